@@ -20,3 +20,17 @@ Vec2I action_direction(Action action) {
     return VEC2I_ZERO;
   }
 }
+
+// The action that moves in a direction, ACTION_NONE if it is not one of the
+// four directions.
+Action action_from_direction(Vec2I direction) {
+  if (vec2i_eq(direction, VEC2I_UP))
+    return (Action){ACTION_MOVE_UP};
+  if (vec2i_eq(direction, VEC2I_DOWN))
+    return (Action){ACTION_MOVE_DOWN};
+  if (vec2i_eq(direction, VEC2I_LEFT))
+    return (Action){ACTION_MOVE_LEFT};
+  if (vec2i_eq(direction, VEC2I_RIGHT))
+    return (Action){ACTION_MOVE_RIGHT};
+  return (Action){ACTION_NONE};
+}
@@ -21,5 +21,6 @@ typedef struct {
 
 void action_init(Action *action);
 Vec2I action_direction(Action action);
+Action action_from_direction(Vec2I direction);
 
 #endif // !SNAKE_ACTION_H
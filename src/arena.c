@@ -0,0 +1,142 @@
+#include <assert.h>
+#include <stddef.h>
+#include <stdlib.h>
+
+#include "arena.h"
+#include "error.h"
+#include "util.h"
+
+void arena_init(Arena *arena, size_t element_size) {
+  assert(element_size >= sizeof(void *));
+  arena->element_size = element_size;
+  for (size_t i = 0; i < ARENA_CLASS_COUNT; ++i) {
+    arena->free_lists[i] = nullptr;
+  }
+  arena->slabs = nullptr;
+  arena->slab_count = 0;
+  arena->slab_capacity = 0;
+  arena->current = 0;
+  arena->offset = 0;
+  arena->stats = (ArenaStats){0};
+}
+
+void arena_free(Arena *arena) {
+  for (size_t i = 0; i < arena->slab_count; ++i) {
+    free(arena->slabs[i].memory);
+  }
+  free(arena->slabs);
+  arena_init(arena, arena->element_size);
+}
+
+// Forgets every block handed out, which must not be used or released
+// afterwards. The slabs are kept, and are carved up again from the start.
+void arena_reset(Arena *arena) {
+  for (size_t i = 0; i < ARENA_CLASS_COUNT; ++i) {
+    arena->free_lists[i] = nullptr;
+    arena->stats.blocks[i] = 0;
+  }
+  arena->current = 0;
+  arena->offset = 0;
+  arena->stats.in_use = 0;
+}
+
+// Returns the size class of a block that holds count elements.
+static size_t size_class(size_t count) {
+  size_t class = 0;
+  while (((size_t)1 << (ARENA_MIN_SHIFT + class)) < count)
+    ++class;
+  if (class >= ARENA_CLASS_COUNT) {
+    report_error("arena block of %zu elements is too large", count);
+    exit(EXIT_FAILURE);
+  }
+  return class;
+}
+
+static size_t class_size(const Arena *arena, size_t class) {
+  return arena->element_size << (ARENA_MIN_SHIFT + class);
+}
+
+// The number of elements the block given for count elements actually holds.
+size_t arena_block_capacity(size_t count) {
+  return (size_t)1 << (ARENA_MIN_SHIFT + size_class(count));
+}
+
+static void add_slab(Arena *arena, size_t size) {
+  if (arena->slab_count == arena->slab_capacity) {
+    const size_t capacity = new_capacity(arena->slab_capacity);
+    ArenaSlab *slabs = realloc(arena->slabs, capacity * sizeof(ArenaSlab));
+    if (slabs == nullptr) {
+      report_error("failed to resize arena slab allocation");
+      exit(EXIT_FAILURE);
+    }
+    arena->slabs = slabs;
+    arena->slab_capacity = capacity;
+  }
+
+  char *memory = malloc(size);
+  if (memory == nullptr) {
+    report_error("failed to allocate arena slab");
+    exit(EXIT_FAILURE);
+  }
+  arena->slabs[arena->slab_count++] = (ArenaSlab){memory, size};
+  ++arena->stats.slab_allocations;
+  arena->stats.reserved += size;
+}
+
+// Carves size bytes from the slabs, moving on to the next slab with enough
+// room when the current one runs out. Whatever is left of the slabs passed
+// over goes unused until the arena is reset.
+static void *carve(Arena *arena, size_t size) {
+  while (arena->current < arena->slab_count) {
+    const ArenaSlab *slab = &arena->slabs[arena->current];
+    if (slab->size - arena->offset >= size) {
+      void *block = slab->memory + arena->offset;
+      arena->offset += size;
+      return block;
+    }
+    ++arena->current;
+    arena->offset = 0;
+  }
+
+  add_slab(arena, max_size(size, ARENA_SLAB_SIZE));
+  arena->current = arena->slab_count - 1;
+  arena->offset = size;
+  return arena->slabs[arena->current].memory;
+}
+
+// Returns a block with room for at least count elements, see
+// arena_block_capacity.
+void *arena_alloc(Arena *arena, size_t count) {
+  const size_t class = size_class(count);
+  const size_t size = class_size(arena, class);
+
+  void *block = arena->free_lists[class];
+  if (block != nullptr) {
+    arena->free_lists[class] = *(void **)block;
+  } else {
+    block = carve(arena, size);
+  }
+
+  ArenaStats *stats = &arena->stats;
+  ++stats->allocations;
+  ++stats->blocks[class];
+  stats->in_use += size;
+  stats->peak_in_use = max_size(stats->peak_in_use, stats->in_use);
+  return block;
+}
+
+// Count must be the number of elements the block was allocated for, or any
+// other number in the same size class. Releasing nullptr does nothing.
+void arena_release(Arena *arena, void *block, size_t count) {
+  if (block == nullptr)
+    return;
+
+  const size_t class = size_class(count);
+  *(void **)block = arena->free_lists[class];
+  arena->free_lists[class] = block;
+
+  ArenaStats *stats = &arena->stats;
+  ++stats->releases;
+  --stats->blocks[class];
+  stats->in_use -= class_size(arena, class);
+}
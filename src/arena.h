@@ -0,0 +1,63 @@
+#ifndef SNAKE_ARENA_H
+#define SNAKE_ARENA_H
+
+#include <stddef.h>
+
+// Blocks hold a power of two number of elements, from 1 << ARENA_MIN_SHIFT
+// up to 1 << (ARENA_MIN_SHIFT + ARENA_CLASS_COUNT - 1).
+#define ARENA_MIN_SHIFT 0
+#define ARENA_CLASS_COUNT 32
+// The size of the slabs blocks are carved from. Blocks larger than this get
+// a slab of their own.
+#define ARENA_SLAB_SIZE ((size_t)256 * 1024)
+
+typedef struct {
+  char *memory;
+  size_t size;
+} ArenaSlab;
+
+typedef struct {
+  // Calls to arena_alloc and arena_release.
+  size_t allocations;
+  size_t releases;
+  // Calls to malloc, one per slab.
+  size_t slab_allocations;
+  // Bytes held in slabs, and bytes in blocks that have been handed out.
+  size_t reserved;
+  size_t in_use;
+  size_t peak_in_use;
+  // The number of blocks handed out of each size class.
+  size_t blocks[ARENA_CLASS_COUNT];
+} ArenaStats;
+
+// A size classed allocator for arrays of fixed size elements, such as the
+// bodies of every player in a game. Blocks are carved from large slabs,
+// released blocks are kept in a free list per size class and handed out
+// again before any more of a slab is used, so once a game has warmed up,
+// growing and replacing arrays does not call malloc. The whole arena can be
+// reset at once, which forgets every block but keeps the slabs. Not thread
+// safe, blocks must be allocated and released by one thread at a time.
+typedef struct {
+  size_t element_size;
+  // The first released block of each class, each free block starts with a
+  // pointer to the next.
+  void *free_lists[ARENA_CLASS_COUNT];
+  ArenaSlab *slabs;
+  size_t slab_count;
+  size_t slab_capacity;
+  // The slab blocks are carved from, and how much of it has been used.
+  size_t current;
+  size_t offset;
+  ArenaStats stats;
+} Arena;
+
+// Element size must be at least the size of a pointer.
+void arena_init(Arena *arena, size_t element_size);
+void arena_free(Arena *arena);
+void arena_reset(Arena *arena);
+
+size_t arena_block_capacity(size_t count);
+void *arena_alloc(Arena *arena, size_t count);
+void arena_release(Arena *arena, void *block, size_t count);
+
+#endif // !SNAKE_ARENA_H
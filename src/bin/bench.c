@@ -0,0 +1,735 @@
+// Microbenchmarks for the hot primitives of the game: the player deque and
+// cursor, key map lookups, wrapping positions, writing vertices and indices,
+// the bitboard kernels, and whole ticks at several scales. Each benchmark is
+// run a few times to warm up, then repeated, and the minimum and median time
+// per op of the repetitions are reported, along with cycles per op on x86-64.
+//
+// usage: snake-bench [--filter TEXT] [--repetitions N] [--warmup N]
+//                    [--output PATH] [--baseline PATH] [--threshold PERCENT]
+//
+// --output writes the results as JSON, a file written this way can be passed
+// back as --baseline to a later run, which flags every benchmark whose median
+// got slower by more than the threshold, 10% by default, and exits with a
+// failure if any did.
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+#include "arena.h"
+#include "bitboard.h"
+#include "bot.h"
+#include "config.h"
+#include "error.h"
+#include "game.h"
+#include "input.h"
+#include "map.h"
+#include "player.h"
+#include "rng.h"
+#include "util.h"
+#include "vec.h"
+#include "vertex.h"
+
+#define BENCH_MAX_REPETITIONS 1000
+#define BENCH_NAME_SIZE 64
+
+// Accumulates the time spent between timer_start and timer_stop, so that a
+// benchmark can leave its setup out of the measurement.
+typedef struct {
+  uint64_t ns;
+  uint64_t cycles;
+  uint64_t start_ns;
+  uint64_t start_cycles;
+} Timer;
+
+// The time stamp counter ticks at a constant rate rather than with the
+// core's clock, so cycles are reference cycles. Zero where there is no
+// counter to read.
+static inline uint64_t read_cycles(void) {
+#if defined(__x86_64__) || defined(__i386__)
+  return __rdtsc();
+#else
+  return 0;
+#endif
+}
+
+static inline void timer_start(Timer *timer) {
+  timer->start_ns = time_ns();
+  timer->start_cycles = read_cycles();
+}
+
+static inline void timer_stop(Timer *timer) {
+  timer->cycles += read_cycles() - timer->start_cycles;
+  timer->ns += time_ns() - timer->start_ns;
+}
+
+typedef struct {
+  const char *name;
+  // The units of work done by one repetition, times are reported per op.
+  size_t ops;
+  void *(*setup)(void);
+  void (*run)(void *state, Timer *timer);
+  void (*teardown)(void *state);
+} Benchmark;
+
+typedef struct {
+  const char *name;
+  size_t ops;
+  unsigned int repetitions;
+  double min_ns;
+  double median_ns;
+  double min_cycles;
+  double median_cycles;
+} BenchResult;
+
+// Keeps the compiler from optimising away work whose result is unused.
+static volatile uint64_t sink;
+
+static void *allocate(size_t size) {
+  void *memory = calloc(1, size);
+  if (memory == nullptr) {
+    report_error("failed to allocate benchmark state");
+    exit(EXIT_FAILURE);
+  }
+  return memory;
+}
+
+// Player deque.
+
+#define DEQUE_LENGTH 1024
+#define DEQUE_OPS (1 << 16)
+#define CURSOR_LENGTH 4096
+#define CURSOR_WALKS 16
+
+typedef struct {
+  Arena arena;
+  Player player;
+} PlayerState;
+
+static Vec2I wrap(Vec2I pos, Vec2I bounds) {
+  return vec2i((pos.x + bounds.x) % bounds.x, (pos.y + bounds.y) % bounds.y);
+}
+
+// Grows a player to length segments, turning at random, but never back on
+// itself, so that its links are not all the same.
+static void *player_setup(size_t length, bool turns) {
+  PlayerState *state = allocate(sizeof(PlayerState));
+  arena_init(&state->arena, sizeof(uint64_t));
+  player_init(&state->player);
+
+  const Vec2I bounds = vec2i(4096, 4096);
+  Player *player = &state->player;
+  player_spawn(player, &state->arena, bounds, vec2i(1, 0), vec2i(0, 0));
+  player_reserve(player, &state->arena, length + 1);
+
+  Rng rng;
+  rng_init(&rng, 1);
+  Vec2I forward = VEC2I_RIGHT;
+  while (player->count < length) {
+    if (turns && rng_range(&rng, 2) == 0) {
+      forward = rng_range(&rng, 2) == 0 ? vec2i(-forward.y, forward.x)
+                                        : vec2i(forward.y, -forward.x);
+    }
+    player_push_front(player, wrap(vec2i_add(player->head, forward), bounds));
+  }
+  return state;
+}
+
+static void player_teardown(void *context) {
+  PlayerState *state = context;
+  player_free(&state->player, &state->arena);
+  arena_free(&state->arena);
+  free(state);
+}
+
+static void *deque_setup(void) {
+  return player_setup(DEQUE_LENGTH, false);
+}
+
+// One op moves the player a cell, as a tick does.
+static void deque_run(void *context, Timer *timer) {
+  Player *player = &((PlayerState *)context)->player;
+  timer_start(timer);
+  for (size_t i = 0; i < DEQUE_OPS; ++i) {
+    player_push_front(player, wrap(vec2i_add(player->head, VEC2I_RIGHT),
+                                   player->bounds));
+    player_pop_back(player);
+  }
+  timer_stop(timer);
+}
+
+static void *cursor_setup(void) {
+  return player_setup(CURSOR_LENGTH, true);
+}
+
+// One op visits a segment.
+static void cursor_run(void *context, Timer *timer) {
+  const Player *player = &((PlayerState *)context)->player;
+  uint64_t sum = 0;
+  timer_start(timer);
+  for (size_t i = 0; i < CURSOR_WALKS; ++i) {
+    PlayerCursor cursor = player_cursor(player);
+    Vec2I pos;
+    while (player_cursor_next(&cursor, &pos))
+      sum += pos.x ^ pos.y;
+  }
+  timer_stop(timer);
+  sink = sum;
+}
+
+// Key map.
+
+#define KEYMAP_KEYS 256
+#define KEYMAP_OPS (1 << 16)
+
+typedef struct {
+  KeyMap keymap;
+  // Keys that are mapped, and keys that were mapped and then removed, which
+  // leave tombstones that lookups have to probe past.
+  uint16_t live[KEYMAP_KEYS / 2];
+  uint16_t removed[KEYMAP_KEYS / 2];
+} KeyMapState;
+
+static void *keymap_setup(void) {
+  KeyMapState *state = allocate(sizeof(KeyMapState));
+  keymap_init(&state->keymap);
+  for (uint16_t key = 1; key <= KEYMAP_KEYS; ++key) {
+    keymap_map(&state->keymap, key, PLAYER_HANDLE_NULL,
+               (Action){ACTION_MOVE_UP});
+  }
+  for (uint16_t i = 0; i < KEYMAP_KEYS / 2; ++i) {
+    state->live[i] = 2 * i + 1;
+    state->removed[i] = 2 * i + 2;
+    keymap_unmap(&state->keymap, state->removed[i]);
+  }
+  return state;
+}
+
+static void keymap_teardown(void *context) {
+  KeyMapState *state = context;
+  keymap_free(&state->keymap);
+  free(state);
+}
+
+static void keymap_lookup(KeyMapState *state, const uint16_t *keys,
+                          Timer *timer) {
+  PlayerHandle player;
+  Action action;
+  uint64_t found = 0;
+  timer_start(timer);
+  for (size_t i = 0; i < KEYMAP_OPS; ++i) {
+    found += keymap_action(&state->keymap, keys[i % (KEYMAP_KEYS / 2)],
+                           &player, &action);
+  }
+  timer_stop(timer);
+  sink = found;
+}
+
+static void keymap_hit_run(void *context, Timer *timer) {
+  KeyMapState *state = context;
+  keymap_lookup(state, state->live, timer);
+}
+
+static void keymap_miss_run(void *context, Timer *timer) {
+  KeyMapState *state = context;
+  keymap_lookup(state, state->removed, timer);
+}
+
+// Map.
+
+#define WRAP_POSITIONS 4096
+#define WRAP_OPS (1 << 16)
+#define VERTICES_SIZE 256
+#define VERTICES_CALLS 4
+
+typedef struct {
+  Game game;
+  Vec2I positions[WRAP_POSITIONS];
+  Vertex *vertices;
+  unsigned int *indices;
+} MapState;
+
+// A walled map with some players on it.
+static void *map_setup(void) {
+  MapState *state = allocate(sizeof(MapState));
+  Config config;
+  config_init(&config);
+  config.map_width = VERTICES_SIZE;
+  config.map_height = VERTICES_SIZE;
+  config.player_count = 256;
+  game_setup(&state->game, &config);
+
+  // Half of the positions are outside the map, on either side.
+  const Map *map = &state->game.map;
+  Rng rng;
+  rng_init(&rng, 1);
+  for (size_t i = 0; i < WRAP_POSITIONS; ++i) {
+    state->positions[i] =
+        vec2i((int)rng_range(&rng, 2 * map->width) - map->width / 2,
+              (int)rng_range(&rng, 2 * map->height) - map->height / 2);
+  }
+
+  const size_t cell_count = (size_t)map->width * map->height;
+  state->vertices = allocate(4 * cell_count * sizeof(Vertex));
+  state->indices = allocate(6 * cell_count * sizeof(unsigned int));
+  return state;
+}
+
+static void map_teardown(void *context) {
+  MapState *state = context;
+  free(state->vertices);
+  free(state->indices);
+  game_free(&state->game);
+  free(state);
+}
+
+static void wrap_run(void *context, Timer *timer) {
+  MapState *state = context;
+  uint64_t sum = 0;
+  timer_start(timer);
+  for (size_t i = 0; i < WRAP_OPS; ++i) {
+    const Vec2I pos = map_wrap_pos(&state->game.map,
+                                   state->positions[i % WRAP_POSITIONS]);
+    sum += pos.x ^ pos.y;
+  }
+  timer_stop(timer);
+  sink = sum;
+}
+
+// One op writes a cell.
+static void vertices_run(void *context, Timer *timer) {
+  MapState *state = context;
+  timer_start(timer);
+  for (size_t i = 0; i < VERTICES_CALLS; ++i) {
+    write_vertices(&state->game.map, state->vertices);
+  }
+  timer_stop(timer);
+  sink = state->vertices[4 * VERTICES_SIZE].type;
+}
+
+static void indices_run(void *context, Timer *timer) {
+  MapState *state = context;
+  timer_start(timer);
+  for (size_t i = 0; i < VERTICES_CALLS; ++i) {
+    write_indices(&state->game.map, state->indices);
+  }
+  timer_stop(timer);
+  sink = state->indices[6 * VERTICES_SIZE];
+}
+
+// Bitboards, run on the blocked index of the map above.
+
+#define BITBOARD_CALLS 16
+#define NEIGHBOURS_OPS (1 << 16)
+
+typedef struct {
+  MapState *map;
+  Bitboard out;
+} BitboardState;
+
+static void *bitboard_setup(void) {
+  BitboardState *state = allocate(sizeof(BitboardState));
+  state->map = map_setup();
+  bitboard_init(&state->out);
+  return state;
+}
+
+static void bitboard_teardown(void *context) {
+  BitboardState *state = context;
+  bitboard_free(&state->out);
+  map_teardown(state->map);
+  free(state);
+}
+
+// One op is a cell of the board, for the whole board kernels.
+static void count_run(void *context, Timer *timer) {
+  const Bitboard *blocked = &((BitboardState *)context)->map->game.map.blocked;
+  uint64_t sum = 0;
+  timer_start(timer);
+  for (size_t i = 0; i < BITBOARD_CALLS; ++i) {
+    sum += bitboard_count(blocked);
+  }
+  timer_stop(timer);
+  sink = sum;
+}
+
+static void neighbours_run(void *context, Timer *timer) {
+  MapState *map = ((BitboardState *)context)->map;
+  const Bitboard *blocked = &map->game.map.blocked;
+  uint64_t sum = 0;
+  timer_start(timer);
+  for (size_t i = 0; i < NEIGHBOURS_OPS; ++i) {
+    const Vec2I pos = map_wrap_pos(&map->game.map,
+                                   map->positions[i % WRAP_POSITIONS]);
+    sum += bitboard_clear_neighbours(blocked, pos);
+  }
+  timer_stop(timer);
+  sink = sum;
+}
+
+static void neighbours_at_least_run(void *context, Timer *timer) {
+  BitboardState *state = context;
+  const Bitboard *blocked = &state->map->game.map.blocked;
+  timer_start(timer);
+  for (size_t i = 0; i < BITBOARD_CALLS; ++i) {
+    bitboard_clear_neighbours_at_least(blocked, 3, &state->out);
+  }
+  timer_stop(timer);
+  sink = state->out.words[0];
+}
+
+// Floods the open area around the middle of the map, which takes in most of
+// it.
+static void flood_run(void *context, Timer *timer) {
+  BitboardState *state = context;
+  const Bitboard *blocked = &state->map->game.map.blocked;
+  Vec2I start = vec2i(VERTICES_SIZE / 2, VERTICES_SIZE / 2);
+  if (!bitboard_next_clear_pair(blocked, &start))
+    return;
+
+  uint64_t sum = 0;
+  timer_start(timer);
+  for (size_t i = 0; i < BITBOARD_CALLS; ++i) {
+    sum += bitboard_flood(blocked, start, SIZE_MAX, &state->out);
+  }
+  timer_stop(timer);
+  sink = sum;
+}
+
+// Game updates.
+
+typedef struct {
+  unsigned int size;
+  unsigned int bot_count;
+  unsigned int ticks;
+  Game game;
+  BotController bots;
+  bool ready;
+} GameState;
+
+static void *game_state(unsigned int size, unsigned int bot_count,
+                        unsigned int ticks) {
+  GameState *state = allocate(sizeof(GameState));
+  state->size = size;
+  state->bot_count = bot_count;
+  state->ticks = ticks;
+  state->ready = false;
+  return state;
+}
+
+#define GAME_SMALL_TICKS 200
+#define GAME_MEDIUM_TICKS 50
+#define GAME_LARGE_TICKS 20
+
+static void *game_small_setup(void) {
+  return game_state(64, 64, GAME_SMALL_TICKS);
+}
+
+static void *game_medium_setup(void) {
+  return game_state(256, 1000, GAME_MEDIUM_TICKS);
+}
+
+static void *game_large_setup(void) {
+  return game_state(1024, 4000, GAME_LARGE_TICKS);
+}
+
+static void game_release(GameState *state) {
+  if (!state->ready)
+    return;
+  bots_free(&state->bots);
+  game_free(&state->game);
+  state->ready = false;
+}
+
+static void game_teardown(void *context) {
+  game_release(context);
+  free(context);
+}
+
+// Every player is a bot, so the game plays out the same way every
+// repetition. Each repetition starts a new game, and only game_update is
+// timed, deciding the bots' moves is left out. One op is one tick.
+static void game_run(void *context, Timer *timer) {
+  GameState *state = context;
+  game_release(state);
+
+  Config config;
+  config_init(&config);
+  config.map_width = state->size;
+  config.map_height = state->size;
+  config.player_count = 0;
+  game_setup(&state->game, &config);
+  bots_init(&state->bots);
+  bots_spawn(&state->bots, &state->game, state->bot_count);
+  state->ready = true;
+
+  for (unsigned int i = 0; i < state->ticks; ++i) {
+    bots_update(&state->bots, &state->game);
+    timer_start(timer);
+    game_update(&state->game);
+    timer_stop(timer);
+  }
+}
+
+static const Benchmark benchmarks[] = {
+    {"player_push_pop", DEQUE_OPS, deque_setup, deque_run, player_teardown},
+    {"player_cursor", CURSOR_LENGTH * CURSOR_WALKS, cursor_setup, cursor_run,
+     player_teardown},
+    {"keymap_hit", KEYMAP_OPS, keymap_setup, keymap_hit_run, keymap_teardown},
+    {"keymap_miss", KEYMAP_OPS, keymap_setup, keymap_miss_run,
+     keymap_teardown},
+    {"map_wrap_pos", WRAP_OPS, map_setup, wrap_run, map_teardown},
+    {"write_vertices", VERTICES_SIZE * VERTICES_SIZE * VERTICES_CALLS,
+     map_setup, vertices_run, map_teardown},
+    {"write_indices", VERTICES_SIZE * VERTICES_SIZE * VERTICES_CALLS,
+     map_setup, indices_run, map_teardown},
+    {"bitboard_count", VERTICES_SIZE * VERTICES_SIZE * BITBOARD_CALLS,
+     bitboard_setup, count_run, bitboard_teardown},
+    {"bitboard_clear_neighbours", NEIGHBOURS_OPS, bitboard_setup,
+     neighbours_run, bitboard_teardown},
+    {"bitboard_neighbours_at_least",
+     VERTICES_SIZE * VERTICES_SIZE * BITBOARD_CALLS, bitboard_setup,
+     neighbours_at_least_run, bitboard_teardown},
+    {"bitboard_flood", VERTICES_SIZE * VERTICES_SIZE * BITBOARD_CALLS,
+     bitboard_setup, flood_run, bitboard_teardown},
+    {"game_update_64", GAME_SMALL_TICKS, game_small_setup, game_run,
+     game_teardown},
+    {"game_update_256", GAME_MEDIUM_TICKS, game_medium_setup, game_run,
+     game_teardown},
+    {"game_update_1024", GAME_LARGE_TICKS, game_large_setup, game_run,
+     game_teardown},
+};
+
+#define BENCHMARK_COUNT (sizeof(benchmarks) / sizeof(benchmarks[0]))
+
+static int compare_doubles(const void *a, const void *b) {
+  const double x = *(const double *)a;
+  const double y = *(const double *)b;
+  return (x > y) - (x < y);
+}
+
+static double median(double *values, size_t count) {
+  qsort(values, count, sizeof(double), compare_doubles);
+  return count % 2 == 1 ? values[count / 2]
+                        : (values[count / 2 - 1] + values[count / 2]) / 2;
+}
+
+static BenchResult run_benchmark(const Benchmark *benchmark,
+                                 unsigned int warmup,
+                                 unsigned int repetitions) {
+  static double ns[BENCH_MAX_REPETITIONS];
+  static double cycles[BENCH_MAX_REPETITIONS];
+
+  void *state = benchmark->setup();
+  for (unsigned int i = 0; i < warmup + repetitions; ++i) {
+    Timer timer = {0};
+    benchmark->run(state, &timer);
+    if (i >= warmup) {
+      ns[i - warmup] = (double)timer.ns / benchmark->ops;
+      cycles[i - warmup] = (double)timer.cycles / benchmark->ops;
+    }
+  }
+  benchmark->teardown(state);
+
+  // Finding the median sorts the samples, so the minimum comes first.
+  BenchResult result = {benchmark->name, benchmark->ops, repetitions};
+  result.median_ns = median(ns, repetitions);
+  result.min_ns = ns[0];
+  result.median_cycles = median(cycles, repetitions);
+  result.min_cycles = cycles[0];
+  return result;
+}
+
+// Results are written one benchmark to a line, which is what load_baseline
+// expects.
+static bool write_results(const char *path, const BenchResult *results,
+                          size_t count) {
+  FILE *f = fopen(path, "w");
+  if (f == nullptr) {
+    report_error("failed to open file: %s", path);
+    return false;
+  }
+
+  fprintf(f, "{\"benchmarks\": [\n");
+  for (size_t i = 0; i < count; ++i) {
+    const BenchResult *r = &results[i];
+    fprintf(f,
+            "  {\"name\": \"%s\", \"ops\": %zu, \"repetitions\": %u, "
+            "\"min_ns\": %.4f, \"median_ns\": %.4f, \"min_cycles\": %.4f, "
+            "\"median_cycles\": %.4f}%s\n",
+            r->name, r->ops, r->repetitions, r->min_ns, r->median_ns,
+            r->min_cycles, r->median_cycles, i + 1 < count ? "," : "");
+  }
+  fprintf(f, "]}\n");
+
+  const bool success = !ferror(f);
+  if (fclose(f) != 0 || !success) {
+    report_error("failed to write results: %s", path);
+    return false;
+  }
+  return true;
+}
+
+typedef struct {
+  char name[BENCH_NAME_SIZE];
+  double median_ns;
+} BaselineEntry;
+
+// Reads the name and median of every benchmark in a file written by
+// write_results. Returns false if the file cannot be read.
+static bool load_baseline(const char *path, BaselineEntry *entries,
+                          size_t capacity, size_t *count) {
+  FILE *f = fopen(path, "r");
+  if (f == nullptr) {
+    report_error("failed to open file: %s", path);
+    return false;
+  }
+
+  *count = 0;
+  char line[512];
+  while (*count < capacity && fgets(line, sizeof(line), f) != nullptr) {
+    BaselineEntry *entry = &entries[*count];
+    const char *median = strstr(line, "\"median_ns\": ");
+    if (sscanf(line, " {\"name\": \"%63[^\"]\"", entry->name) != 1 ||
+        median == nullptr ||
+        sscanf(median, "\"median_ns\": %lf", &entry->median_ns) != 1)
+      continue;
+    ++*count;
+  }
+
+  fclose(f);
+  return true;
+}
+
+static const BaselineEntry *find_baseline(const BaselineEntry *entries,
+                                          size_t count, const char *name) {
+  for (size_t i = 0; i < count; ++i) {
+    if (strcmp(entries[i].name, name) == 0)
+      return &entries[i];
+  }
+  return nullptr;
+}
+
+typedef struct {
+  const char *filter;
+  unsigned int repetitions;
+  unsigned int warmup;
+  const char *output_path;
+  const char *baseline_path;
+  double threshold;
+} BenchOptions;
+
+static bool parse_unsigned(const char *arg, unsigned int *value) {
+  char *end;
+  const unsigned long parsed = strtoul(arg, &end, 10);
+  if (*arg == '\0' || *end != '\0' || parsed > UINT32_MAX)
+    return false;
+  *value = parsed;
+  return true;
+}
+
+static bool parse_options(BenchOptions *options, int argc, const char **argv) {
+  *options = (BenchOptions){nullptr, 10, 2, nullptr, nullptr, 10.0};
+  for (int i = 1; i < argc; ++i) {
+    const char *arg = argv[i];
+    const char *value = i + 1 < argc ? argv[i + 1] : nullptr;
+    if (value == nullptr) {
+      report_error("missing value for '%s'", arg);
+      return false;
+    }
+    ++i;
+
+    if (strcmp(arg, "--filter") == 0) {
+      options->filter = value;
+    } else if (strcmp(arg, "--repetitions") == 0) {
+      if (!parse_unsigned(value, &options->repetitions) ||
+          options->repetitions < 1 ||
+          options->repetitions > BENCH_MAX_REPETITIONS) {
+        report_error("repetitions must be between 1 and %d",
+                     BENCH_MAX_REPETITIONS);
+        return false;
+      }
+    } else if (strcmp(arg, "--warmup") == 0) {
+      if (!parse_unsigned(value, &options->warmup)) {
+        report_error("invalid warmup '%s'", value);
+        return false;
+      }
+    } else if (strcmp(arg, "--output") == 0) {
+      options->output_path = value;
+    } else if (strcmp(arg, "--baseline") == 0) {
+      options->baseline_path = value;
+    } else if (strcmp(arg, "--threshold") == 0) {
+      char *end;
+      options->threshold = strtod(value, &end);
+      if (*end != '\0' || options->threshold < 0.0) {
+        report_error("invalid threshold '%s'", value);
+        return false;
+      }
+    } else {
+      report_error("unexpected argument '%s'", arg);
+      return false;
+    }
+  }
+  return true;
+}
+
+int main(int argc, const char **argv) {
+  BenchOptions options;
+  if (!parse_options(&options, argc, argv))
+    return EXIT_FAILURE;
+
+  BaselineEntry baseline[BENCHMARK_COUNT];
+  size_t baseline_count = 0;
+  if (options.baseline_path &&
+      !load_baseline(options.baseline_path, baseline, BENCHMARK_COUNT,
+                     &baseline_count))
+    return EXIT_FAILURE;
+
+  printf("  %-28s %12s %12s %10s %10s %9s\n", "benchmark", "min ns/op",
+         "median ns/op", "min cyc", "median cyc", "baseline");
+
+  BenchResult results[BENCHMARK_COUNT];
+  size_t result_count = 0;
+  unsigned int regressions = 0;
+  for (size_t i = 0; i < BENCHMARK_COUNT; ++i) {
+    const Benchmark *benchmark = &benchmarks[i];
+    if (options.filter && !strstr(benchmark->name, options.filter))
+      continue;
+
+    const BenchResult result =
+        run_benchmark(benchmark, options.warmup, options.repetitions);
+    results[result_count++] = result;
+    printf("  %-28s %12.3f %12.3f %10.1f %10.1f", result.name, result.min_ns,
+           result.median_ns, result.min_cycles, result.median_cycles);
+
+    const BaselineEntry *base =
+        find_baseline(baseline, baseline_count, result.name);
+    if (base != nullptr && base->median_ns > 0.0) {
+      const double change =
+          100.0 * (result.median_ns - base->median_ns) / base->median_ns;
+      const bool regressed = change > options.threshold;
+      regressions += regressed;
+      printf(" %+8.1f%%%s", change, regressed ? " REGRESSION" : "");
+    } else if (options.baseline_path) {
+      printf(" %9s", "new");
+    }
+    printf("\n");
+    fflush(stdout);
+  }
+
+  if (options.output_path &&
+      !write_results(options.output_path, results, result_count))
+    return EXIT_FAILURE;
+
+  if (regressions > 0) {
+    printf("%u of %zu benchmarks regressed by more than %.1f%%\n",
+           regressions, result_count, options.threshold);
+    return EXIT_FAILURE;
+  }
+  return EXIT_SUCCESS;
+}
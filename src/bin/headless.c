@@ -0,0 +1,289 @@
+// Runs the simulation without a window or an OpenGL context, as fast as
+// possible, and reports how long each phase of a tick takes.
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "action.h"
+#include "arena.h"
+#include "bot.h"
+#include "config.h"
+#include "error.h"
+#include "game.h"
+#include "map.h"
+#include "player.h"
+#include "replay.h"
+#include "rng.h"
+#include "trace.h"
+#include "util.h"
+#include "vec.h"
+
+// A single scripted input, applied at the start of the given tick.
+typedef struct {
+  unsigned int tick;
+  unsigned int player_id;
+  Action action;
+} ScriptEntry;
+
+typedef struct {
+  ScriptEntry *entries;
+  size_t capacity;
+  size_t count;
+  // Index of the next entry to apply.
+  size_t cursor;
+} Script;
+
+static void script_init(Script *script) {
+  script->entries = nullptr;
+  script->capacity = 0;
+  script->count = 0;
+  script->cursor = 0;
+}
+
+static void script_free(Script *script) {
+  free(script->entries);
+  script_init(script);
+}
+
+static bool parse_action(const char *name, Action *action) {
+  if (strcmp(name, "up") == 0) {
+    action->type = ACTION_MOVE_UP;
+  } else if (strcmp(name, "down") == 0) {
+    action->type = ACTION_MOVE_DOWN;
+  } else if (strcmp(name, "left") == 0) {
+    action->type = ACTION_MOVE_LEFT;
+  } else if (strcmp(name, "right") == 0) {
+    action->type = ACTION_MOVE_RIGHT;
+  } else {
+    return false;
+  }
+
+  return true;
+}
+
+// Scripts are plain text, one input per line in the form
+// `<tick> <player id> <up|down|left|right>`, sorted by tick.
+static bool script_load(Script *script, const char *path) {
+  FILE *f = fopen(path, "r");
+  if (f == nullptr) {
+    report_error("failed to open script: %s", path);
+    return false;
+  }
+
+  unsigned int tick;
+  unsigned int player_id;
+  char name[16];
+  int line = 1;
+  int matched;
+  while ((matched = fscanf(f, "%u %u %15s", &tick, &player_id, name)) == 3) {
+    ScriptEntry entry = {tick, player_id};
+    if (!parse_action(name, &entry.action)) {
+      report_error("%s:%i: unknown action '%s'", path, line, name);
+      fclose(f);
+      return false;
+    }
+
+    if (script->count > 0 && script->entries[script->count - 1].tick > tick) {
+      report_error("%s:%i: script entries must be sorted by tick", path, line);
+      fclose(f);
+      return false;
+    }
+
+    if (script->count == script->capacity) {
+      size_t capacity = new_capacity(script->capacity);
+      ScriptEntry *entries =
+          realloc(script->entries, capacity * sizeof(ScriptEntry));
+      if (entries == nullptr) {
+        report_error("failed to resize script allocation");
+        exit(EXIT_FAILURE);
+      }
+      script->entries = entries;
+      script->capacity = capacity;
+    }
+
+    script->entries[script->count++] = entry;
+    ++line;
+  }
+
+  bool success = matched == EOF;
+  if (!success) {
+    report_error("%s:%i: expected '<tick> <player id> <action>'", path, line);
+  }
+
+  fclose(f);
+  return success;
+}
+
+static void script_apply(Script *script, Game *game, unsigned int tick) {
+  while (script->cursor < script->count &&
+         script->entries[script->cursor].tick <= tick) {
+    ScriptEntry *entry = &script->entries[script->cursor++];
+    PlayerData *player_data =
+        entry->tick == tick ? players_get_slot(&game->players, entry->player_id)
+                            : nullptr;
+    if (player_data != nullptr) {
+      player_data->current_action = entry->action;
+    }
+  }
+}
+
+static bool is_blocked(const Map *map, Vec2I pos) {
+  CellType type = map_get_cell(map, map_wrap_pos(map, pos)).type;
+  return type == CELL_WALL || type == CELL_PLAYER;
+}
+
+// Random inputs, players turn every now and then and otherwise only turn to
+// avoid running into something directly in front of them. This keeps players
+// alive long enough for a run to be representative.
+static void random_apply(Rng *rng, Game *game) {
+  for (size_t i = 0; i < game->players.count; ++i) {
+    PlayerData *player_data = &game->players.data[i];
+    Player *player = &player_data->player;
+    if (!player->alive)
+      continue;
+
+    Vec2I head = player_front(player);
+    Vec2I forward = player_head_forward(player);
+    Vec2I left = vec2i(-forward.y, forward.x);
+    Vec2I right = vec2i(forward.y, -forward.x);
+
+    Vec2I candidates[3];
+    int candidate_count = 0;
+    if (!is_blocked(&game->map, vec2i_add(head, forward)))
+      candidates[candidate_count++] = forward;
+    if (!is_blocked(&game->map, vec2i_add(head, left)))
+      candidates[candidate_count++] = left;
+    if (!is_blocked(&game->map, vec2i_add(head, right)))
+      candidates[candidate_count++] = right;
+
+    if (candidate_count == 0)
+      continue;
+
+    bool forward_free = vec2i_eq(candidates[0], forward);
+    if (forward_free && rng_range(rng, 8) != 0)
+      continue;
+
+    Vec2I direction = candidates[rng_range(rng, candidate_count)];
+    player_data->current_action = action_from_direction(direction);
+  }
+}
+
+static void report_phase(const char *name, uint64_t ns, uint64_t total_ns,
+                         unsigned int ticks) {
+  printf("  %-12s %12.1f ns/tick %6.1f%%\n", name, (double)ns / ticks,
+         total_ns > 0 ? 100.0 * ns / total_ns : 0.0);
+}
+
+int main(int argc, const char **argv) {
+  TRACE_THREAD_NAME("main");
+  Config config;
+  config_init(&config);
+  if (!config_from_args(&config, argc, argv)) {
+    return EXIT_FAILURE;
+  }
+
+  Script script;
+  script_init(&script);
+  if (config.script_path && !script_load(&script, config.script_path)) {
+    return EXIT_FAILURE;
+  }
+
+  Rng rng;
+  rng_init(&rng, config.seed);
+
+  Game game;
+  game_setup(&game, &config);
+
+  BotController bots;
+  bots_init(&bots);
+  const unsigned int bot_count = bots_spawn(&bots, &game, config.bot_count);
+  if (bot_count < config.bot_count) {
+    report_error("map has no room for %u bots", config.bot_count);
+    return EXIT_FAILURE;
+  }
+
+  Recorder recorder;
+  recorder_init(&recorder);
+  if (config.record_path &&
+      !recorder_open(&recorder, config.record_path, &config)) {
+    return EXIT_FAILURE;
+  }
+
+  // Slabs allocated after setup, growing snakes should rarely need one.
+  const ArenaStats setup_bodies = game.players.bodies.stats;
+
+  uint64_t input_ns = 0;
+  uint64_t bots_ns = 0;
+  uint64_t update_ns = 0;
+  const uint64_t start = time_ns();
+  for (unsigned int tick = 0; tick < config.tick_count; ++tick) {
+    const uint64_t t0 = time_ns();
+    if (config.script_path) {
+      script_apply(&script, &game, tick);
+    } else {
+      random_apply(&rng, &game);
+    }
+
+    const uint64_t tb = time_ns();
+    bots_update(&bots, &game);
+    recorder_record(&recorder, &game);
+
+    const uint64_t t1 = time_ns();
+    game_update(&game);
+
+    const uint64_t t2 = time_ns();
+    input_ns += tb - t0;
+    bots_ns += t1 - tb;
+    update_ns += t2 - t1;
+  }
+  const uint64_t total_ns = time_ns() - start;
+
+  unsigned int alive = 0;
+  for (size_t i = 0; i < game.players.count; ++i) {
+    alive += game.players.data[i].player.alive;
+  }
+  unsigned int bots_alive = 0;
+  for (size_t i = 0; i < bots.count; ++i) {
+    bots_alive += players_get(&game.players, bots.players[i])->player.alive;
+  }
+
+  const unsigned int ticks = config.tick_count > 0 ? config.tick_count : 1;
+  printf("map %ux%u, %u players, %u bots, %u ticks, %s inputs\n",
+         game.map.width, game.map.height, config.player_count, bot_count,
+         config.tick_count, config.script_path ? "scripted" : "random");
+  printf("  %-12s %12.3f ms\n", "total", total_ns / 1e6);
+  printf("  %-12s %12.1f\n", "ticks/sec",
+         total_ns > 0 ? config.tick_count / (total_ns / 1e9) : 0.0);
+  printf("  %-12s %12.1f\n", "ns/tick", (double)total_ns / ticks);
+  report_phase("game_update", update_ns, total_ns, ticks);
+  report_phase("inputs", input_ns, total_ns, ticks);
+  report_phase("bots", bots_ns, total_ns, ticks);
+  printf("  %-12s %9u/%u\n", "alive", alive, config.player_count + bot_count);
+  printf("  %-12s %9u/%u\n", "bots alive", bots_alive, bot_count);
+
+  const ArenaStats *bodies = &game.players.bodies.stats;
+  printf("  %-12s %12.1f KiB in use, %.1f KiB peak, %.1f KiB reserved\n",
+         "bodies", bodies->in_use / 1024.0, bodies->peak_in_use / 1024.0,
+         bodies->reserved / 1024.0);
+  printf("  %-12s %12zu allocs, %zu releases, %zu slabs (%zu during ticks)\n",
+         "", bodies->allocations, bodies->releases,
+         bodies->slab_allocations,
+         bodies->slab_allocations - setup_bodies.slab_allocations);
+
+  // The summary covers the last ticks of the run, as far back as the trace
+  // buffers reach.
+  bool traced = true;
+  if (config.trace_path) {
+    trace_report(stdout);
+    traced = trace_write_json(config.trace_path);
+  }
+
+  recorder_close(&recorder, &game);
+  bots_free(&bots);
+  game_free(&game);
+  script_free(&script);
+
+  return traced ? EXIT_SUCCESS : EXIT_FAILURE;
+}
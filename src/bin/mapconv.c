@@ -0,0 +1,35 @@
+// Converts a text map, written with the same symbols as map_debug, into a
+// binary map file that can be passed to the game with --map.
+//
+// usage: snake-mapconv <input.txt> <output.snkm>
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "error.h"
+#include "map.h"
+#include "mapfile.h"
+
+int main(int argc, const char **argv) {
+  if (argc != 3) {
+    report_error("usage: %s <input.txt> <output.snkm>", argv[0]);
+    return EXIT_FAILURE;
+  }
+
+  Map map;
+  map_init(&map);
+  if (!map_load_text(&map, argv[1])) {
+    map_free(&map);
+    return EXIT_FAILURE;
+  }
+
+  if (!map_save(&map, argv[2])) {
+    map_free(&map);
+    return EXIT_FAILURE;
+  }
+
+  printf("%ux%u cells, %zu of %u chunks stored\n", map.width, map.height,
+         map_allocated_chunk_count(&map), map.chunk_columns * map.chunk_rows);
+  map_free(&map);
+  return EXIT_SUCCESS;
+}
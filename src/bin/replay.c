@@ -0,0 +1,80 @@
+// Plays back a replay recorded with --record as fast as possible, without a
+// window, and checks that the game matches every keyframe it passes.
+//
+// usage: snake-replay <replay> [<tick to seek to>] [<threads>]
+
+#include <inttypes.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "error.h"
+#include "game.h"
+#include "pool.h"
+#include "replay.h"
+#include "util.h"
+
+static bool parse_u64(const char *arg, uint64_t *out) {
+  char *end;
+  *out = strtoull(arg, &end, 10);
+  return *arg != '\0' && *end == '\0';
+}
+
+int main(int argc, const char **argv) {
+  uint64_t seek_tick = 0;
+  uint64_t thread_count = 1;
+  if (argc < 2 || argc > 4 || (argc > 2 && !parse_u64(argv[2], &seek_tick)) ||
+      (argc > 3 && !parse_u64(argv[3], &thread_count))) {
+    report_error("usage: %s <replay> [<tick to seek to>] [<threads>]",
+                 argv[0]);
+    return EXIT_FAILURE;
+  }
+
+  Replay replay;
+  replay_init(&replay);
+  if (!replay_load(&replay, argv[1])) {
+    replay_free(&replay);
+    return EXIT_FAILURE;
+  }
+
+  Game game;
+  game_init(&game);
+  pool_spawn(&game.pool, thread_count);
+
+  // Seeking only simulates from the closest keyframe.
+  const uint64_t seek_start = time_ns();
+  if (!replay_seek(&replay, &game, seek_tick)) {
+    game_free(&game);
+    replay_free(&replay);
+    return EXIT_FAILURE;
+  }
+  const uint64_t seek_ns = time_ns() - seek_start;
+
+  const uint64_t play_start = time_ns();
+  while (replay_step(&replay, &game))
+    ;
+  const uint64_t play_ns = time_ns() - play_start;
+
+  unsigned int alive = 0;
+  for (size_t i = 0; i < game.players.count; ++i) {
+    alive += game.players.data[i].player.alive;
+  }
+
+  const uint64_t played = replay.end_tick - seek_tick;
+  printf("map %ux%u, %zu players, %zu keyframes, ends at tick %" PRIu64 "\n",
+         game.map.width, game.map.height, game.players.count,
+         replay.keyframe_count, replay.end_tick);
+  printf("  %-12s %12.3f ms to tick %" PRIu64 "\n", "seek", seek_ns / 1e6,
+         seek_tick);
+  printf("  %-12s %12.3f ms for %" PRIu64 " ticks\n", "play", play_ns / 1e6,
+         played);
+  printf("  %-12s %12.1f\n", "ticks/sec",
+         play_ns > 0 ? played / (play_ns / 1e9) : 0.0);
+  printf("  %-12s %9u/%zu\n", "alive", alive, game.players.count);
+  printf("  %-12s %12zu\n", "mismatches", replay.mismatch_count);
+
+  const bool success = replay.mismatch_count == 0;
+  game_free(&game);
+  replay_free(&replay);
+  return success ? EXIT_SUCCESS : EXIT_FAILURE;
+}
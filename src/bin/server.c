@@ -0,0 +1,438 @@
+// Runs an authoritative game that clients connect to over TCP, without a
+// window. Everything happens on a single thread around one epoll instance:
+// new connections, actions from clients, ticks driven by a timer, and
+// shutdown on SIGINT or SIGTERM. Each connected client controls one player,
+// which is spawned when it connects and removed when it leaves, and after
+// every tick each client is sent a delta against the previous
+// state it was sent, or the full state if it has just joined.
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <errno.h>
+#include <inttypes.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
+#include <sys/socket.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+
+#include "action.h"
+#include "bot.h"
+#include "bytes.h"
+#include "config.h"
+#include "error.h"
+#include "game.h"
+#include "map.h"
+#include "net.h"
+#include "replay.h"
+#include "snapshot.h"
+#include "trace.h"
+#include "util.h"
+
+// Tokens identifying what an epoll event is for, peers use their index
+// offset by SERVER_TOKEN_PEER.
+#define SERVER_TOKEN_LISTEN 0
+#define SERVER_TOKEN_TIMER 1
+#define SERVER_TOKEN_SIGNAL 2
+#define SERVER_TOKEN_PEER 3
+
+#define SERVER_MAX_EVENTS 256
+// A client with more than this many bytes queued is not keeping up and is
+// disconnected, rather than letting its queue grow without bound.
+#define SERVER_MAX_PENDING (32u << 20)
+// The most ticks run at once when the server falls behind, anything beyond
+// that is dropped so that the server does not spiral.
+#define SERVER_MAX_CATCH_UP 4
+
+typedef struct {
+  // A file descriptor of -1 means the slot is free.
+  Connection connection;
+  // The player the peer controls.
+  PlayerHandle player;
+  // Whether the peer has been sent a full state, after which it is sent
+  // deltas against the previous state.
+  bool synced;
+  // Whether the peer's socket is being watched for room to write.
+  bool writing;
+} Peer;
+
+typedef struct {
+  Game game;
+  // Bots fill the game alongside connected clients, see --bots.
+  BotController bots;
+  Recorder recorder;
+  int epoll_fd;
+  int listen_fd;
+  int timer_fd;
+  int signal_fd;
+  // One slot per client that can be connected at once, see --player-count.
+  Peer *peers;
+  size_t peer_count;
+  size_t connected;
+  // The state sent after the previous tick, and the one being sent now.
+  ByteBuffer previous;
+  ByteBuffer current;
+  ByteBuffer delta;
+  bool running;
+} Server;
+
+static bool watch(Server *server, int fd, uint32_t events, uint64_t token,
+                  int op) {
+  struct epoll_event event = {.events = events, .data.u64 = token};
+  if (epoll_ctl(server->epoll_fd, op, fd, &event) != 0) {
+    report_error("failed to watch socket: %s", strerror(errno));
+    return false;
+  }
+  return true;
+}
+
+static void disconnect(Server *server, size_t index) {
+  Peer *peer = &server->peers[index];
+  recorder_remove(&server->recorder, &server->game, peer->player);
+  game_remove_player(&server->game, peer->player);
+  printf("player %" PRIu32 " disconnected, %zu connected\n",
+         peer->player.index, server->connected - 1);
+
+  connection_free(&peer->connection);
+  peer->player = PLAYER_HANDLE_NULL;
+  peer->synced = false;
+  peer->writing = false;
+  --server->connected;
+}
+
+// Sends what the peer has queued, and watches for room to write if the
+// socket is full. Returns false if the peer was disconnected.
+static bool flush_peer(Server *server, size_t index) {
+  Peer *peer = &server->peers[index];
+  NetStatus status = connection_flush(&peer->connection);
+  if (status == NET_CLOSED ||
+      connection_pending(&peer->connection) > SERVER_MAX_PENDING) {
+    disconnect(server, index);
+    return false;
+  }
+
+  const bool writing = status == NET_WOULD_BLOCK;
+  if (writing != peer->writing) {
+    const uint32_t events = EPOLLIN | (writing ? EPOLLOUT : 0);
+    watch(server, peer->connection.fd, events, SERVER_TOKEN_PEER + index,
+          EPOLL_CTL_MOD);
+    peer->writing = writing;
+  }
+  return true;
+}
+
+// Best effort, the socket is closed straight away.
+static void reject(int fd) {
+  const uint8_t message[] = {1, 0, 0, 0, MESSAGE_REJECT};
+  send(fd, message, sizeof(message), MSG_NOSIGNAL | MSG_DONTWAIT);
+  close(fd);
+}
+
+static void accept_peers(Server *server) {
+  for (;;) {
+    const int fd = accept(server->listen_fd, nullptr, nullptr);
+    if (fd < 0) {
+      if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+        report_error("failed to accept connection: %s", strerror(errno));
+      if (errno != EINTR)
+        return;
+      continue;
+    }
+
+    size_t index = 0;
+    while (index < server->peer_count &&
+           server->peers[index].connection.fd >= 0) {
+      ++index;
+    }
+
+    if (index == server->peer_count || !net_set_nonblocking(fd)) {
+      reject(fd);
+      continue;
+    }
+
+    // The spawn is recorded even if it fails, replaying it fails the same way.
+    recorder_spawn(&server->recorder, &server->game);
+    const PlayerHandle player = game_spawn_player(&server->game);
+    if (player_handle_is_null(player)) {
+      reject(fd);
+      continue;
+    }
+    if (!watch(server, fd, EPOLLIN, SERVER_TOKEN_PEER + index, EPOLL_CTL_ADD)) {
+      recorder_remove(&server->recorder, &server->game, player);
+      game_remove_player(&server->game, player);
+      close(fd);
+      continue;
+    }
+    Peer *peer = &server->peers[index];
+    connection_init(&peer->connection, fd);
+    peer->player = player;
+    peer->synced = false;
+    peer->writing = false;
+    ++server->connected;
+
+    // The full state follows after the next tick.
+    const uint32_t welcome[] = {player.index, player.generation};
+    connection_send(&peer->connection, MESSAGE_WELCOME, welcome,
+                    sizeof(welcome));
+    printf("player %" PRIu32 " connected, %zu connected\n", player.index,
+           server->connected);
+  }
+}
+
+static void read_peer(Server *server, size_t index) {
+  Peer *peer = &server->peers[index];
+  const NetStatus status = connection_receive(&peer->connection);
+
+  MessageType type;
+  const uint8_t *payload;
+  size_t size;
+  NetStatus message_status;
+  while ((message_status = connection_next_message(
+              &peer->connection, &type, &payload, &size)) == NET_OK) {
+    if (type != MESSAGE_ACTION || size != 1 || payload[0] > ACTION_MOVE_RIGHT) {
+      message_status = NET_CLOSED;
+      break;
+    }
+    // Actions beyond what the queue holds are dropped, a client cannot get
+    // ahead of the game by more than that.
+    ActionQueue *queue = players_queue(&server->game.players, peer->player);
+    if (queue != nullptr)
+      action_queue_push(queue, (Action){payload[0]}, time_ns());
+  }
+
+  if (status == NET_CLOSED || message_status == NET_CLOSED)
+    disconnect(server, index);
+}
+
+static void tick(Server *server) {
+  TRACE_SCOPE("tick");
+  Game *game = &server->game;
+  game_apply_inputs(game, time_ns());
+  bots_update(&server->bots, game);
+  recorder_record(&server->recorder, game);
+  game_update(game);
+}
+
+// Every synced peer received the previous state, so they all share one
+// delta.
+static void broadcast(Server *server) {
+  if (server->connected == 0)
+    return;
+
+  TRACE_SCOPE("broadcast");
+  bytes_clear(&server->current);
+  snapshot_write(&server->game, &server->current);
+
+  bool any_synced = false;
+  for (size_t i = 0; i < server->peer_count; ++i) {
+    any_synced |= server->peers[i].connection.fd >= 0 && server->peers[i].synced;
+  }
+  bytes_clear(&server->delta);
+  if (any_synced)
+    snapshot_delta(server->previous.data, server->previous.size,
+                   server->current.data, server->current.size, &server->delta);
+
+  for (size_t i = 0; i < server->peer_count; ++i) {
+    Peer *peer = &server->peers[i];
+    if (peer->connection.fd < 0)
+      continue;
+
+    if (peer->synced) {
+      connection_send(&peer->connection, MESSAGE_DELTA_STATE,
+                      server->delta.data, server->delta.size);
+    } else {
+      connection_send(&peer->connection, MESSAGE_FULL_STATE,
+                      server->current.data, server->current.size);
+      peer->synced = true;
+    }
+    flush_peer(server, i);
+  }
+
+  ByteBuffer previous = server->previous;
+  server->previous = server->current;
+  server->current = previous;
+}
+
+static void handle_timer(Server *server) {
+  uint64_t expirations = 0;
+  if (read(server->timer_fd, &expirations, sizeof(expirations)) !=
+      sizeof(expirations))
+    return;
+
+  if (expirations > SERVER_MAX_CATCH_UP)
+    expirations = SERVER_MAX_CATCH_UP;
+  for (uint64_t i = 0; i < expirations; ++i) {
+    tick(server);
+  }
+  broadcast(server);
+}
+
+// SIGUSR1 prints a summary of the timing probes and keeps the server
+// running, any other signal stops it.
+static void handle_signals(Server *server) {
+  struct signalfd_siginfo info;
+  while (read(server->signal_fd, &info, sizeof(info)) == sizeof(info)) {
+    if (info.ssi_signo == SIGUSR1) {
+      trace_report(stdout);
+      fflush(stdout);
+    } else {
+      server->running = false;
+    }
+  }
+}
+
+static bool open_server(Server *server, const Config *config) {
+  const char *host = config->host ? config->host : "127.0.0.1";
+  server->listen_fd = net_listen(host, config->port);
+  if (server->listen_fd < 0)
+    return false;
+
+  server->epoll_fd = epoll_create1(0);
+  server->timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK);
+  sigset_t signals;
+  sigemptyset(&signals);
+  sigaddset(&signals, SIGINT);
+  sigaddset(&signals, SIGTERM);
+  sigaddset(&signals, SIGUSR1);
+  sigprocmask(SIG_BLOCK, &signals, nullptr);
+  server->signal_fd = signalfd(-1, &signals, SFD_NONBLOCK);
+  if (server->epoll_fd < 0 || server->timer_fd < 0 || server->signal_fd < 0) {
+    report_error("failed to set up event loop: %s", strerror(errno));
+    return false;
+  }
+
+  const long period_ns = 1000000000L / config->tick_rate;
+  const struct itimerspec period = {
+      .it_interval = {period_ns / 1000000000L, period_ns % 1000000000L},
+      .it_value = {period_ns / 1000000000L, period_ns % 1000000000L},
+  };
+  timerfd_settime(server->timer_fd, 0, &period, nullptr);
+
+  if (!watch(server, server->listen_fd, EPOLLIN, SERVER_TOKEN_LISTEN,
+             EPOLL_CTL_ADD) ||
+      !watch(server, server->timer_fd, EPOLLIN, SERVER_TOKEN_TIMER,
+             EPOLL_CTL_ADD) ||
+      !watch(server, server->signal_fd, EPOLLIN, SERVER_TOKEN_SIGNAL,
+             EPOLL_CTL_ADD))
+    return false;
+
+  printf("listening on %s:%u, up to %zu players, %u ticks/sec\n", host, config->port,
+         server->peer_count, config->tick_rate);
+  return true;
+}
+
+static void run(Server *server) {
+  struct epoll_event events[SERVER_MAX_EVENTS];
+  while (server->running) {
+    const int count =
+        epoll_wait(server->epoll_fd, events, SERVER_MAX_EVENTS, -1);
+    if (count < 0) {
+      if (errno == EINTR)
+        continue;
+      report_error("failed to wait for events: %s", strerror(errno));
+      return;
+    }
+
+    for (int i = 0; i < count; ++i) {
+      const uint64_t token = events[i].data.u64;
+      switch (token) {
+      case SERVER_TOKEN_LISTEN:
+        accept_peers(server);
+        break;
+      case SERVER_TOKEN_TIMER:
+        handle_timer(server);
+        break;
+      case SERVER_TOKEN_SIGNAL:
+        handle_signals(server);
+        break;
+      default: {
+        const size_t index = token - SERVER_TOKEN_PEER;
+        // The peer may have been disconnected by an earlier event.
+        if (server->peers[index].connection.fd < 0)
+          break;
+        if (events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR))
+          read_peer(server, index);
+        if (server->peers[index].connection.fd >= 0 &&
+            (events[i].events & EPOLLOUT))
+          flush_peer(server, index);
+      } break;
+      }
+    }
+  }
+}
+
+int main(int argc, const char **argv) {
+  TRACE_THREAD_NAME("main");
+  Config config;
+  config_init(&config);
+  if (!config_from_args(&config, argc, argv)) {
+    return EXIT_FAILURE;
+  }
+
+  Server server = {
+      .epoll_fd = -1,
+      .listen_fd = -1,
+      .timer_fd = -1,
+      .signal_fd = -1,
+      .running = true,
+  };
+  // Players are only spawned as clients connect.
+  Config game_config = config;
+  game_config.player_count = 0;
+  game_setup(&server.game, &game_config);
+  // Bots are part of the initial state of a recording.
+  bots_init(&server.bots);
+  if (bots_spawn(&server.bots, &server.game, config.bot_count) <
+      config.bot_count) {
+    report_error("map has no room for %u bots", config.bot_count);
+    exit(EXIT_FAILURE);
+  }
+  recorder_init(&server.recorder);
+  bytes_init(&server.previous);
+  bytes_init(&server.current);
+  bytes_init(&server.delta);
+
+  server.peer_count = config.player_count;
+  server.peers = calloc(server.peer_count, sizeof(Peer));
+  if (server.peers == nullptr) {
+    report_error("failed to allocate peers");
+    exit(EXIT_FAILURE);
+  }
+  for (size_t i = 0; i < server.peer_count; ++i) {
+    connection_init(&server.peers[i].connection, -1);
+    server.peers[i].player = PLAYER_HANDLE_NULL;
+  }
+
+  bool success = open_server(&server, &config) &&
+                 (!config.record_path ||
+                  recorder_open(&server.recorder, config.record_path, &config));
+  if (success) {
+    run(&server);
+    printf("stopped at tick %" PRIu64 "\n", server.game.tick);
+    if (config.trace_path != nullptr)
+      trace_write_json(config.trace_path);
+  }
+
+  for (size_t i = 0; i < server.peer_count; ++i) {
+    connection_free(&server.peers[i].connection);
+  }
+  free(server.peers);
+  const int fds[] = {server.listen_fd, server.timer_fd, server.signal_fd,
+                     server.epoll_fd};
+  for (size_t i = 0; i < sizeof(fds) / sizeof(fds[0]); ++i) {
+    if (fds[i] >= 0)
+      close(fds[i]);
+  }
+  recorder_close(&server.recorder, &server.game);
+  bytes_free(&server.previous);
+  bytes_free(&server.current);
+  bytes_free(&server.delta);
+  bots_free(&server.bots);
+  game_free(&server.game);
+  return success ? EXIT_SUCCESS : EXIT_FAILURE;
+}
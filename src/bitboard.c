@@ -0,0 +1,502 @@
+#include <assert.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include "bitboard.h"
+#include "error.h"
+#include "vec.h"
+
+// Whole board operations work on Lanes, as many words as fit in a SIMD
+// register. Rows are padded to a whole number of lanes, so kernels never
+// have to deal with a partial register.
+#if defined(__AVX2__)
+typedef __m256i Lanes;
+#define LANE_WORDS 4
+
+static inline Lanes lanes_load(const uint64_t *words) {
+  return _mm256_loadu_si256((const __m256i *)words);
+}
+
+static inline void lanes_store(uint64_t *words, Lanes lanes) {
+  _mm256_storeu_si256((__m256i *)words, lanes);
+}
+
+static inline Lanes lanes_or(Lanes a, Lanes b) { return _mm256_or_si256(a, b); }
+static inline Lanes lanes_and(Lanes a, Lanes b) { return _mm256_and_si256(a, b); }
+static inline Lanes lanes_xor(Lanes a, Lanes b) { return _mm256_xor_si256(a, b); }
+
+// The bits of b that are clear in a.
+static inline Lanes lanes_andnot(Lanes a, Lanes b) {
+  return _mm256_andnot_si256(a, b);
+}
+
+static inline bool lanes_eq(Lanes a, Lanes b) {
+  return _mm256_movemask_epi8(_mm256_cmpeq_epi8(a, b)) == -1;
+}
+
+static inline Lanes lanes_ones(void) { return _mm256_set1_epi64x(-1); }
+#elif defined(__SSE2__)
+typedef __m128i Lanes;
+#define LANE_WORDS 2
+
+static inline Lanes lanes_load(const uint64_t *words) {
+  return _mm_loadu_si128((const __m128i *)words);
+}
+
+static inline void lanes_store(uint64_t *words, Lanes lanes) {
+  _mm_storeu_si128((__m128i *)words, lanes);
+}
+
+static inline Lanes lanes_or(Lanes a, Lanes b) { return _mm_or_si128(a, b); }
+static inline Lanes lanes_and(Lanes a, Lanes b) { return _mm_and_si128(a, b); }
+static inline Lanes lanes_xor(Lanes a, Lanes b) { return _mm_xor_si128(a, b); }
+
+static inline Lanes lanes_andnot(Lanes a, Lanes b) {
+  return _mm_andnot_si128(a, b);
+}
+
+static inline bool lanes_eq(Lanes a, Lanes b) {
+  return _mm_movemask_epi8(_mm_cmpeq_epi8(a, b)) == 0xffff;
+}
+
+static inline Lanes lanes_ones(void) { return _mm_set1_epi64x(-1); }
+#else
+typedef uint64_t Lanes;
+#define LANE_WORDS 1
+
+static inline Lanes lanes_load(const uint64_t *words) { return *words; }
+static inline void lanes_store(uint64_t *words, Lanes lanes) { *words = lanes; }
+static inline Lanes lanes_or(Lanes a, Lanes b) { return a | b; }
+static inline Lanes lanes_and(Lanes a, Lanes b) { return a & b; }
+static inline Lanes lanes_xor(Lanes a, Lanes b) { return a ^ b; }
+static inline Lanes lanes_andnot(Lanes a, Lanes b) { return ~a & b; }
+static inline bool lanes_eq(Lanes a, Lanes b) { return a == b; }
+static inline Lanes lanes_ones(void) { return UINT64_MAX; }
+#endif
+
+void bitboard_init(Bitboard *board) {
+  board->width = 0;
+  board->height = 0;
+  board->stride = 0;
+  board->words = nullptr;
+}
+
+void bitboard_free(Bitboard *board) {
+  free(board->words);
+  bitboard_init(board);
+}
+
+void bitboard_resize(Bitboard *board, unsigned int width, unsigned int height) {
+  const size_t used = ((size_t)width + 63) / 64;
+  const size_t stride = (used + LANE_WORDS - 1) / LANE_WORDS * LANE_WORDS;
+  const size_t size = stride * height * sizeof(uint64_t);
+  uint64_t *words = realloc(board->words, size);
+  if (size > 0 && words == nullptr) {
+    report_error("failed to allocate bitboard");
+    exit(EXIT_FAILURE);
+  }
+
+  board->width = width;
+  board->height = height;
+  board->stride = stride;
+  board->words = words;
+  bitboard_clear(board);
+}
+
+void bitboard_clear(Bitboard *board) {
+  memset(board->words, 0, board->stride * board->height * sizeof(uint64_t));
+}
+
+static inline uint64_t *row(const Bitboard *board, unsigned int y) {
+  return &board->words[y * board->stride];
+}
+
+// The number of words in a row that hold cells, the rest are padding.
+static inline size_t used_words(const Bitboard *board) {
+  return ((size_t)board->width + 63) / 64;
+}
+
+// The cells held by the word at index i of a row.
+static inline uint64_t word_mask(const Bitboard *board, size_t i) {
+  const size_t used = used_words(board);
+  if (i + 1 < used)
+    return UINT64_MAX;
+  if (i + 1 > used)
+    return 0;
+  const unsigned int bits = board->width & 63;
+  return bits == 0 ? UINT64_MAX : ((uint64_t)1 << bits) - 1;
+}
+
+// Clears the padding of a row.
+static void mask_row(const Bitboard *board, uint64_t *words) {
+  for (size_t i = used_words(board) - 1; i < board->stride; ++i) {
+    words[i] &= word_mask(board, i);
+  }
+}
+
+#if defined(__AVX2__)
+// Counts bits a nibble at a time with a lookup table in a register.
+static size_t popcount_words(const uint64_t *words, size_t count) {
+  const __m256i table =
+      _mm256_setr_epi8(0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4, 0, 1,
+                       1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4);
+  const __m256i low = _mm256_set1_epi8(0x0f);
+  __m256i total = _mm256_setzero_si256();
+  for (size_t i = 0; i < count; i += LANE_WORDS) {
+    const __m256i lanes = lanes_load(&words[i]);
+    const __m256i lo = _mm256_and_si256(lanes, low);
+    const __m256i hi = _mm256_and_si256(_mm256_srli_epi16(lanes, 4), low);
+    const __m256i bytes = _mm256_add_epi8(_mm256_shuffle_epi8(table, lo),
+                                          _mm256_shuffle_epi8(table, hi));
+    total = _mm256_add_epi64(total,
+                             _mm256_sad_epu8(bytes, _mm256_setzero_si256()));
+  }
+
+  uint64_t sums[LANE_WORDS];
+  lanes_store(sums, total);
+  return sums[0] + sums[1] + sums[2] + sums[3];
+}
+#elif defined(__SSE2__)
+// SSE2 has no byte shuffle, so bits are counted by adding neighbouring
+// fields within each byte instead.
+static size_t popcount_words(const uint64_t *words, size_t count) {
+  const __m128i m1 = _mm_set1_epi8(0x55);
+  const __m128i m2 = _mm_set1_epi8(0x33);
+  const __m128i m4 = _mm_set1_epi8(0x0f);
+  __m128i total = _mm_setzero_si128();
+  for (size_t i = 0; i < count; i += LANE_WORDS) {
+    __m128i lanes = lanes_load(&words[i]);
+    lanes = _mm_sub_epi8(lanes, _mm_and_si128(_mm_srli_epi16(lanes, 1), m1));
+    lanes = _mm_add_epi8(_mm_and_si128(lanes, m2),
+                         _mm_and_si128(_mm_srli_epi16(lanes, 2), m2));
+    lanes = _mm_and_si128(_mm_add_epi8(lanes, _mm_srli_epi16(lanes, 4)), m4);
+    total = _mm_add_epi64(total, _mm_sad_epu8(lanes, _mm_setzero_si128()));
+  }
+
+  uint64_t sums[LANE_WORDS];
+  lanes_store(sums, total);
+  return sums[0] + sums[1];
+}
+#else
+static size_t popcount_words(const uint64_t *words, size_t count) {
+  size_t total = 0;
+  for (size_t i = 0; i < count; ++i) {
+    total += __builtin_popcountll(words[i]);
+  }
+  return total;
+}
+#endif
+
+// The number of set bits.
+size_t bitboard_count(const Bitboard *board) {
+  return popcount_words(board->words, board->stride * board->height);
+}
+
+// The number of the four cells next to pos whose bits are clear, wrapping
+// at the edges. Position must be a wrapped vector.
+unsigned int bitboard_clear_neighbours(const Bitboard *board, Vec2I pos) {
+  const int width = board->width;
+  const int height = board->height;
+  const Vec2I neighbours[] = {
+      vec2i(pos.x, pos.y + 1 < height ? pos.y + 1 : 0),
+      vec2i(pos.x, pos.y > 0 ? pos.y - 1 : height - 1),
+      vec2i(pos.x > 0 ? pos.x - 1 : width - 1, pos.y),
+      vec2i(pos.x + 1 < width ? pos.x + 1 : 0, pos.y),
+  };
+
+  unsigned int count = 0;
+  for (size_t i = 0; i < sizeof(neighbours) / sizeof(neighbours[0]); ++i) {
+    count += !bitboard_get(board, neighbours[i]);
+  }
+  return count;
+}
+
+// Advances pos to the first cell at or after it in row major order whose bit
+// is clear, along with the bit of the cell above it, wrapping at the top
+// edge. Returns false if there is none. An x equal to the width starts from
+// the next row.
+bool bitboard_next_clear_pair(const Bitboard *board, Vec2I *pos) {
+  const size_t used = used_words(board);
+  const unsigned int height = board->height;
+  size_t i = pos->x >> 6;
+  uint64_t from = UINT64_MAX << (pos->x & 63);
+  for (unsigned int y = pos->y; y < height; ++y) {
+    const uint64_t *words = row(board, y);
+    const uint64_t *above = row(board, y + 1 < height ? y + 1 : 0);
+    for (; i < used; ++i) {
+      const uint64_t clear = ~(words[i] | above[i]) & word_mask(board, i) & from;
+      from = UINT64_MAX;
+      if (clear != 0) {
+        *pos = vec2i(i * 64 + __builtin_ctzll(clear), y);
+        return true;
+      }
+    }
+    i = 0;
+    from = UINT64_MAX;
+  }
+  return false;
+}
+
+// Shifts a row one cell towards higher x, so that each bit of out is the bit
+// of the cell to its left, wrapping from the last cell to the first.
+static void shift_row_up(const Bitboard *board, const uint64_t *in,
+                         uint64_t *out) {
+  const size_t used = used_words(board);
+  const unsigned int last = (board->width - 1) & 63;
+  uint64_t carry = in[used - 1] >> last & 1;
+  for (size_t i = 0; i < used; ++i) {
+    out[i] = in[i] << 1 | carry;
+    carry = in[i] >> 63;
+  }
+  for (size_t i = used; i < board->stride; ++i) {
+    out[i] = 0;
+  }
+  mask_row(board, out);
+}
+
+// The opposite of shift_row_up, each bit of out is the bit of the cell to
+// its right.
+static void shift_row_down(const Bitboard *board, const uint64_t *in,
+                           uint64_t *out) {
+  const size_t used = used_words(board);
+  const unsigned int last = (board->width - 1) & 63;
+  uint64_t carry = (in[0] & 1) << last;
+  for (size_t i = used; i-- > 0;) {
+    out[i] = in[i] >> 1 | carry;
+    carry = in[i] << 63;
+  }
+  for (size_t i = used; i < board->stride; ++i) {
+    out[i] = 0;
+  }
+  mask_row(board, out);
+}
+
+// Sums the set bits of the four neighbours of each cell in a row a bit
+// position at a time, with the sum held in three bit planes, and keeps the
+// clear cells with at most max_set neighbours set.
+static void at_most_row(uint64_t *out, const uint64_t *centre,
+                        const uint64_t *north, const uint64_t *south,
+                        const uint64_t *west, const uint64_t *east,
+                        unsigned int max_set, size_t stride) {
+  for (size_t i = 0; i < stride; i += LANE_WORDS) {
+    const Lanes n = lanes_load(&north[i]);
+    const Lanes s = lanes_load(&south[i]);
+    const Lanes w = lanes_load(&west[i]);
+    const Lanes e = lanes_load(&east[i]);
+
+    // Two half adders, then a full adder of their results.
+    const Lanes vertical = lanes_xor(n, s);
+    const Lanes vertical_carry = lanes_and(n, s);
+    const Lanes horizontal = lanes_xor(w, e);
+    const Lanes horizontal_carry = lanes_and(w, e);
+    const Lanes ones = lanes_xor(vertical, horizontal);
+    const Lanes carry = lanes_and(vertical, horizontal);
+    const Lanes twos =
+        lanes_xor(lanes_xor(vertical_carry, horizontal_carry), carry);
+    const Lanes fours = lanes_or(
+        lanes_and(vertical_carry, horizontal_carry),
+        lanes_and(carry, lanes_xor(vertical_carry, horizontal_carry)));
+
+    // The cells with more than max_set neighbours set.
+    Lanes over;
+    switch (max_set) {
+    case 0:
+      over = lanes_or(lanes_or(ones, twos), fours);
+      break;
+    case 1:
+      over = lanes_or(twos, fours);
+      break;
+    case 2:
+      over = lanes_or(lanes_and(twos, ones), fours);
+      break;
+    case 3:
+      over = fours;
+      break;
+    default:
+      over = lanes_xor(fours, fours);
+      break;
+    }
+
+    const Lanes rejected = lanes_or(over, lanes_load(&centre[i]));
+    lanes_store(&out[i], lanes_andnot(rejected, lanes_ones()));
+  }
+}
+
+// Sets the bits of out for the clear cells of board that have at least count
+// clear neighbours, wrapping at the edges, and clears the rest. A count of 1
+// or less finds every clear cell that is not enclosed, 2 or more skips dead
+// ends. Out is resized to match board if needed.
+void bitboard_clear_neighbours_at_least(const Bitboard *board,
+                                        unsigned int count, Bitboard *out) {
+  assert(out != board);
+  if (out->width != board->width || out->height != board->height)
+    bitboard_resize(out, board->width, board->height);
+  if (count > 4) {
+    bitboard_clear(out);
+    return;
+  }
+  if (board->height == 0 || board->width == 0)
+    return;
+
+  uint64_t *shifted = malloc(2 * board->stride * sizeof(uint64_t));
+  if (shifted == nullptr) {
+    report_error("failed to allocate bitboard row");
+    exit(EXIT_FAILURE);
+  }
+  uint64_t *west = shifted;
+  uint64_t *east = &shifted[board->stride];
+
+  const unsigned int max_set = 4 - count;
+  const unsigned int height = board->height;
+  for (unsigned int y = 0; y < height; ++y) {
+    const uint64_t *centre = row(board, y);
+    shift_row_up(board, centre, west);
+    shift_row_down(board, centre, east);
+    uint64_t *words = row(out, y);
+    at_most_row(words, centre, row(board, y > 0 ? y - 1 : height - 1),
+                row(board, y + 1 < height ? y + 1 : 0), west, east, max_set,
+                board->stride);
+    mask_row(out, words);
+  }
+
+  free(shifted);
+}
+
+// Occluded fills, grows the set bits of x through the set bits of open
+// towards higher or lower bits within a word, in log steps.
+static uint64_t fill_word_up(uint64_t x, uint64_t open) {
+  x |= open & x << 1;
+  open &= open << 1;
+  x |= open & x << 2;
+  open &= open << 2;
+  x |= open & x << 4;
+  open &= open << 4;
+  x |= open & x << 8;
+  open &= open << 8;
+  x |= open & x << 16;
+  open &= open << 16;
+  x |= open & x << 32;
+  return x;
+}
+
+static uint64_t fill_word_down(uint64_t x, uint64_t open) {
+  x |= open & x >> 1;
+  open &= open >> 1;
+  x |= open & x >> 2;
+  open &= open >> 2;
+  x |= open & x >> 4;
+  open &= open >> 4;
+  x |= open & x >> 8;
+  open &= open >> 8;
+  x |= open & x >> 16;
+  open &= open >> 16;
+  x |= open & x >> 32;
+  return x;
+}
+
+// Grows the set bits of a row of region along the row, through the cells
+// that are clear in the same row of blocked, carrying from word to word and
+// wrapping at the ends of the row.
+static void fill_row(const Bitboard *board, uint64_t *words,
+                     const uint64_t *blocked) {
+  const size_t used = used_words(board);
+  const unsigned int last = (board->width - 1) & 63;
+  bool changed;
+  do {
+    changed = false;
+
+    uint64_t carry = words[used - 1] >> last & 1;
+    for (size_t i = 0; i < used; ++i) {
+      const uint64_t open = ~blocked[i] & word_mask(board, i);
+      const uint64_t filled = fill_word_up(words[i] | (carry & open), open);
+      changed |= filled != words[i];
+      words[i] = filled;
+      carry = filled >> 63;
+    }
+
+    carry = (words[0] & 1) << last;
+    for (size_t i = used; i-- > 0;) {
+      const uint64_t open = ~blocked[i] & word_mask(board, i);
+      const uint64_t filled = fill_word_down(words[i] | (carry & open), open);
+      changed |= filled != words[i];
+      words[i] = filled;
+      carry = filled << 63;
+    }
+  } while (changed);
+}
+
+// Spreads the region into a row from the rows above and below it, returns
+// whether the row changed. Every row of the region is kept filled along
+// itself, so only rows that gained a cell from a neighbour need filling.
+static bool spread_row(const Bitboard *region, const Bitboard *blocked,
+                       unsigned int y) {
+  const unsigned int height = region->height;
+  uint64_t *words = row(region, y);
+  const uint64_t *above = row(region, y + 1 < height ? y + 1 : 0);
+  const uint64_t *below = row(region, y > 0 ? y - 1 : height - 1);
+  const uint64_t *walls = row(blocked, y);
+
+  bool changed = false;
+  for (size_t i = 0; i < region->stride; i += LANE_WORDS) {
+    const Lanes current = lanes_load(&words[i]);
+    const Lanes grown = lanes_andnot(
+        lanes_load(&walls[i]),
+        lanes_or(current, lanes_or(lanes_load(&above[i]), lanes_load(&below[i]))));
+    if (!lanes_eq(grown, current)) {
+      lanes_store(&words[i], grown);
+      changed = true;
+    }
+  }
+
+  if (changed)
+    fill_row(region, words, walls);
+  return changed;
+}
+
+// Sets the bits of region for every cell reachable from start through cells
+// that are clear in blocked, wrapping at the edges, and returns how many
+// there are. Stops early once at least limit cells have been found, in
+// which case region holds some of the reachable cells, the count of which
+// is returned. Region is resized to match blocked if needed. Position must
+// be a wrapped vector.
+size_t bitboard_flood(const Bitboard *blocked, Vec2I start, size_t limit,
+                      Bitboard *region) {
+  assert(region != blocked);
+  if (region->width != blocked->width || region->height != blocked->height)
+    bitboard_resize(region, blocked->width, blocked->height);
+  else
+    bitboard_clear(region);
+
+  if (bitboard_get(blocked, start))
+    return 0;
+
+  bitboard_set(region, start, true);
+  fill_row(region, row(region, start.y), row(blocked, start.y));
+
+  // Sweeping down then up carries the region as far as it can go in a
+  // straight line in either direction each round, so only paths that wind
+  // back on themselves need more rounds.
+  size_t count;
+  bool changed;
+  do {
+    changed = false;
+    for (unsigned int y = 0; y < region->height; ++y) {
+      changed |= spread_row(region, blocked, y);
+    }
+    for (unsigned int y = region->height; y-- > 0;) {
+      changed |= spread_row(region, blocked, y);
+    }
+    count = bitboard_count(region);
+  } while (changed && count < limit);
+
+  return count;
+}
@@ -0,0 +1,51 @@
+#ifndef SNAKE_BITBOARD_H
+#define SNAKE_BITBOARD_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "vec.h"
+
+// A grid of bits, one per cell, in row major order. Each row is padded to a
+// whole number of 64 bit words so that rows can be processed a word at a
+// time, the padding bits are always 0. Whole board operations run on SIMD
+// registers, with AVX2 or SSE2 depending on what the build targets, and
+// plain words otherwise. Boards wrap at the edges like the map does.
+typedef struct {
+  unsigned int width;
+  unsigned int height;
+  // The number of words in a row.
+  size_t stride;
+  uint64_t *words;
+} Bitboard;
+
+void bitboard_init(Bitboard *board);
+void bitboard_free(Bitboard *board);
+
+// Any existing bits are discarded, and every bit is left clear.
+void bitboard_resize(Bitboard *board, unsigned int width, unsigned int height);
+void bitboard_clear(Bitboard *board);
+
+// Position must be a wrapped vector.
+static inline bool bitboard_get(const Bitboard *board, Vec2I pos) {
+  const uint64_t word = board->words[pos.y * board->stride + (pos.x >> 6)];
+  return word >> (pos.x & 63) & 1;
+}
+
+// Position must be a wrapped vector.
+static inline void bitboard_set(Bitboard *board, Vec2I pos, bool value) {
+  uint64_t *word = &board->words[pos.y * board->stride + (pos.x >> 6)];
+  const uint64_t bit = (uint64_t)1 << (pos.x & 63);
+  *word = value ? *word | bit : *word & ~bit;
+}
+
+size_t bitboard_count(const Bitboard *board);
+unsigned int bitboard_clear_neighbours(const Bitboard *board, Vec2I pos);
+bool bitboard_next_clear_pair(const Bitboard *board, Vec2I *pos);
+void bitboard_clear_neighbours_at_least(const Bitboard *board,
+                                        unsigned int count, Bitboard *out);
+size_t bitboard_flood(const Bitboard *blocked, Vec2I start, size_t limit,
+                      Bitboard *region);
+
+#endif // !SNAKE_BITBOARD_H
@@ -0,0 +1,427 @@
+#include <assert.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "action.h"
+#include "bot.h"
+#include "error.h"
+#include "game.h"
+#include "map.h"
+#include "player.h"
+#include "players.h"
+#include "pool.h"
+#include "trace.h"
+#include "util.h"
+#include "vec.h"
+
+// Every search marks at most BOT_SEARCH_LIMIT cells, so the visited set is
+// kept at most half full.
+#define BOT_VISIT_CAPACITY (2 * BOT_SEARCH_LIMIT)
+static_assert((BOT_SEARCH_LIMIT & (BOT_SEARCH_LIMIT - 1)) == 0,
+              "BOT_SEARCH_LIMIT must be a power of two");
+static_assert(BOT_SPACE_LIMIT <= BOT_SEARCH_LIMIT,
+              "flood fills share the search queue");
+
+// Candidate moves, in the order they are preferred when nothing else
+// decides between them.
+enum {
+  BOT_MOVE_FORWARD,
+  BOT_MOVE_LEFT,
+  BOT_MOVE_RIGHT,
+  BOT_MOVE_COUNT,
+};
+
+static const Vec2I neighbours[] = {VEC2I_UP, VEC2I_DOWN, VEC2I_LEFT,
+                                   VEC2I_RIGHT};
+#define NEIGHBOUR_COUNT (sizeof(neighbours) / sizeof(neighbours[0]))
+
+static void scratch_init(BotScratch *scratch) {
+  scratch->visits = calloc(BOT_VISIT_CAPACITY, sizeof(BotVisit));
+  scratch->visit_capacity = BOT_VISIT_CAPACITY;
+  scratch->stamp = 0;
+  scratch->queue = malloc(BOT_SEARCH_LIMIT * sizeof(Vec2I));
+  scratch->queue_capacity = BOT_SEARCH_LIMIT;
+  if (scratch->visits == nullptr || scratch->queue == nullptr) {
+    report_error("failed to allocate bot scratch");
+    exit(EXIT_FAILURE);
+  }
+}
+
+static void scratch_free(BotScratch *scratch) {
+  free(scratch->visits);
+  free(scratch->queue);
+}
+
+void bots_init(BotController *bots) {
+  bots->players = nullptr;
+  bots->targets = nullptr;
+  bots->count = 0;
+  bots->capacity = 0;
+  bots->scratch = nullptr;
+  bots->scratch_count = 0;
+  bots->heads = nullptr;
+  bots->head_capacity = 0;
+}
+
+void bots_free(BotController *bots) {
+  for (size_t i = 0; i < bots->scratch_count; ++i) {
+    scratch_free(&bots->scratch[i]);
+  }
+  free(bots->scratch);
+  free(bots->players);
+  free(bots->targets);
+  free(bots->heads);
+  bots_init(bots);
+}
+
+void bots_add(BotController *bots, PlayerHandle player) {
+  if (bots->count == bots->capacity) {
+    const size_t capacity = new_capacity(bots->capacity);
+    PlayerHandle *players =
+        realloc(bots->players, capacity * sizeof(PlayerHandle));
+    if (players != nullptr)
+      bots->players = players;
+    Vec2I *targets = realloc(bots->targets, capacity * sizeof(Vec2I));
+    if (targets != nullptr)
+      bots->targets = targets;
+    if (players == nullptr || targets == nullptr) {
+      report_error("failed to allocate bots");
+      exit(EXIT_FAILURE);
+    }
+    bots->capacity = capacity;
+  }
+  bots->players[bots->count] = player;
+  bots->targets[bots->count] = BOT_NO_TARGET;
+  ++bots->count;
+}
+
+// Returns false if the player is not driven by a bot.
+bool bots_remove(BotController *bots, PlayerHandle player) {
+  for (size_t i = 0; i < bots->count; ++i) {
+    const PlayerHandle bot = bots->players[i];
+    if (bot.index == player.index && bot.generation == player.generation) {
+      --bots->count;
+      bots->players[i] = bots->players[bots->count];
+      bots->targets[i] = bots->targets[bots->count];
+      return true;
+    }
+  }
+  return false;
+}
+
+// Spawns players driven by bots, stopping early if the game is full. Returns
+// the number spawned.
+unsigned int bots_spawn(BotController *bots, Game *game, unsigned int count) {
+  for (unsigned int i = 0; i < count; ++i) {
+    const PlayerHandle player = game_spawn_player(game);
+    if (player_handle_is_null(player))
+      return i;
+    bots_add(bots, player);
+  }
+  return count;
+}
+
+// Makes sure there is a scratch for every chunk, this only allocates when the
+// number of bots grows.
+static void reserve_scratch(BotController *bots) {
+  const size_t chunk_count =
+      (bots->count + BOT_CHUNK_SIZE - 1) / BOT_CHUNK_SIZE;
+  if (chunk_count <= bots->scratch_count)
+    return;
+
+  BotScratch *scratch =
+      realloc(bots->scratch, chunk_count * sizeof(BotScratch));
+  if (scratch == nullptr) {
+    report_error("failed to allocate bot scratch");
+    exit(EXIT_FAILURE);
+  }
+  for (size_t i = bots->scratch_count; i < chunk_count; ++i) {
+    scratch_init(&scratch[i]);
+  }
+  bots->scratch = scratch;
+  bots->scratch_count = chunk_count;
+}
+
+// Forgets every cell visited by the previous search.
+static void begin_search(BotScratch *scratch) {
+  if (++scratch->stamp == 0) {
+    memset(scratch->visits, 0, scratch->visit_capacity * sizeof(BotVisit));
+    scratch->stamp = 1;
+  }
+}
+
+// Marks a cell as visited, returns false if it already was.
+static bool visit(BotScratch *scratch, const Map *map, Vec2I pos) {
+  const uint32_t cell = row_maj_index(map->width, pos.x, pos.y);
+  const size_t mask = scratch->visit_capacity - 1;
+  size_t index = hash_slot(cell, mask);
+  for (;;) {
+    BotVisit *entry = &scratch->visits[index];
+    if (entry->stamp != scratch->stamp) {
+      *entry = (BotVisit){scratch->stamp, cell};
+      return true;
+    }
+    if (entry->cell == cell)
+      return false;
+    index = (index + 1) & mask;
+  }
+}
+
+// The cell next to pos in a direction. Cheaper than map_wrap_pos, as it only
+// ever has to wrap by one cell.
+static Vec2I step(const Map *map, Vec2I pos, Vec2I direction) {
+  Vec2I next = pos;
+  next.x += direction.x;
+  next.y += direction.y;
+  if (next.x < 0)
+    next.x = map->width - 1;
+  else if (next.x == (int)map->width)
+    next.x = 0;
+  if (next.y < 0)
+    next.y = map->height - 1;
+  else if (next.y == (int)map->height)
+    next.y = 0;
+  return next;
+}
+
+// Breadth first search out from the head for the nearest power-up, gives up
+// after BOT_SEARCH_LIMIT cells. Only open cells are searched, so a power-up
+// that is found can be reached, at least for now.
+static bool find_powerup(BotScratch *scratch, const Map *map, Vec2I head,
+                         Vec2I *powerup) {
+  begin_search(scratch);
+  visit(scratch, map, head);
+  scratch->queue[0] = head;
+  size_t front = 0;
+  size_t back = 1;
+  while (front < back) {
+    const Vec2I pos = scratch->queue[front++];
+    for (size_t i = 0; i < NEIGHBOUR_COUNT; ++i) {
+      const Vec2I next = step(map, pos, neighbours[i]);
+      if (map_is_blocked(map, next) || !visit(scratch, map, next))
+        continue;
+      if (map_get_cell(map, next).type == CELL_POWERUP) {
+        *powerup = next;
+        return true;
+      }
+      if (back == scratch->queue_capacity)
+        return false;
+      scratch->queue[back++] = next;
+    }
+  }
+
+  return false;
+}
+
+// Counts the open cells reachable from start, stopping at limit. The head of
+// the bot is on the map, so the fill never walks back through it.
+static size_t measure_room(BotScratch *scratch, const Map *map, Vec2I start,
+                           size_t limit) {
+  if (map_is_blocked(map, start))
+    return 0;
+
+  begin_search(scratch);
+  visit(scratch, map, start);
+  scratch->queue[0] = start;
+  size_t front = 0;
+  size_t back = 1;
+  while (front < back && back < limit) {
+    const Vec2I pos = scratch->queue[front++];
+    for (size_t i = 0; i < NEIGHBOUR_COUNT && back < limit; ++i) {
+      const Vec2I next = step(map, pos, neighbours[i]);
+      if (!map_is_blocked(map, next) && visit(scratch, map, next))
+        scratch->queue[back++] = next;
+    }
+  }
+
+  return back;
+}
+
+// The shortest way from a to b along one axis of a map that wraps.
+static int wrapped_delta(int a, int b, int size) {
+  int delta = (b - a) % size;
+  if (delta > size / 2)
+    delta -= size;
+  else if (delta < -size / 2)
+    delta += size;
+  return delta;
+}
+
+static int distance(const Map *map, Vec2I a, Vec2I b) {
+  return abs(wrapped_delta(a.x, b.x, map->width)) +
+         abs(wrapped_delta(a.y, b.y, map->height));
+}
+
+static inline uint32_t head_key(const Map *map, Vec2I pos) {
+  return row_maj_index(map->width, pos.x, pos.y) + 1;
+}
+
+// Whether the head of a live player is at pos.
+static bool is_head(const BotController *bots, const Map *map, Vec2I pos) {
+  const uint32_t key = head_key(map, pos);
+  const size_t mask = bots->head_capacity - 1;
+  size_t index = hash_slot(key, mask);
+  for (;;) {
+    if (bots->heads[index] == key)
+      return true;
+    if (bots->heads[index] == 0)
+      return false;
+    index = (index + 1) & mask;
+  }
+}
+
+// Whether another player could move into pos this tick, in which case both
+// would die.
+static bool is_contested(const BotController *bots, const Map *map, Vec2I pos,
+                         Vec2I head) {
+  for (size_t i = 0; i < NEIGHBOUR_COUNT; ++i) {
+    const Vec2I next = step(map, pos, neighbours[i]);
+    if (!vec2i_eq(next, head) && is_head(bots, map, next))
+      return true;
+  }
+  return false;
+}
+
+// Picks the move the bot at index makes this tick. A bot heads for its
+// target power-up, looking for a new one when it has none. The move closest
+// to the target is taken if it leaves room for the whole body, otherwise
+// the bot keeps going forward, or turns, whichever leaves enough room first.
+// A move another player might make at the same time only counts for half
+// its room. If no move leaves enough room, the bot takes the one with the
+// most and hopes its tail moves out of the way.
+static void decide(const BotController *bots, BotScratch *scratch,
+                   const Game *game, size_t index, PlayerData *player_data) {
+  const Map *map = &game->map;
+  const Player *player = &player_data->player;
+  const Vec2I head = player_front(player);
+  const Vec2I forward = player_head_forward(player);
+  const Vec2I moves[BOT_MOVE_COUNT] = {
+      [BOT_MOVE_FORWARD] = forward,
+      [BOT_MOVE_LEFT] = vec2i(-forward.y, forward.x),
+      [BOT_MOVE_RIGHT] = vec2i(forward.y, -forward.x),
+  };
+
+  // Targets are only ever written by their own bot.
+  Vec2I *target = &bots->targets[index];
+  bool has_target = !vec2i_eq(*target, BOT_NO_TARGET);
+  if (has_target && map_get_cell(map, *target).type != CELL_POWERUP) {
+    *target = BOT_NO_TARGET;
+    has_target = false;
+  }
+  if (!has_target && game->powerup_count > 0 &&
+      (game->tick + index) % BOT_SEARCH_INTERVAL == 0)
+    has_target = find_powerup(scratch, map, head, target);
+
+  int order[BOT_MOVE_COUNT] = {BOT_MOVE_FORWARD, BOT_MOVE_LEFT,
+                               BOT_MOVE_RIGHT};
+  if (has_target) {
+    // Moves are few, so they are sorted by insertion, keeping ties in
+    // order of preference.
+    int distances[BOT_MOVE_COUNT];
+    for (int move = 0; move < BOT_MOVE_COUNT; ++move) {
+      distances[move] = distance(map, step(map, head, moves[move]), *target);
+    }
+    for (int i = 1; i < BOT_MOVE_COUNT; ++i) {
+      const int move = order[i];
+      int j = i;
+      for (; j > 0 && distances[order[j - 1]] > distances[move]; --j) {
+        order[j] = order[j - 1];
+      }
+      order[j] = move;
+    }
+  }
+
+  const size_t needed = min_size(player->count, BOT_SPACE_LIMIT);
+  int best = BOT_MOVE_FORWARD;
+  size_t best_room = 0;
+  for (int i = 0; i < BOT_MOVE_COUNT; ++i) {
+    const int move = order[i];
+    const Vec2I pos = step(map, head, moves[move]);
+    size_t room = measure_room(scratch, map, pos, needed);
+    if (room > 0 && is_contested(bots, map, pos, head))
+      room /= 2;
+    if (room > best_room) {
+      best = move;
+      best_room = room;
+    }
+    if (room >= needed)
+      break;
+  }
+
+  // Carrying on forward needs no action.
+  if (best != BOT_MOVE_FORWARD)
+    player_data->current_action = action_from_direction(moves[best]);
+}
+
+typedef struct {
+  BotController *bots;
+  Game *game;
+} BotBatch;
+
+// Chunks are fixed ranges of BOT_CHUNK_SIZE bots, so the scratch used by a
+// chunk follows from where it begins.
+static void decide_chunk(void *context, size_t begin, size_t end) {
+  TRACE_SCOPE("bots_chunk");
+  const BotBatch *batch = context;
+  BotScratch *scratch = &batch->bots->scratch[begin / BOT_CHUNK_SIZE];
+  const Game *game = batch->game;
+  for (size_t i = begin; i < end; ++i) {
+    PlayerData *player_data =
+        players_get(&game->players, batch->bots->players[i]);
+    if (player_data == nullptr || !player_data->player.alive)
+      continue;
+    decide(batch->bots, scratch, game, i, player_data);
+  }
+}
+
+// Fills the set of heads, it is rebuilt every tick as every head moves.
+static void index_heads(BotController *bots, const Game *game) {
+  size_t capacity = bots->head_capacity > 0 ? bots->head_capacity : 16;
+  while (capacity < 2 * game->players.count)
+    capacity *= 2;
+
+  if (capacity != bots->head_capacity) {
+    free(bots->heads);
+    bots->heads = malloc(capacity * sizeof(uint32_t));
+    if (bots->heads == nullptr) {
+      report_error("failed to allocate bot heads");
+      exit(EXIT_FAILURE);
+    }
+    bots->head_capacity = capacity;
+  }
+  memset(bots->heads, 0, capacity * sizeof(uint32_t));
+
+  const Map *map = &game->map;
+  const size_t mask = capacity - 1;
+  for (size_t i = 0; i < game->players.count; ++i) {
+    const Player *player = &game->players.data[i].player;
+    if (!player->alive)
+      continue;
+
+    const uint32_t key = head_key(map, player_front(player));
+    size_t index = hash_slot(key, mask);
+    while (bots->heads[index] != 0 && bots->heads[index] != key)
+      index = (index + 1) & mask;
+    bots->heads[index] = key;
+  }
+}
+
+// Sets the action of every bot for this tick, from the state of the game at
+// the start of the tick. Should be called along with game_apply_inputs,
+// before the tick is recorded. Bots only read the map and each only writes
+// to its own player and target, so they are decided in parallel on the
+// game's thread pool, and the outcome does not depend on the number of
+// threads. Bots whose player has been removed are skipped.
+void bots_update(BotController *bots, Game *game) {
+  if (bots->count == 0)
+    return;
+
+  TRACE_SCOPE("bots_update");
+  reserve_scratch(bots);
+  index_heads(bots, game);
+  BotBatch batch = {bots, game};
+  parallel_for(&game->pool, bots->count, BOT_CHUNK_SIZE, decide_chunk, &batch);
+}
@@ -0,0 +1,71 @@
+#ifndef SNAKE_BOT_H
+#define SNAKE_BOT_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "game.h"
+#include "player.h"
+#include "vec.h"
+
+// The most cells a bot searches for a power-up. Power-ups further away than
+// this are not seen, so the cost of a search does not depend on the size of
+// the map. Must be a power of two.
+#define BOT_SEARCH_LIMIT 256
+// A bot without a target searches for one every this many ticks. Searches
+// are staggered, so only a fraction of the bots search on any one tick.
+#define BOT_SEARCH_INTERVAL 8
+// The most cells a flood fill counts when checking how much room a move
+// leaves. A move that reaches this many cells is always considered safe.
+#define BOT_SPACE_LIMIT 64
+// The number of bots decided together by one worker during a tick.
+#define BOT_CHUNK_SIZE 64
+
+// A cell seen during a search, see BotScratch.
+typedef struct {
+  // The search the cell was seen in, entries from older searches are free.
+  uint32_t stamp;
+  uint32_t cell;
+} BotVisit;
+
+// Buffers a search works in, reused by every bot and every tick. Visited
+// cells are kept in an open addressing set rather than a bitmap of the map,
+// so the scratch space scales with the search limits rather than the size of
+// the map, and is cleared by bumping the stamp.
+typedef struct {
+  BotVisit *visits;
+  size_t visit_capacity;
+  uint32_t stamp;
+  Vec2I *queue;
+  size_t queue_capacity;
+} BotScratch;
+
+// Writes the actions of players driven by bots, see bots_update.
+typedef struct {
+  PlayerHandle *players;
+  // The power-up each bot is heading for, BOT_NO_TARGET if it has none.
+  Vec2I *targets;
+  size_t count;
+  size_t capacity;
+  // One scratch per chunk of bots, as chunks run in parallel.
+  BotScratch *scratch;
+  size_t scratch_count;
+  // The cell of every live player's head this tick, one more than its row
+  // major index, in an open addressing set. 0 if the entry is unused.
+  uint32_t *heads;
+  size_t head_capacity;
+} BotController;
+
+#define BOT_NO_TARGET (Vec2I) { .x = -1, .y = -1 }
+
+void bots_init(BotController *bots);
+void bots_free(BotController *bots);
+
+void bots_add(BotController *bots, PlayerHandle player);
+bool bots_remove(BotController *bots, PlayerHandle player);
+unsigned int bots_spawn(BotController *bots, Game *game, unsigned int count);
+
+void bots_update(BotController *bots, Game *game);
+
+#endif // !SNAKE_BOT_H
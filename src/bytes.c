@@ -0,0 +1,144 @@
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "bytes.h"
+#include "error.h"
+#include "util.h"
+
+void bytes_init(ByteBuffer *bytes) {
+  bytes->data = nullptr;
+  bytes->capacity = 0;
+  bytes->size = 0;
+}
+
+void bytes_free(ByteBuffer *bytes) {
+  free(bytes->data);
+  bytes_init(bytes);
+}
+
+void bytes_clear(ByteBuffer *bytes) {
+  bytes->size = 0;
+}
+
+// Makes sure there is room for size more bytes.
+void bytes_reserve(ByteBuffer *bytes, size_t size) {
+  if (bytes->capacity - bytes->size >= size)
+    return;
+
+  size_t capacity = new_capacity(bytes->capacity);
+  while (capacity - bytes->size < size)
+    capacity = new_capacity(capacity);
+
+  uint8_t *data = realloc(bytes->data, capacity);
+  if (data == nullptr) {
+    report_error("failed to resize byte buffer allocation");
+    exit(EXIT_FAILURE);
+  }
+
+  bytes->data = data;
+  bytes->capacity = capacity;
+}
+
+void bytes_write(ByteBuffer *bytes, const void *data, size_t size) {
+  bytes_reserve(bytes, size);
+  memcpy(bytes->data + bytes->size, data, size);
+  bytes->size += size;
+}
+
+void bytes_write_u8(ByteBuffer *bytes, uint8_t value) {
+  bytes_write(bytes, &value, sizeof(value));
+}
+
+void bytes_write_u16(ByteBuffer *bytes, uint16_t value) {
+  bytes_write(bytes, &value, sizeof(value));
+}
+
+void bytes_write_u32(ByteBuffer *bytes, uint32_t value) {
+  bytes_write(bytes, &value, sizeof(value));
+}
+
+void bytes_write_u64(ByteBuffer *bytes, uint64_t value) {
+  bytes_write(bytes, &value, sizeof(value));
+}
+
+void bytes_write_varint(ByteBuffer *bytes, uint64_t value) {
+  bytes_reserve(bytes, 10);
+  while (value >= 0x80) {
+    bytes->data[bytes->size++] = (value & 0x7f) | 0x80;
+    value >>= 7;
+  }
+  bytes->data[bytes->size++] = value;
+}
+
+void reader_init(ByteReader *reader, const void *data, size_t size) {
+  reader->data = data;
+  reader->size = size;
+  reader->cursor = 0;
+  reader->error = false;
+}
+
+bool reader_done(const ByteReader *reader) {
+  return reader->cursor == reader->size;
+}
+
+const uint8_t *reader_read(ByteReader *reader, size_t size) {
+  if (reader->size - reader->cursor < size) {
+    reader->error = true;
+    reader->cursor = reader->size;
+    return nullptr;
+  }
+
+  const uint8_t *data = reader->data + reader->cursor;
+  reader->cursor += size;
+  return data;
+}
+
+// Copies the next size bytes into out, or zeroes it if there are not enough.
+static void read_value(ByteReader *reader, void *out, size_t size) {
+  const uint8_t *data = reader_read(reader, size);
+  if (data != nullptr) {
+    memcpy(out, data, size);
+  } else {
+    memset(out, 0, size);
+  }
+}
+
+uint8_t reader_read_u8(ByteReader *reader) {
+  uint8_t value;
+  read_value(reader, &value, sizeof(value));
+  return value;
+}
+
+uint16_t reader_read_u16(ByteReader *reader) {
+  uint16_t value;
+  read_value(reader, &value, sizeof(value));
+  return value;
+}
+
+uint32_t reader_read_u32(ByteReader *reader) {
+  uint32_t value;
+  read_value(reader, &value, sizeof(value));
+  return value;
+}
+
+uint64_t reader_read_u64(ByteReader *reader) {
+  uint64_t value;
+  read_value(reader, &value, sizeof(value));
+  return value;
+}
+
+uint64_t reader_read_varint(ByteReader *reader) {
+  uint64_t value = 0;
+  for (unsigned int shift = 0; shift < 64; shift += 7) {
+    const uint8_t byte = reader_read_u8(reader);
+    value |= (uint64_t)(byte & 0x7f) << shift;
+    if ((byte & 0x80) == 0)
+      return value;
+  }
+
+  // More than ten bytes can not have come from bytes_write_varint.
+  reader->error = true;
+  return 0;
+}
@@ -0,0 +1,53 @@
+#ifndef SNAKE_BYTES_H
+#define SNAKE_BYTES_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// A growable array of bytes, used to build anything that is written to a
+// file or sent somewhere else. Values are written in host byte order, which
+// is assumed to be little endian, see mapfile.h.
+typedef struct {
+  uint8_t *data;
+  size_t capacity;
+  size_t size;
+} ByteBuffer;
+
+void bytes_init(ByteBuffer *bytes);
+void bytes_free(ByteBuffer *bytes);
+
+// Empties the buffer without releasing its allocation.
+void bytes_clear(ByteBuffer *bytes);
+void bytes_reserve(ByteBuffer *bytes, size_t size);
+
+void bytes_write(ByteBuffer *bytes, const void *data, size_t size);
+void bytes_write_u8(ByteBuffer *bytes, uint8_t value);
+void bytes_write_u16(ByteBuffer *bytes, uint16_t value);
+void bytes_write_u32(ByteBuffer *bytes, uint32_t value);
+void bytes_write_u64(ByteBuffer *bytes, uint64_t value);
+// Writes seven bits per byte, so small values take a single byte.
+void bytes_write_varint(ByteBuffer *bytes, uint64_t value);
+
+// Reads values written to a ByteBuffer. Reading past the end sets error and
+// yields zeroes, so a sequence of reads only needs to be checked once.
+typedef struct {
+  const uint8_t *data;
+  size_t size;
+  size_t cursor;
+  bool error;
+} ByteReader;
+
+void reader_init(ByteReader *reader, const void *data, size_t size);
+
+bool reader_done(const ByteReader *reader);
+// Returns a pointer to the next size bytes and skips over them, or nullptr if
+// there are not enough bytes left.
+const uint8_t *reader_read(ByteReader *reader, size_t size);
+uint8_t reader_read_u8(ByteReader *reader);
+uint16_t reader_read_u16(ByteReader *reader);
+uint32_t reader_read_u32(ByteReader *reader);
+uint64_t reader_read_u64(ByteReader *reader);
+uint64_t reader_read_varint(ByteReader *reader);
+
+#endif // !SNAKE_BYTES_H
@@ -0,0 +1,234 @@
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <glad/gl.h>
+
+#include "capture.h"
+#include "config.h"
+#include "error.h"
+#include "stream.h"
+#include "trace.h"
+
+static size_t frame_size(const Capture *capture) {
+  return (size_t)capture->width * capture->height * 4;
+}
+
+// Returns whether the fence has been signalled, only waiting for it if wait
+// is set.
+static bool poll_fence(void *fence, bool wait) {
+  for (;;) {
+    const GLenum result = glClientWaitSync(
+        fence, GL_SYNC_FLUSH_COMMANDS_BIT, wait ? FENCE_TIMEOUT_NS : 0);
+    if (result == GL_ALREADY_SIGNALED || result == GL_CONDITION_SATISFIED)
+      return true;
+    if (result == GL_WAIT_FAILED) {
+      report_error("failed to wait for capture fence");
+      return true;
+    }
+    if (!wait)
+      return false;
+  }
+}
+
+static void write_failed(Capture *capture) {
+  if (!capture->failed)
+    report_error("failed to write captured frame: %s", strerror(errno));
+  capture->failed = true;
+}
+
+// Writes a frame from the bottom up, as OpenGL stores rows in that order.
+static void write_rgba(Capture *capture, const uint8_t *pixels) {
+  const size_t row_size = (size_t)capture->width * 4;
+  for (unsigned int y = capture->height; y-- > 0;) {
+    fwrite(pixels + y * row_size, 1, row_size, capture->file);
+  }
+}
+
+// Converts a frame to BT.601 limited range YCbCr, with a full resolution
+// plane for each component, and writes it after a frame header.
+static void write_y4m(Capture *capture, const uint8_t *pixels) {
+  const size_t plane_size = (size_t)capture->width * capture->height;
+  uint8_t *y_plane = capture->data;
+  uint8_t *u_plane = y_plane + plane_size;
+  uint8_t *v_plane = u_plane + plane_size;
+  size_t i = 0;
+  for (unsigned int y = capture->height; y-- > 0;) {
+    const uint8_t *row = pixels + (size_t)y * capture->width * 4;
+    for (unsigned int x = 0; x < capture->width; ++x, ++i) {
+      const int r = row[4 * x + 0];
+      const int g = row[4 * x + 1];
+      const int b = row[4 * x + 2];
+      y_plane[i] = 16 + ((66 * r + 129 * g + 25 * b + 128) >> 8);
+      u_plane[i] = 128 + ((-38 * r - 74 * g + 112 * b + 128) >> 8);
+      v_plane[i] = 128 + ((112 * r - 94 * g - 18 * b + 128) >> 8);
+    }
+  }
+
+  fputs("FRAME\n", capture->file);
+  fwrite(capture->data, 1, 3 * plane_size, capture->file);
+}
+
+// Writes out the oldest frame that has been read back, waiting for the copy
+// to finish if wait is set. Returns false if the frame is not ready yet.
+static bool write_frame(Capture *capture, bool wait) {
+  const unsigned int region = capture->write_count % CAPTURE_REGION_COUNT;
+  void *fence = capture->fences[region];
+  if (!poll_fence(fence, wait))
+    return false;
+
+  TRACE_SCOPE("capture_write");
+  glDeleteSync(fence);
+  capture->fences[region] = nullptr;
+  ++capture->write_count;
+  if (capture->failed)
+    return true;
+
+  const uint8_t *pixels = capture->mapping + region * frame_size(capture);
+  switch (capture->format) {
+  case CAPTURE_FORMAT_Y4M:
+    write_y4m(capture, pixels);
+    break;
+  case CAPTURE_FORMAT_RGBA:
+    write_rgba(capture, pixels);
+    break;
+  }
+  if (ferror(capture->file))
+    write_failed(capture);
+  return true;
+}
+
+void capture_init(Capture *capture) {
+  capture->width = 0;
+  capture->height = 0;
+  capture->format = CAPTURE_FORMAT_Y4M;
+  capture->file = nullptr;
+  capture->owns_file = false;
+  capture->failed = false;
+  capture->framebuffer = 0;
+  capture->renderbuffer = 0;
+  capture->buffer = 0;
+  capture->mapping = nullptr;
+  for (unsigned int i = 0; i < CAPTURE_REGION_COUNT; ++i) {
+    capture->fences[i] = nullptr;
+  }
+  capture->read_count = 0;
+  capture->write_count = 0;
+  capture->data = nullptr;
+}
+
+// Opens path for writing, "-" writes to stdout, which may be a pipe. Frames
+// are width by height pixels, and are shown frame_rate / frame_divisor times
+// a second, which only matters to formats that store a frame rate.
+bool capture_open(Capture *capture, const char *path, CaptureFormat format,
+                  unsigned int width, unsigned int height,
+                  unsigned int frame_rate, unsigned int frame_divisor) {
+  capture->width = width;
+  capture->height = height;
+  capture->format = format;
+
+  capture->owns_file = strcmp(path, "-") != 0;
+  capture->file = capture->owns_file ? fopen(path, "wb") : stdout;
+  if (capture->file == nullptr) {
+    report_error("failed to open file: %s", path);
+    return false;
+  }
+
+  glCreateRenderbuffers(1, &capture->renderbuffer);
+  glNamedRenderbufferStorage(capture->renderbuffer, GL_RGBA8, width, height);
+  glCreateFramebuffers(1, &capture->framebuffer);
+  glNamedFramebufferRenderbuffer(capture->framebuffer, GL_COLOR_ATTACHMENT0,
+                                 GL_RENDERBUFFER, capture->renderbuffer);
+  if (glCheckNamedFramebufferStatus(capture->framebuffer, GL_FRAMEBUFFER) !=
+      GL_FRAMEBUFFER_COMPLETE) {
+    report_error("failed to create capture framebuffer");
+    return false;
+  }
+
+  // Client storage hints that the buffer is read by the cpu, so it is kept
+  // in memory that is quick for the cpu to read.
+  const GLbitfield flags =
+      GL_MAP_READ_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+  const size_t size = frame_size(capture) * CAPTURE_REGION_COUNT;
+  glCreateBuffers(1, &capture->buffer);
+  glNamedBufferStorage(capture->buffer, size, nullptr,
+                       flags | GL_CLIENT_STORAGE_BIT);
+  capture->mapping = glMapNamedBufferRange(capture->buffer, 0, size, flags);
+  if (capture->mapping == nullptr) {
+    report_error("failed to map capture buffer");
+    return false;
+  }
+
+  capture->data = malloc(3 * (size_t)width * height);
+  if (capture->data == nullptr) {
+    report_error("failed to allocate capture staging memory");
+    exit(EXIT_FAILURE);
+  }
+
+  if (format == CAPTURE_FORMAT_Y4M) {
+    fprintf(capture->file, "YUV4MPEG2 W%u H%u F%u:%u Ip A1:1 C444\n", width,
+            height, frame_rate, frame_divisor);
+  }
+  return true;
+}
+
+// Writes out every frame still being read back, then closes the file.
+// Returns false if any frame failed to be written.
+bool capture_close(Capture *capture) {
+  while (capture->write_count < capture->read_count) {
+    write_frame(capture, true);
+  }
+
+  if (capture->buffer != 0) {
+    glUnmapNamedBuffer(capture->buffer);
+    glDeleteBuffers(1, &capture->buffer);
+  }
+  glDeleteFramebuffers(1, &capture->framebuffer);
+  glDeleteRenderbuffers(1, &capture->renderbuffer);
+  free(capture->data);
+
+  bool success = !capture->failed;
+  if (capture->file != nullptr) {
+    if (fflush(capture->file) != 0 && success) {
+      write_failed(capture);
+      success = false;
+    }
+    if (capture->owns_file && fclose(capture->file) != 0 && success) {
+      write_failed(capture);
+      success = false;
+    }
+  }
+
+  capture_init(capture);
+  return success;
+}
+
+void capture_bind(const Capture *capture) {
+  glBindFramebuffer(GL_FRAMEBUFFER, capture->framebuffer);
+  glViewport(0, 0, capture->width, capture->height);
+}
+
+// Starts copying the framebuffer into the next region, then writes out any
+// earlier frames whose copies have finished. Only waits on the gpu when
+// every region is still in use.
+void capture_frame(Capture *capture) {
+  TRACE_SCOPE("capture_frame");
+  if (capture->read_count - capture->write_count == CAPTURE_REGION_COUNT)
+    write_frame(capture, true);
+
+  const unsigned int region = capture->read_count % CAPTURE_REGION_COUNT;
+  glBindBuffer(GL_PIXEL_PACK_BUFFER, capture->buffer);
+  glNamedFramebufferReadBuffer(capture->framebuffer, GL_COLOR_ATTACHMENT0);
+  glReadPixels(0, 0, capture->width, capture->height, GL_RGBA,
+               GL_UNSIGNED_BYTE, (void *)(region * frame_size(capture)));
+  glBindBuffer(GL_PIXEL_PACK_BUFFER, GL_NONE);
+  capture->fences[region] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+  ++capture->read_count;
+
+  // The frame just read is left for later, it is unlikely to be done yet.
+  while (capture->read_count - capture->write_count > 1 &&
+         write_frame(capture, false)) {
+  }
+}
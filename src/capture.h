@@ -0,0 +1,56 @@
+#ifndef SNAKE_CAPTURE_H
+#define SNAKE_CAPTURE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "config.h"
+
+#define CAPTURE_REGION_COUNT 3
+
+// Renders into an offscreen framebuffer and writes every frame drawn into it
+// to a file or pipe. Frames are read back asynchronously: each one is copied
+// into a region of a persistently mapped pixel buffer and fenced, and only
+// written out once the gpu has finished the copy, so the cpu only waits when
+// it gets more than CAPTURE_REGION_COUNT - 1 frames ahead of the gpu.
+typedef struct {
+  unsigned int width;
+  unsigned int height;
+  CaptureFormat format;
+  FILE *file;
+  // Whether file is closed along with the capture, stdout is not.
+  bool owns_file;
+  // Set once a write has failed, later frames are dropped.
+  bool failed;
+  // Framebuffer handle and its colour attachment.
+  unsigned int framebuffer;
+  unsigned int renderbuffer;
+  // The pixel buffer frames are read back into, one frame per region, and
+  // its persistent mapping.
+  unsigned int buffer;
+  uint8_t *mapping;
+  // One fence per region, GLsync objects stored as pointers so that this
+  // header does not depend on OpenGL, see StreamBuffer.
+  void *fences[CAPTURE_REGION_COUNT];
+  // The number of frames read back and written out so far. Frame i is held
+  // in region i % CAPTURE_REGION_COUNT.
+  uint64_t read_count;
+  uint64_t write_count;
+  // Staging memory for a converted frame.
+  uint8_t *data;
+} Capture;
+
+void capture_init(Capture *capture);
+bool capture_open(Capture *capture, const char *path, CaptureFormat format,
+                  unsigned int width, unsigned int height,
+                  unsigned int frame_rate, unsigned int frame_divisor);
+bool capture_close(Capture *capture);
+
+// Binds the framebuffer, so that what is drawn next is captured.
+void capture_bind(const Capture *capture);
+// Should be called once everything has been drawn into the framebuffer.
+void capture_frame(Capture *capture);
+
+#endif // !SNAKE_CAPTURE_H
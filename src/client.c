@@ -0,0 +1,135 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <poll.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "action.h"
+#include "bytes.h"
+#include "client.h"
+#include "error.h"
+#include "game.h"
+#include "input.h"
+#include "net.h"
+#include "snapshot.h"
+
+// How long to wait for the server to send the initial state.
+#define CLIENT_CONNECT_TIMEOUT_MS 5000
+
+void client_init(Client *client) {
+  connection_init(&client->connection, -1);
+  client->player = PLAYER_HANDLE_NULL;
+  keymap_init(&client->keymap);
+  bytes_init(&client->state);
+  bytes_init(&client->scratch);
+}
+
+void client_free(Client *client) {
+  connection_free(&client->connection);
+  keymap_free(&client->keymap);
+  bytes_free(&client->state);
+  bytes_free(&client->scratch);
+  client_init(client);
+}
+
+// Restores the game from the current state.
+static bool restore_state(Client *client, Game *game) {
+  ByteReader reader;
+  reader_init(&reader, client->state.data, client->state.size);
+  return snapshot_read(game, &reader);
+}
+
+static bool handle_message(Client *client, Game *game, MessageType type,
+                           const uint8_t *payload, size_t size,
+                           bool *updated) {
+  switch (type) {
+  case MESSAGE_WELCOME: {
+    ByteReader reader;
+    reader_init(&reader, payload, size);
+    client->player.index = reader_read_u32(&reader);
+    client->player.generation = reader_read_u32(&reader);
+    return !reader.error;
+  }
+  case MESSAGE_REJECT:
+    report_error("the server is full");
+    return false;
+  case MESSAGE_FULL_STATE:
+    bytes_clear(&client->state);
+    bytes_write(&client->state, payload, size);
+    *updated = true;
+    return restore_state(client, game);
+  case MESSAGE_DELTA_STATE: {
+    if (!snapshot_apply_delta(client->state.data, client->state.size, payload,
+                              size, &client->scratch)) {
+      report_error("received a malformed state delta");
+      return false;
+    }
+    ByteBuffer state = client->state;
+    client->state = client->scratch;
+    client->scratch = state;
+    *updated = true;
+    return restore_state(client, game);
+  }
+  default:
+    report_error("received an unexpected message from the server");
+    return false;
+  }
+}
+
+// Handles everything that has been received from the server, updated is set
+// if the game changed. Returns NET_CLOSED if the connection was lost.
+NetStatus client_poll(Client *client, Game *game, bool *updated) {
+  *updated = false;
+  NetStatus status = connection_receive(&client->connection);
+  MessageType type;
+  const uint8_t *payload;
+  size_t size;
+  NetStatus message_status;
+  while ((message_status = connection_next_message(
+              &client->connection, &type, &payload, &size)) == NET_OK) {
+    if (!handle_message(client, game, type, payload, size, updated))
+      return NET_CLOSED;
+  }
+
+  if (message_status == NET_CLOSED || status == NET_CLOSED)
+    return NET_CLOSED;
+  if (connection_flush(&client->connection) == NET_CLOSED)
+    return NET_CLOSED;
+  return NET_OK;
+}
+
+// Connects to a server and waits for the initial state, which replaces the
+// state of the initialised game.
+bool client_connect(Client *client, const char *host, unsigned int port,
+                    Game *game) {
+  const int fd = net_connect(host, port);
+  if (fd < 0)
+    return false;
+  if (!net_set_nonblocking(fd)) {
+    report_error("failed to configure socket");
+    return false;
+  }
+  connection_init(&client->connection, fd);
+
+  bool updated = false;
+  while (!updated) {
+    struct pollfd pfd = {fd, POLLIN};
+    if (poll(&pfd, 1, CLIENT_CONNECT_TIMEOUT_MS) <= 0) {
+      report_error("timed out waiting for the server");
+      return false;
+    }
+    if (client_poll(client, game, &updated) == NET_CLOSED) {
+      report_error("lost connection to the server");
+      return false;
+    }
+  }
+
+  return true;
+}
+
+// Queues an action for the client's player, it is sent on the next poll.
+void client_send_action(Client *client, Action action) {
+  connection_send(&client->connection, MESSAGE_ACTION, &action.type,
+                  sizeof(action.type));
+}
@@ -0,0 +1,35 @@
+#ifndef SNAKE_CLIENT_H
+#define SNAKE_CLIENT_H
+
+#include <stdbool.h>
+
+#include "action.h"
+#include "bytes.h"
+#include "game.h"
+#include "input.h"
+#include "net.h"
+
+// The client side of a game run by snake-server. The server is
+// authoritative, the client only sends the actions of its player and mirrors
+// the state it is sent into a local Game, which is never updated locally.
+typedef struct {
+  Connection connection;
+  // The player the client controls.
+  PlayerHandle player;
+  // Keys mapped to the actions of the client's player. Kept apart from the
+  // game's keymap, which is overwritten along with the rest of the game.
+  KeyMap keymap;
+  // The last state received, deltas are applied against it.
+  ByteBuffer state;
+  ByteBuffer scratch;
+} Client;
+
+void client_init(Client *client);
+void client_free(Client *client);
+
+bool client_connect(Client *client, const char *host, unsigned int port,
+                    Game *game);
+NetStatus client_poll(Client *client, Game *game, bool *updated);
+void client_send_action(Client *client, Action action);
+
+#endif // !SNAKE_CLIENT_H
@@ -1,14 +1,66 @@
+#include <stdint.h>
+#include <stdio.h>
 #include <string.h>
 
 #include "config.h"
 #include "error.h"
+#include "net.h"
+#include "trace.h"
 
 typedef enum {
   OPTION_PLAYER_COUNT,
+  OPTION_MAP_WIDTH,
+  OPTION_MAP_HEIGHT,
+  OPTION_TICK_COUNT,
+  OPTION_SEED,
+  OPTION_SCRIPT,
+  OPTION_THREADS,
+  OPTION_RENDERER,
+  OPTION_MAP,
+  OPTION_RECORD,
+  OPTION_KEYFRAME_INTERVAL,
+  OPTION_HOST,
+  OPTION_PORT,
+  OPTION_TICK_RATE,
+  OPTION_FRAME_RATE,
+  OPTION_INPUT_POLICY,
+  OPTION_POWERUP_RATE,
+  OPTION_POWERUP_LIMIT,
+  OPTION_POWERUP_POWERS,
+  OPTION_BOTS,
+  OPTION_TRACE,
+  OPTION_CAPTURE,
+  OPTION_CAPTURE_FORMAT,
+  OPTION_CAPTURE_STRIDE,
 } OptionType;
 
 void config_init(Config *config) {
   config->player_count = 1;
+  config->map_width = 32;
+  config->map_height = 32;
+  config->tick_count = 1000;
+  config->seed = 1;
+  config->thread_count = 1;
+  config->renderer = RENDERER_CELLS;
+  config->script_path = nullptr;
+  config->map_path = nullptr;
+  config->record_path = nullptr;
+  config->keyframe_interval = 1000;
+  config->host = nullptr;
+  config->port = NET_DEFAULT_PORT;
+  config->tick_rate = 8;
+  config->frame_rate = 60;
+  config->input_policy = INPUT_POLICY_QUEUED;
+  config->powerup_rate = 50;
+  config->powerup_limit = 4;
+  config->powerup_powers[0] = 5;
+  config->powerup_weights[0] = 1;
+  config->powerup_kind_count = 1;
+  config->bot_count = 0;
+  config->trace_path = nullptr;
+  config->capture_path = nullptr;
+  config->capture_format = CAPTURE_FORMAT_Y4M;
+  config->capture_stride = 1;
 }
 
 // Returns false if the option is not recognized.
@@ -17,6 +69,30 @@ static bool identify_short_option(const char *arg, OptionType *type) {
   case 'p':
     *type = OPTION_PLAYER_COUNT;
     return true;
+  case 'W':
+    *type = OPTION_MAP_WIDTH;
+    return true;
+  case 'H':
+    *type = OPTION_MAP_HEIGHT;
+    return true;
+  case 'n':
+    *type = OPTION_TICK_COUNT;
+    return true;
+  case 's':
+    *type = OPTION_SEED;
+    return true;
+  case 't':
+    *type = OPTION_THREADS;
+    return true;
+  case 'r':
+    *type = OPTION_RENDERER;
+    return true;
+  case 'm':
+    *type = OPTION_MAP;
+    return true;
+  case 'R':
+    *type = OPTION_RECORD;
+    return true;
   default:
     return false;
   }
@@ -27,6 +103,75 @@ static bool identify_long_option(const char *arg, OptionType *type) {
   if (strcmp(arg, "player-count") == 0) {
     *type = OPTION_PLAYER_COUNT;
     return true;
+  } else if (strcmp(arg, "map-width") == 0) {
+    *type = OPTION_MAP_WIDTH;
+    return true;
+  } else if (strcmp(arg, "map-height") == 0) {
+    *type = OPTION_MAP_HEIGHT;
+    return true;
+  } else if (strcmp(arg, "ticks") == 0) {
+    *type = OPTION_TICK_COUNT;
+    return true;
+  } else if (strcmp(arg, "seed") == 0) {
+    *type = OPTION_SEED;
+    return true;
+  } else if (strcmp(arg, "script") == 0) {
+    *type = OPTION_SCRIPT;
+    return true;
+  } else if (strcmp(arg, "threads") == 0) {
+    *type = OPTION_THREADS;
+    return true;
+  } else if (strcmp(arg, "renderer") == 0) {
+    *type = OPTION_RENDERER;
+    return true;
+  } else if (strcmp(arg, "map") == 0) {
+    *type = OPTION_MAP;
+    return true;
+  } else if (strcmp(arg, "record") == 0) {
+    *type = OPTION_RECORD;
+    return true;
+  } else if (strcmp(arg, "keyframe-interval") == 0) {
+    *type = OPTION_KEYFRAME_INTERVAL;
+    return true;
+  } else if (strcmp(arg, "host") == 0) {
+    *type = OPTION_HOST;
+    return true;
+  } else if (strcmp(arg, "port") == 0) {
+    *type = OPTION_PORT;
+    return true;
+  } else if (strcmp(arg, "tick-rate") == 0) {
+    *type = OPTION_TICK_RATE;
+    return true;
+  } else if (strcmp(arg, "frame-rate") == 0) {
+    *type = OPTION_FRAME_RATE;
+    return true;
+  } else if (strcmp(arg, "input-policy") == 0) {
+    *type = OPTION_INPUT_POLICY;
+    return true;
+  } else if (strcmp(arg, "powerup-rate") == 0) {
+    *type = OPTION_POWERUP_RATE;
+    return true;
+  } else if (strcmp(arg, "powerup-limit") == 0) {
+    *type = OPTION_POWERUP_LIMIT;
+    return true;
+  } else if (strcmp(arg, "powerup-powers") == 0) {
+    *type = OPTION_POWERUP_POWERS;
+    return true;
+  } else if (strcmp(arg, "bots") == 0) {
+    *type = OPTION_BOTS;
+    return true;
+  } else if (strcmp(arg, "trace") == 0) {
+    *type = OPTION_TRACE;
+    return true;
+  } else if (strcmp(arg, "capture") == 0) {
+    *type = OPTION_CAPTURE;
+    return true;
+  } else if (strcmp(arg, "capture-format") == 0) {
+    *type = OPTION_CAPTURE_FORMAT;
+    return true;
+  } else if (strcmp(arg, "capture-stride") == 0) {
+    *type = OPTION_CAPTURE_STRIDE;
+    return true;
   } else {
     return false;
   }
@@ -74,19 +219,176 @@ static bool parse_uint(Config *cfg, ParseContext *ctx, unsigned int *out) {
   return true;
 }
 
+// Takes the next argument as is. The string is not copied, so it lives as
+// long as argv does.
+static bool parse_string(Config *cfg, ParseContext *ctx, const char **out) {
+  if (ctx->cursor == ctx->chunk_count)
+    return false;
+
+  *out = ctx->chunks[ctx->cursor++];
+  return true;
+}
+
+static bool parse_renderer(Config *cfg, ParseContext *ctx, RendererType *out) {
+  const char *name;
+  if (!parse_string(cfg, ctx, &name))
+    return false;
+
+  if (strcmp(name, "cells") == 0) {
+    *out = RENDERER_CELLS;
+  } else if (strcmp(name, "greedy") == 0) {
+    *out = RENDERER_GREEDY;
+  } else if (strcmp(name, "texture") == 0) {
+    *out = RENDERER_TEXTURE;
+  } else {
+    report_error("unknown renderer '%s', expected one of: cells, greedy, "
+                 "texture", name);
+    return false;
+  }
+
+  return true;
+}
+
+static bool parse_input_policy(Config *cfg, ParseContext *ctx,
+                               InputPolicy *out) {
+  const char *name;
+  if (!parse_string(cfg, ctx, &name))
+    return false;
+
+  if (strcmp(name, "queued") == 0) {
+    *out = INPUT_POLICY_QUEUED;
+  } else if (strcmp(name, "latest") == 0) {
+    *out = INPUT_POLICY_LATEST;
+  } else {
+    report_error("unknown input policy '%s', expected one of: queued, latest",
+                 name);
+    return false;
+  }
+
+  return true;
+}
+
+static bool parse_capture_format(Config *cfg, ParseContext *ctx,
+                                 CaptureFormat *out) {
+  const char *name;
+  if (!parse_string(cfg, ctx, &name))
+    return false;
+
+  if (strcmp(name, "y4m") == 0) {
+    *out = CAPTURE_FORMAT_Y4M;
+  } else if (strcmp(name, "rgba") == 0) {
+    *out = CAPTURE_FORMAT_RGBA;
+  } else {
+    report_error("unknown capture format '%s', expected one of: y4m, rgba",
+                 name);
+    return false;
+  }
+
+  return true;
+}
+
+// Parses a comma separated list of power:weight pairs, e.g. "1:70,3:25,10:5".
+static bool parse_powerup_powers(Config *cfg, ParseContext *ctx) {
+  const char *list;
+  if (!parse_string(cfg, ctx, &list))
+    return false;
+
+  unsigned int count = 0;
+  uint64_t total_weight = 0;
+  const char *c = list;
+  while (*c != '\0') {
+    unsigned int power = 0;
+    unsigned int weight = 0;
+    int length = 0;
+    const bool parsed = count < CONFIG_MAX_POWERUP_KINDS &&
+                        sscanf(c, "%u:%u%n", &power, &weight, &length) == 2 &&
+                        (c[length] == ',' || c[length] == '\0');
+    total_weight += weight;
+    if (!parsed || power < 1 || power > UINT8_MAX || weight < 1 ||
+        total_weight > UINT32_MAX) {
+      report_error("invalid power-up powers '%s', expected at most %d "
+                   "power:weight pairs with powers from 1 to %u and weights "
+                   "of at least 1", list, CONFIG_MAX_POWERUP_KINDS, UINT8_MAX);
+      return false;
+    }
+
+    cfg->powerup_powers[count] = power;
+    cfg->powerup_weights[count] = weight;
+    ++count;
+    c += length + (c[length] == ',');
+  }
+
+  if (count == 0) {
+    report_error("expected at least one power-up power");
+    return false;
+  }
+  cfg->powerup_kind_count = count;
+  return true;
+}
+
+static bool parse_uint_option(Config *cfg, ParseContext *ctx, unsigned int *out) {
+  bool success = parse_uint(cfg, ctx, out);
+  if (!success) {
+    report_error("expected integer value");
+  }
+  return success;
+}
+
 static bool parse_option_value(Config *cfg, ParseContext *ctx, OptionType opt) {
   if (ctx->cursor == ctx->chunk_count) {
+    report_error("expected value for option '%s'", ctx->chunks[ctx->cursor - 1]);
     return false;
   }
 
   switch (opt) {
-  case OPTION_PLAYER_COUNT: {
-    bool success = parse_uint(cfg, ctx, &cfg->player_count);
-    if (!success) {
-      report_error("expected integer value");
-    }
-    return success;
-  }
+  case OPTION_PLAYER_COUNT:
+    return parse_uint_option(cfg, ctx, &cfg->player_count);
+  case OPTION_MAP_WIDTH:
+    return parse_uint_option(cfg, ctx, &cfg->map_width);
+  case OPTION_MAP_HEIGHT:
+    return parse_uint_option(cfg, ctx, &cfg->map_height);
+  case OPTION_TICK_COUNT:
+    return parse_uint_option(cfg, ctx, &cfg->tick_count);
+  case OPTION_SEED:
+    return parse_uint_option(cfg, ctx, &cfg->seed);
+  case OPTION_SCRIPT:
+    return parse_string(cfg, ctx, &cfg->script_path);
+  case OPTION_THREADS:
+    return parse_uint_option(cfg, ctx, &cfg->thread_count);
+  case OPTION_RENDERER:
+    return parse_renderer(cfg, ctx, &cfg->renderer);
+  case OPTION_MAP:
+    return parse_string(cfg, ctx, &cfg->map_path);
+  case OPTION_RECORD:
+    return parse_string(cfg, ctx, &cfg->record_path);
+  case OPTION_KEYFRAME_INTERVAL:
+    return parse_uint_option(cfg, ctx, &cfg->keyframe_interval);
+  case OPTION_HOST:
+    return parse_string(cfg, ctx, &cfg->host);
+  case OPTION_PORT:
+    return parse_uint_option(cfg, ctx, &cfg->port);
+  case OPTION_TICK_RATE:
+    return parse_uint_option(cfg, ctx, &cfg->tick_rate);
+  case OPTION_FRAME_RATE:
+    return parse_uint_option(cfg, ctx, &cfg->frame_rate);
+  case OPTION_INPUT_POLICY:
+    return parse_input_policy(cfg, ctx, &cfg->input_policy);
+  case OPTION_POWERUP_RATE:
+    return parse_uint_option(cfg, ctx, &cfg->powerup_rate);
+  case OPTION_POWERUP_LIMIT:
+    return parse_uint_option(cfg, ctx, &cfg->powerup_limit);
+  case OPTION_POWERUP_POWERS:
+    return parse_powerup_powers(cfg, ctx);
+  case OPTION_BOTS:
+    return parse_uint_option(cfg, ctx, &cfg->bot_count);
+  case OPTION_TRACE:
+    return parse_string(cfg, ctx, &cfg->trace_path);
+  case OPTION_CAPTURE:
+    return parse_string(cfg, ctx, &cfg->capture_path);
+  case OPTION_CAPTURE_FORMAT:
+    return parse_capture_format(cfg, ctx, &cfg->capture_format);
+  case OPTION_CAPTURE_STRIDE:
+    return parse_uint_option(cfg, ctx, &cfg->capture_stride);
   }
 }
 
@@ -106,5 +408,35 @@ bool config_from_args(Config *cfg, int argc, const char **argv) {
     }
   }
 
+  if (cfg->player_count < 1) {
+    report_error("player count must be at least 1");
+    return false;
+  }
+
+  if (cfg->port > UINT16_MAX) {
+    report_error("port must be at most %u", UINT16_MAX);
+    return false;
+  }
+
+  if (cfg->tick_rate < 1) {
+    report_error("tick rate must be at least 1");
+    return false;
+  }
+
+  if (cfg->map_width < 3 || cfg->map_height < 3) {
+    report_error("map dimensions must be at least 3x3");
+    return false;
+  }
+
+  if (cfg->capture_stride < 1) {
+    report_error("capture stride must be at least 1");
+    return false;
+  }
+
+  if (cfg->trace_path != nullptr && !trace_enabled()) {
+    report_error("tracing is disabled, build with TRACE=1");
+    return false;
+  }
+
   return true;
 }
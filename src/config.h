@@ -19,10 +19,106 @@ typedef struct {
   size_t cursor;
 } ParseContext;
 
+typedef enum {
+  // One quad per cell, updated incrementally as cells change.
+  RENDERER_CELLS,
+  // Walls and the background merged into large quads that are only rebuilt
+  // when the layout of the map changes, with players and power-ups drawn
+  // over them.
+  RENDERER_GREEDY,
+  // The type of every cell stored in a texture, drawn with a single quad.
+  RENDERER_TEXTURE,
+} RendererType;
+
+// How the actions queued by a player are applied, see game_apply_inputs.
+typedef enum {
+  // One turn per tick, the rest stay queued for the following ticks, so
+  // quick successive turns are all made.
+  INPUT_POLICY_QUEUED,
+  // Only the last action given before a tick is applied, the rest are
+  // dropped.
+  INPUT_POLICY_LATEST,
+} InputPolicy;
+
+// How frames captured with --capture are written, see capture.h.
+typedef enum {
+  // YUV4MPEG2 with 4:4:4 chroma, which most video tools read directly.
+  CAPTURE_FORMAT_Y4M,
+  // Bare 8 bit RGBA pixels, one frame after another, rows top to bottom.
+  CAPTURE_FORMAT_RGBA,
+} CaptureFormat;
+
+// The most kinds of power-up that can be given with --powerup-powers.
+#define CONFIG_MAX_POWERUP_KINDS 16
+
 typedef struct {
   // Has a default value of 1.
   // Must be greater than or equal to 1.
   unsigned int player_count;
+  // The dimensions of the generated map, both have a default value of 32.
+  unsigned int map_width;
+  unsigned int map_height;
+  // The number of ticks to simulate when running headless or capturing, has
+  // a default value of 1000.
+  unsigned int tick_count;
+  // Seed for anything that is randomised, has a default value of 1.
+  unsigned int seed;
+  // The number of threads used to update the simulation, 0 uses one thread
+  // per processor. Has a default value of 1.
+  unsigned int thread_count;
+  // How the map is drawn, has a default value of RENDERER_CELLS.
+  RendererType renderer;
+  // Path to a file of scripted inputs, if this is null inputs are random.
+  const char *script_path;
+  // Path to a map file written by snake-mapconv, if this is null a walled
+  // arena of map_width by map_height cells is used.
+  const char *map_path;
+  // Path to write a replay of the game to, if this is null nothing is
+  // recorded, see replay.h.
+  const char *record_path;
+  // The number of ticks between keyframes in a replay, 0 only writes the
+  // initial keyframe. Has a default value of 1000.
+  unsigned int keyframe_interval;
+  // The address snake-server listens on, defaults to 127.0.0.1 if this is
+  // null. If set, the game connects to a server at this address instead of
+  // running a game of its own.
+  const char *host;
+  // The port used with host, has a default value of 7777.
+  unsigned int port;
+  // The number of ticks per second the game runs at, both in a window and in
+  // snake-server. Has a default value of 8.
+  unsigned int tick_rate;
+  // The most frames per second drawn in a window, 0 does not cap frames. Has a
+  // default value of 60.
+  unsigned int frame_rate;
+  // Has a default value of INPUT_POLICY_QUEUED.
+  InputPolicy input_policy;
+  // The average number of power-ups spawned every 1000 ticks, 0 disables
+  // spawning. Has a default value of 50.
+  unsigned int powerup_rate;
+  // The most power-ups on the map at once, has a default value of 4.
+  unsigned int powerup_limit;
+  // The power of each spawned power-up is picked from powerup_powers, in
+  // proportion to powerup_weights. Given as a list of power:weight pairs, the
+  // default is a single kind with a power of 5.
+  unsigned int powerup_powers[CONFIG_MAX_POWERUP_KINDS];
+  unsigned int powerup_weights[CONFIG_MAX_POWERUP_KINDS];
+  unsigned int powerup_kind_count;
+  // The number of players driven by bots, spawned on top of player_count,
+  // see bot.h. Has a default value of 0.
+  unsigned int bot_count;
+  // Path to write a Chrome trace of the timing probes to on exit, if this is
+  // null no trace is written. Probes are only built with TRACE=1, see
+  // trace.h.
+  const char *trace_path;
+  // Path to write frames to, "-" writes them to stdout. If set, the game is
+  // drawn offscreen rather than in a visible window, and runs tick_count
+  // ticks as fast as it can.
+  const char *capture_path;
+  // Has a default value of CAPTURE_FORMAT_Y4M.
+  CaptureFormat capture_format;
+  // The number of ticks between captured frames, has a default value of 1.
+  unsigned int capture_stride;
 } Config;
 
 void config_init(Config *config);
@@ -2,72 +2,356 @@
 #include <stdlib.h>
 
 #include "action.h"
+#include "config.h"
 #include "error.h"
 #include "game.h"
 #include "input.h"
 #include "map.h"
+#include "mapfile.h"
 #include "player.h"
+#include "players.h"
+#include "pool.h"
+#include "rng.h"
+#include "spawner.h"
+#include "trace.h"
 #include "util.h"
 #include "vec.h"
 
-void player_data_init(PlayerData *player_data) {
-  player_init(&player_data->player);
-  action_init(&player_data->current_action);
-  action_init(&player_data->previous_action);
-}
-
-void player_data_free(PlayerData *player_data) {
-  player_free(&player_data->player);
-  player_data_init(player_data);
-}
-
 void game_init(Game *game) {
-  game->player_data = nullptr;
-  game->player_capacity = 0;
-  game->player_count = 0;
+  players_init(&game->players, CELL_PLAYER_ID_COUNT);
   map_init(&game->map);
   keymap_init(&game->keymap);
+  game->claims = nullptr;
+  game->claim_capacity = 0;
+  pool_init(&game->pool);
+  game->tick = 0;
+  rng_init(&game->rng, 0);
+  game->input_policy = INPUT_POLICY_QUEUED;
+  spawner_init(&game->spawner);
+  game->powerup_count = 0;
 }
 
 void game_free(Game *game) {
-  for (int i = 0; i < game->player_count; ++i) {
-    player_data_free(&game->player_data[i]);
-  }
-  free(game->player_data);
+  players_free(&game->players);
   map_free(&game->map);
   keymap_free(&game->keymap);
+  free(game->claims);
+  pool_free(&game->pool);
   game_init(game);
 }
 
-void game_add_player(Game *game, Player player) {
-  if (game->player_count == game->player_capacity) {
-    size_t capacity = new_capacity(game->player_capacity);
-    PlayerData *player_data =
-        realloc(game->player_data, capacity * sizeof(PlayerData));
-    if (player_data == nullptr) {
-      report_error("failed to resize game player_data allocation");
+static Map create_map(const Config *config) {
+  Map map;
+  map_init(&map);
+  if (config->map_path != nullptr) {
+    if (!map_load(&map, config->map_path))
       exit(EXIT_FAILURE);
+    return map;
+  }
+
+  map_set_dimensions(&map, config->map_width, config->map_height);
+  map_fill(&map, (Cell){CELL_EMPTY});
+
+  // Set vertical walls.
+  for (int i = 0; i < map.height; ++i) {
+    const Cell cell = {CELL_WALL};
+    map_set_cell(&map, vec2i(0, i), cell);
+    map_set_cell(&map, vec2i(map.width - 1, i), cell);
+  }
+
+  // Set horizontal walls.
+  for (int i = 0; i < map.width; ++i) {
+    const Cell cell = {CELL_WALL};
+    map_set_cell(&map, vec2i(i, 0), cell);
+    map_set_cell(&map, vec2i(i, map.height - 1), cell);
+  }
+
+  return map;
+}
+
+static bool is_spawn(const Map *map, Vec2I head) {
+  const Vec2I tail = map_wrap_pos(map, vec2i(head.x, head.y + 1));
+  return map_get_cell(map, head).type == CELL_EMPTY &&
+         map_get_cell(map, tail).type == CELL_EMPTY;
+}
+
+// Searches from pos up to end in row major order, only visiting the cells
+// that are not blocked along with the cell above them, which skips over
+// crowded stretches of the map a word at a time.
+static bool find_indexed_spawn(const Map *map, Vec2I *pos, Vec2I end) {
+  Vec2I next = *pos;
+  while (bitboard_next_clear_pair(&map->blocked, &next)) {
+    if (next.y > end.y || (next.y == end.y && next.x >= end.x))
+      return false;
+    if (is_spawn(map, next)) {
+      *pos = next;
+      return true;
     }
+    ++next.x;
+  }
+  return false;
+}
 
-    game->player_data = player_data;
-    game->player_capacity = capacity;
+// Maps loaded from file can have anything at the positions players are
+// spread over, so search onwards in row-major order for an empty vertical
+// pair of cells. Returns false if there are none.
+static bool find_spawn(const Map *map, Vec2I *pos) {
+  if (map->blocked.words != nullptr) {
+    // From pos to the end of the map, then from the start up to pos.
+    Vec2I head = *pos;
+    if (!find_indexed_spawn(map, &head, vec2i(0, map->height))) {
+      head = vec2i(0, 0);
+      if (!find_indexed_spawn(map, &head, *pos))
+        return false;
+    }
+    *pos = head;
+    return true;
   }
 
-  PlayerData *player_data = &game->player_data[game->player_count++];
-  player_data_init(player_data);
-  player_data->player = player;
+  const size_t cell_count = map->width * map->height;
+  const size_t start = pos->x + pos->y * map->width;
+  for (size_t i = 0; i < cell_count; ++i) {
+    const size_t index = (start + i) % cell_count;
+    const Vec2I head = vec2i(index % map->width, index / map->width);
+    if (is_spawn(map, head)) {
+      *pos = head;
+      return true;
+    }
+  }
+
+  return false;
 }
 
-void game_update(Game *game) {
-  for (int i = 0; i < game->player_count; ++i) {
-    PlayerData *player_data = &game->player_data[i];
-    Player *player = &game->player_data[i].player;
-    Action *action = &game->player_data[i].current_action;
+// Builds the map described by the config and spawns its players, everything
+// except input handling, which depends on where the game is being run.
+void game_setup(Game *game, const Config *config) {
+  if (config->player_count > CELL_PLAYER_ID_COUNT) {
+    report_error("at most %zu players are supported, build with "
+                 "WIDE_PLAYER_IDS=1 for more", CELL_PLAYER_ID_COUNT);
+    exit(EXIT_FAILURE);
+  }
 
-    if (!player->alive)
-      return;
+  game_init(game);
+  rng_init(&game->rng, config->seed);
+  game->input_policy = config->input_policy;
+  game->map = create_map(config);
+  map_index_empty(&game->map);
+  map_index_blocked(&game->map);
+  spawner_setup(&game->spawner, config);
+  pool_spawn(&game->pool, config->thread_count);
 
-    Vec2I direction = action_direction(*action);
+  // Players are spread over an evenly spaced grid, with a single row when
+  // there are only a few of them.
+  // TODO: Determine appropriate starting position for players.
+  unsigned int columns = 1;
+  while (columns * columns < config->player_count)
+    ++columns;
+  const unsigned int rows = (config->player_count + columns - 1) / columns;
+  const unsigned int x_spacing = game->map.width / (columns + 1);
+  const unsigned int y_spacing = game->map.height / (rows + 1);
+  if (x_spacing < 1 || y_spacing < 2) {
+    report_error("map is too small for %u players", config->player_count);
+    exit(EXIT_FAILURE);
+  }
+
+  for (int i = 0; i < config->player_count; ++i) {
+    Player player;
+    player_init(&player);
+
+    Vec2I pos = vec2i(x_spacing * (i % columns + 1),
+                      y_spacing * (i / columns + 1));
+    if (!find_spawn(&game->map, &pos)) {
+      report_error("map has no room for %u players", config->player_count);
+      exit(EXIT_FAILURE);
+    }
+
+    const Vec2I bounds = vec2i(game->map.width, game->map.height);
+    const Vec2I tail = map_wrap_pos(&game->map, vec2i(pos.x, pos.y + 1));
+    player_spawn(&player, &game->players.bodies, bounds, pos, tail);
+    PlayerHandle handle = game_add_player(game, player);
+    map_player(&game->map, &players_get(&game->players, handle)->player);
+  }
+}
+
+// The player's body must have been allocated from the game's arena,
+// game->players.bodies. Returns PLAYER_HANDLE_NULL if the game is full.
+PlayerHandle game_add_player(Game *game, Player player) {
+  return players_insert(&game->players, player);
+}
+
+// Spawns a player at a random free position, returns PLAYER_HANDLE_NULL if
+// the game is full or there is no room on the map.
+PlayerHandle game_spawn_player(Game *game) {
+  if (game->players.free_slot == PLAYER_SLOT_NONE &&
+      game->players.slot_count == game->players.slot_limit)
+    return PLAYER_HANDLE_NULL;
+
+  // A random empty cell usually has room above it, otherwise the search
+  // carries on from there.
+  const size_t empty_count = map_empty_count(&game->map);
+  if (empty_count == 0)
+    return PLAYER_HANDLE_NULL;
+  Vec2I pos = map_empty_cell(&game->map, rng_range(&game->rng, empty_count));
+  if (!find_spawn(&game->map, &pos))
+    return PLAYER_HANDLE_NULL;
+
+  Player player;
+  player_init(&player);
+  const Vec2I bounds = vec2i(game->map.width, game->map.height);
+  const Vec2I tail = map_wrap_pos(&game->map, vec2i(pos.x, pos.y + 1));
+  player_spawn(&player, &game->players.bodies, bounds, pos, tail);
+
+  PlayerHandle handle = game_add_player(game, player);
+  map_player(&game->map, &players_get(&game->players, handle)->player);
+  return handle;
+}
+
+// Gives a cell to any player with a segment in it, or leaves it empty.
+// Walks every player, so only used for the rare cell that is shared. Walls
+// are never handed out, a head that died in one shares it with nobody.
+static void restore_cell(Game *game, Vec2I pos) {
+  if (map_get_cell(&game->map, pos).type == CELL_WALL)
+    return;
+
+  for (size_t i = 0; i < game->players.count; ++i) {
+    const Player *player = &game->players.data[i].player;
+    PlayerCursor cursor = player_cursor(player);
+    Vec2I segment;
+    while (player_cursor_next(&cursor, &segment)) {
+      if (vec2i_eq(segment, pos)) {
+        const Cell cell = {CELL_PLAYER, {.player = {player->id}}};
+        map_set_cell(&game->map, pos, cell);
+        return;
+      }
+    }
+  }
+}
+
+// Removes a player along with its segments from the map. Returns false if
+// the handle is stale.
+bool game_remove_player(Game *game, PlayerHandle handle) {
+  PlayerData *player_data = players_get(&game->players, handle);
+  if (player_data == nullptr)
+    return false;
+
+  const Player *player = &player_data->player;
+  // The head of a player that died moving into another player shares its
+  // cell with them, see commit_moves, and they get the cell back. Only if
+  // the player owned the cell, a head that died in a wall left it a wall.
+  const Vec2I head = player->count > 0 ? player_front(player) : VEC2I_ZERO;
+  const Cell head_cell = map_get_cell(&game->map, head);
+  const bool shares_head = !player->alive && player->count > 0 &&
+                           head_cell.type == CELL_PLAYER &&
+                           head_cell.player.id == player->id;
+
+  PlayerCursor cursor = player_cursor(player);
+  Vec2I pos;
+  while (player_cursor_next(&cursor, &pos)) {
+    const Cell cell = map_get_cell(&game->map, pos);
+    if (cell.type == CELL_PLAYER && cell.player.id == player->id)
+      map_set_cell(&game->map, pos, (Cell){CELL_EMPTY});
+  }
+
+  const bool removed = players_remove(&game->players, handle);
+  if (shares_head)
+    restore_cell(game, head);
+  return removed;
+}
+
+// Whether the action would change the direction the player is moving in,
+// turning back on itself does not count.
+static bool action_turns(const Player *player, Action action) {
+  const Vec2I direction = action_direction(action);
+  return !vec2i_eq(direction, VEC2I_ZERO) &&
+         vec2i_dot(player_head_forward(player), direction) == 0;
+}
+
+// Takes the actions players have queued since the last tick and sets the
+// action each of them makes this tick, according to the game's input policy.
+// Should be called at the start of a tick, before the tick is recorded, as
+// replays only see the actions that were applied. Players without a queue
+// keep whatever action was set directly.
+void game_apply_inputs(Game *game, uint64_t now) {
+  TRACE_SCOPE("apply_inputs");
+  PlayerSlotMap *players = &game->players;
+  for (size_t i = 0; i < players->count; ++i) {
+    ActionQueue *queue = players->queues[players->data_slots[i]];
+    if (queue == nullptr)
+      continue;
+
+    PlayerData *player_data = &players->data[i];
+    const Player *player = &player_data->player;
+    TimedAction next;
+    while (action_queue_peek(queue, &next)) {
+      action_queue_pop(queue);
+      // The action may have been given after now was taken.
+      const bool expired =
+          now > next.time && now - next.time > GAME_INPUT_MAX_AGE_NS;
+      if (!player->alive || expired)
+        continue;
+
+      if (game->input_policy == INPUT_POLICY_LATEST) {
+        player_data->current_action = next.action;
+      } else if (action_turns(player, next.action)) {
+        // Actions that would not turn the player are skipped rather than
+        // spending the player's turn for the tick.
+        player_data->current_action = next.action;
+        break;
+      }
+    }
+  }
+}
+
+static inline uint64_t claim_key(const Map *map, Vec2I pos) {
+  return (uint64_t)pos.y * map->width + pos.x + 1;
+}
+
+// Finds the entry for a cell, or the unused entry it would be stored in.
+static Claim *find_claim(const Game *game, Vec2I pos) {
+  const uint64_t key = claim_key(&game->map, pos);
+  const size_t mask = game->claim_capacity - 1;
+  size_t index = hash_slot(key, mask);
+  for (;;) {
+    Claim *claim = &game->claims[index];
+    if (claim->key == key || claim->key == 0)
+      return claim;
+    index = (index + 1) & mask;
+  }
+}
+
+// Makes sure the claim table has room for every player while staying at most
+// half full, this only allocates when the number of players grows.
+static void reserve_claims(Game *game) {
+  size_t capacity = game->claim_capacity > 0 ? game->claim_capacity : 16;
+  while (capacity < 2 * game->players.count)
+    capacity *= 2;
+
+  if (capacity == game->claim_capacity)
+    return;
+
+  free(game->claims);
+  game->claims = calloc(capacity, sizeof(Claim));
+  if (game->claims == nullptr) {
+    report_error("failed to allocate game claims");
+    exit(EXIT_FAILURE);
+  }
+  game->claim_capacity = capacity;
+}
+
+// Phase one, work out where each player in the range is going to move. Only
+// reads shared state, and only writes to the move of each player, so ranges
+// can be proposed independently of each other.
+static void propose_moves(Game *game, size_t begin, size_t end) {
+  for (size_t i = begin; i < end; ++i) {
+    PlayerData *player_data = &game->players.data[i];
+    Player *player = &player_data->player;
+    PlayerMove *move = &player_data->move;
+
+    move->active = player->alive;
+    if (!move->active)
+      continue;
+
+    Vec2I direction = action_direction(player_data->current_action);
     Vec2I forward = player_head_forward(player);
 
     // If the player is not attempting to turn, ignore the input.
@@ -75,43 +359,167 @@ void game_update(Game *game) {
       direction = forward;
     }
 
-    // Figure out which cell the player's new segment is in, and check for
-    // collisions.
-    PlayerSegment new_head = {
-        map_wrap_pos(&game->map, vec2i_add(player_front(player)->position, direction))};
-    player_push_front(player, new_head);
-    // Check if the player picked up a power-up last update. If so, we do not
+    move->head =
+        map_wrap_pos(&game->map, vec2i_add(player_front(player), direction));
+    // If the player picked up a power-up in a previous update, we do not
     // remove the player's last segment.
-    if (player->queued_growth > 0) {
+    move->grows = player->queued_growth > 0;
+  }
+}
+
+// Phase two, vacate the cells of every tail that moves this tick and claim
+// the cells players are moving into. Both are commutative, so the order in
+// which players are visited does not matter.
+static void claim_moves(Game *game) {
+  TRACE_SCOPE("claim_moves");
+  for (size_t i = 0; i < game->players.count; ++i) {
+    PlayerData *player_data = &game->players.data[i];
+    PlayerMove *move = &player_data->move;
+    if (!move->active)
+      continue;
+
+    // The new head is pushed before the tail is popped, so there must be
+    // room for one more segment. Growing here means resolving never
+    // allocates, which would not be safe from the pool's workers.
+    Player *player = &player_data->player;
+    player_reserve(player, &game->players.bodies, player->count + 1);
+
+    // A tail only vacates a cell it owns. If it is owned by someone else,
+    // the head of a player that died moving into it is still there.
+    if (!move->grows) {
+      const Vec2I tail = player_back(player);
+      const Cell cell = map_get_cell(&game->map, tail);
+      if (cell.type == CELL_PLAYER && cell.player.id == player->id)
+        map_set_cell(&game->map, tail, (Cell){CELL_EMPTY});
+    }
+
+    Claim *claim = find_claim(game, move->head);
+    // A power-up is used up by the first player to reach it, even if that
+    // player does not get it because another arrives at the same time.
+    if (claim->count == 0 &&
+        map_get_cell(&game->map, move->head).type == CELL_POWERUP)
+      --game->powerup_count;
+    claim->key = claim_key(&game->map, move->head);
+    move->claim = claim - game->claims;
+    if (claim->count < 2)
+      ++claim->count;
+  }
+}
+
+// Phase three, move each player in the range and resolve collisions. A
+// player dies when it moves into a wall, into a segment that is still
+// occupied after every tail has moved, or into a cell another player is
+// moving into at the same time. Head-on collisions fall out of this, as a
+// head is never vacated during a tick. Only reads shared state, so ranges
+// can be resolved independently of each other.
+static void resolve_moves(Game *game, size_t begin, size_t end) {
+  for (size_t i = begin; i < end; ++i) {
+    PlayerData *player_data = &game->players.data[i];
+    Player *player = &player_data->player;
+    const PlayerMove *move = &player_data->move;
+    if (!move->active)
+      continue;
+
+    player_push_front(player, move->head);
+    if (move->grows) {
       --player->queued_growth;
     } else {
-      PlayerSegment segment = player_pop_back(player);
-      Cell cell = {CELL_EMPTY};
-      map_set_cell(&game->map, segment.position, cell);
+      player_pop_back(player);
     }
 
-    // As it currently works, if two players are attempting to occupy a cell,
-    // the one that is updated first will live and the other die. This isn't
-    // really fair, and should be fixed later. A better system would be to
-    // move all players, keeping track of their new positions, checking
-    // whether there was a colilision in any of the updated cells, and then
-    // killing the appropriate players.
-    Cell head_cell = map_get_cell(&game->map, new_head.position);
+    Cell head_cell = map_get_cell(&game->map, move->head);
+    bool contested = game->claims[move->claim].count > 1;
     switch (head_cell.type) {
     case CELL_WALL:
     case CELL_PLAYER: {
       player->alive = false;
     } break;
     case CELL_POWERUP: {
-      PowerUpCell cell = head_cell.powerup;
-      player->queued_growth += cell.power;
+      // Nobody gets the power-up if two players reach it at the same time.
+      if (!contested) {
+        PowerUpCell cell = head_cell.powerup;
+        player->queued_growth =
+            min(player->queued_growth + cell.power, UINT8_MAX);
+      }
     } break;
     case CELL_EMPTY:
       break;
     }
 
+    if (contested)
+      player->alive = false;
+
     // Clear action.
     player_data->previous_action = player_data->current_action;
     action_init(&player_data->current_action);
   }
 }
+
+static void propose_chunk(void *context, size_t begin, size_t end) {
+  TRACE_SCOPE("propose_chunk");
+  propose_moves(context, begin, end);
+}
+
+static void resolve_chunk(void *context, size_t begin, size_t end) {
+  TRACE_SCOPE("resolve_chunk");
+  resolve_moves(context, begin, end);
+}
+
+// Phase four, write each new head to the map, and reset the claims made
+// this tick, so the claim table does not need to be cleared in full. Every
+// entry is removed at once, so there is no need for tombstones. Together
+// with the tails vacated while claiming, this keeps the map in step with the
+// players without rewriting their bodies.
+//
+// Players that die keep their bodies on the map, including a head that
+// moved into another player. The dead head takes the cell over, so that it
+// is not vacated when the other player's tail moves on. A head that moved
+// into a wall leaves the wall be.
+static void commit_moves(Game *game) {
+  TRACE_SCOPE("commit_moves");
+  for (size_t i = 0; i < game->players.count; ++i) {
+    const PlayerData *player_data = &game->players.data[i];
+    const PlayerMove *move = &player_data->move;
+    if (!move->active)
+      continue;
+
+    if (map_get_cell(&game->map, move->head).type != CELL_WALL) {
+      const Cell cell = {CELL_PLAYER, {.player = {player_data->player.id}}};
+      map_set_cell(&game->map, move->head, cell);
+    }
+    game->claims[move->claim] = (Claim){0, 0};
+  }
+}
+
+// Every player moves simultaneously. Moves are proposed from the state at
+// the start of the tick, then tails are vacated and target cells claimed,
+// and finally collisions are resolved against the result, so the outcome is
+// the same no matter which order players are stored in. Proposing and
+// resolving are split into chunks of players and run on the game's thread
+// pool, the phases that write to the map run on the calling thread.
+// Power-ups are spawned first, while every player is still on the map. The
+// map is up to date once the update returns, only players that are added
+// need to be written in full, see map_player.
+void game_update(Game *game) {
+  TRACE_SCOPE("game_update");
+  {
+    TRACE_SCOPE("spawn_powerups");
+    game->powerup_count += spawner_update(&game->spawner, &game->map,
+                                          &game->rng, game->powerup_count);
+  }
+  reserve_claims(game);
+
+  {
+    TRACE_SCOPE("propose_moves");
+    parallel_for(&game->pool, game->players.count, GAME_PLAYER_CHUNK_SIZE,
+                 propose_chunk, game);
+  }
+  claim_moves(game);
+  {
+    TRACE_SCOPE("resolve_moves");
+    parallel_for(&game->pool, game->players.count, GAME_PLAYER_CHUNK_SIZE,
+                 resolve_chunk, game);
+  }
+  commit_moves(game);
+  ++game->tick;
+}
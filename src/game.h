@@ -5,36 +5,63 @@
 #include <stddef.h>
 #include <stdint.h>
 
+#include "config.h"
 #include "input.h"
 #include "map.h"
 #include "player.h"
+#include "players.h"
+#include "pool.h"
+#include "rng.h"
+#include "spawner.h"
 
+// The number of players moving into a cell during a tick, saturating at 2.
+// Claims are kept in an open addressing hash table keyed by cell, so that the
+// memory used scales with the number of players rather than the size of the
+// map.
 typedef struct {
-  Player player;
-  Action current_action;
-  Action previous_action;
-} PlayerData;
-
-void player_data_init(PlayerData *player_data);
-void player_data_free(PlayerData *player_data);
+  // One more than the row major index of the cell, 0 if the entry is unused.
+  uint64_t key;
+  uint8_t count;
+} Claim;
 
 typedef struct {
-  // TODO: Currently we just store an array of data associated with each player,
-  // this array is indexed by id. An issue with this is that while order is
-  // currently stable, it cannot be if networked multiplayer is to be
-  // implemented, as players can connect and disconnect at any time. We will
-  // need to replace this with something else.
-  PlayerData *player_data;
-  size_t player_capacity;
-  size_t player_count;
+  // Players can join and leave at any time, so they are referred to by
+  // handle, and updated by walking players.data.
+  PlayerSlotMap players;
   Map map;
   KeyMap keymap;
+  // The cells players are moving into this tick, see Claim. The table is
+  // empty between ticks.
+  Claim *claims;
+  size_t claim_capacity;
+  // Workers used to update players in parallel.
+  ThreadPool pool;
+  // The number of times the game has been updated.
+  uint64_t tick;
+  // Anything the game randomises draws from this, so that a game is
+  // reproduced exactly by its initial state and the actions of its players.
+  Rng rng;
+  // How queued actions become the actions of the next tick.
+  InputPolicy input_policy;
+  PowerUpSpawner spawner;
+  // The number of power-ups on the map.
+  uint32_t powerup_count;
 } Game;
 
+// The number of players processed together by one worker during a tick.
+#define GAME_PLAYER_CHUNK_SIZE 256
+// Queued actions older than this are dropped, so that input buffered during
+// a hitch does not steer players long after it was given.
+#define GAME_INPUT_MAX_AGE_NS 1000000000ull
+
 void game_init(Game *game);
 void game_free(Game *game);
+void game_setup(Game *game, const Config *config);
 
+void game_apply_inputs(Game *game, uint64_t now);
 void game_update(Game *game);
-void game_add_player(Game *game, Player player);
+PlayerHandle game_add_player(Game *game, Player player);
+PlayerHandle game_spawn_player(Game *game);
+bool game_remove_player(Game *game, PlayerHandle handle);
 
 #endif // !SNAKE_GAME_H
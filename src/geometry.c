@@ -1,9 +1,13 @@
+#include <assert.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include <glad/gl.h>
 
 #include "error.h"
 #include "geometry.h"
+#include "trace.h"
+#include "util.h"
 
 static unsigned int buffer_type_target(BufferType type) {
   switch (type) {
@@ -20,6 +24,7 @@ static void buffer_init(Buffer *buffer, BufferType type, size_t datum_size) {
   buffer->datum_size = datum_size;
   buffer->datum_count = 0;
   buffer->handle = 0;
+  buffer->gpu_size = 0;
 }
 
 static void buffer_free(Buffer *buffer) {
@@ -47,33 +52,47 @@ static void buffer_set_length(Buffer *buffer, size_t length) {
   buffer->datum_count = length;
 }
 
+// Vertex data is rewritten as the map changes, while indices only change
+// when the number of quads does.
+static unsigned int buffer_type_usage(BufferType type) {
+  switch (type) {
+  case BUFFER_ARRAY:
+    return GL_DYNAMIC_DRAW;
+  case BUFFER_ELEMENT:
+    return GL_STATIC_DRAW;
+  }
+}
+
 // Should not be called unless we have already created and bound a vertex array.
 static void buffer_sync(Buffer *buffer) {
+  TRACE_SCOPE("buffer_sync");
+  // The buffer only needs to be attached to the vertex array once, after that
+  // it is updated through its handle.
   if (buffer->handle == 0) {
     glCreateBuffers(1, &buffer->handle);
-  }
 
-  int target = buffer_type_target(buffer->type);
-  glBindBuffer(target, buffer->handle);
+    int target = buffer_type_target(buffer->type);
+    glBindBuffer(target, buffer->handle);
 
-  if (target == GL_ARRAY_BUFFER) {
-    glVertexAttribPointer(0, 2, GL_INT, GL_FALSE, sizeof(Vertex), (void *)offsetof(Vertex, pos));
-    glEnableVertexAttribArray(0);
+    if (target == GL_ARRAY_BUFFER) {
+      glVertexAttribPointer(0, 2, GL_INT, GL_FALSE, sizeof(Vertex), (void *)offsetof(Vertex, pos));
+      glEnableVertexAttribArray(0);
 
-    glVertexAttribIPointer(1, 1, GL_UNSIGNED_INT, sizeof(Vertex), (void *)offsetof(Vertex, type));
-    glEnableVertexAttribArray(1);
+      glVertexAttribIPointer(1, 1, GL_UNSIGNED_INT, sizeof(Vertex), (void *)offsetof(Vertex, type));
+      glEnableVertexAttribArray(1);
+    }
   }
 
   size_t buffer_size = buffer->datum_count * buffer->datum_size;
-  int gpu_buffer_size;
-  glGetBufferParameteriv(target, GL_BUFFER_SIZE, &gpu_buffer_size);
   // We could just check whether the buffer is large enough to hold the data,
   // the issue is that if the buffer on the cpu side shrinks then we will hold
   // on to some extra memory that we don't need.
-  if (gpu_buffer_size != buffer_size) {
-    glBufferData(target, buffer_size, buffer->data, GL_STATIC_DRAW);
-  } else {
-    glBufferSubData(target, 0, buffer_size, buffer->data);
+  if (buffer->gpu_size != buffer_size) {
+    glNamedBufferData(buffer->handle, buffer_size, buffer->data,
+                      buffer_type_usage(buffer->type));
+    buffer->gpu_size = buffer_size;
+  } else if (buffer_size > 0) {
+    glNamedBufferSubData(buffer->handle, 0, buffer_size, buffer->data);
   }
 }
 
@@ -102,10 +121,6 @@ void geometry_free(Geometry *geometry) {
   geometry_init(geometry);
 }
 
-static Vertex vertex(const Map *map, unsigned int i);
-void write_vertices(const Map *map, Vertex *vertices);
-void write_indices(const Map *map, unsigned int *indices);
-
 void geometry_sync(Geometry *geometry, bool resized) {
   if (geometry->handle == 0) {
     glCreateVertexArrays(1, &geometry->handle);
@@ -121,96 +136,380 @@ void geometry_sync(Geometry *geometry, bool resized) {
   glBindVertexArray(GL_NONE);
 }
 
-// Currently this is the only correct way to make geometry.
-void geometry_from_map(Geometry *geometry, const Map *map) {
-  unsigned prev_cell_count = geometry->vertices.datum_count / 4;
-  unsigned cell_count = map->width * map->height;
-  bool need_resize = cell_count != prev_cell_count;
-  // Resize the buffers if the size of the map has changed or the buffers are empty.
-  if (need_resize) {
-    // 4 vertices per cell.
-    buffer_set_length(&geometry->vertices, 4 * cell_count);
-    // 2 triangles per cell.
-    buffer_set_length(&geometry->indices, 6 * cell_count);
+// Resizes the geometry to hold the given number of quads, rewriting the
+// indices if the number changed. Returns whether the geometry was resized.
+static bool set_quad_count(Geometry *geometry, size_t quad_count) {
+  if (geometry->vertices.datum_count == 4 * quad_count &&
+      geometry->indices.datum_count == 6 * quad_count)
+    return false;
+
+  buffer_set_length(&geometry->vertices, 4 * quad_count);
+  buffer_set_length(&geometry->indices, 6 * quad_count);
+  write_quad_indices(geometry->indices.data, quad_count);
+  return true;
+}
+
+typedef struct {
+  Vec2I min;
+  Vec2I max;
+  CellType type;
+} Rect;
+
+typedef struct {
+  Rect *rects;
+  size_t capacity;
+  size_t count;
+} RectList;
+
+static void rect_list_push(RectList *list, Rect rect) {
+  if (list->count == list->capacity) {
+    size_t capacity = new_capacity(list->capacity);
+    Rect *rects = realloc(list->rects, capacity * sizeof(Rect));
+    if (rects == nullptr) {
+      report_error("failed to resize rect list allocation");
+      exit(EXIT_FAILURE);
+    }
+    list->rects = rects;
+    list->capacity = capacity;
   }
 
-  // Update the contents of the buffers.
-  write_vertices(map, geometry->vertices.data);
-  if (need_resize)
-    write_indices(map, geometry->indices.data);
+  list->rects[list->count++] = rect;
+}
 
-  geometry_sync(geometry, need_resize);
+// The type a cell is drawn as in the static layer, dynamic cells are drawn
+// over the empty background.
+static CellType static_type(const Map *map, unsigned int x, unsigned int y) {
+  CellType type = map_get_cell(map, vec2i(x, y)).type;
+  return map_cell_is_static(type) ? type : CELL_EMPTY;
 }
 
-// TODO: Think about redesigning this. Currently we write one quad per cell no
-// matter what. We continually update the buffer data, but the only things that
-// change each frame are the dynamic cells. Another thing to think about is the
-// fact that we don't actually need to submit each cell as a quad, we could
-// instead create larger quads that contain multiple adjacent cells of the same
-// type.
-void write_vertices(const Map *map, Vertex *vertices) {
-  for (int i = 0; i < 4 * map->width * map->height; ++i) {
-    vertices[i] = vertex(map, i);
+// Greedy meshing, each cell that has not yet been covered starts a new
+// rectangle, which is grown as far right as possible, and then as far up as
+// every cell in the next row along its width allows.
+void geometry_static_from_map(Geometry *geometry, const Map *map) {
+  size_t cell_count = map->width * map->height;
+  bool *covered = calloc(cell_count, sizeof(bool));
+  if (covered == nullptr && cell_count > 0) {
+    report_error("failed to allocate greedy mesh scratch space");
+    exit(EXIT_FAILURE);
   }
+
+  RectList list = {nullptr, 0, 0};
+  for (unsigned int y = 0; y < map->height; ++y) {
+    for (unsigned int x = 0; x < map->width; ++x) {
+      if (covered[row_maj_index(map->width, x, y)])
+        continue;
+
+      CellType type = static_type(map, x, y);
+      unsigned int x_end = x + 1;
+      while (x_end < map->width &&
+             !covered[row_maj_index(map->width, x_end, y)] &&
+             static_type(map, x_end, y) == type)
+        ++x_end;
+
+      unsigned int y_end = y + 1;
+      for (; y_end < map->height; ++y_end) {
+        bool row_matches = true;
+        for (unsigned int i = x; i < x_end && row_matches; ++i) {
+          row_matches = !covered[row_maj_index(map->width, i, y_end)] &&
+                        static_type(map, i, y_end) == type;
+        }
+        if (!row_matches)
+          break;
+      }
+
+      for (unsigned int j = y; j < y_end; ++j) {
+        for (unsigned int i = x; i < x_end; ++i) {
+          covered[row_maj_index(map->width, i, j)] = true;
+        }
+      }
+
+      rect_list_push(&list, (Rect){vec2i(x, y), vec2i(x_end, y_end), type});
+    }
+  }
+  free(covered);
+
+  bool resized = set_quad_count(geometry, list.count);
+  Vertex *vertices = geometry->vertices.data;
+  for (size_t i = 0; i < list.count; ++i) {
+    Rect *rect = &list.rects[i];
+    write_quad(&vertices[4 * i], rect->min, rect->max, rect->type);
+  }
+  free(list.rects);
+
+  geometry_sync(geometry, resized);
 }
 
-void write_indices(const Map *map, unsigned int *indices) {
-  for (int i = 0; i < map->width * map->height; ++i) {
-    // there are 6 unsigned ints per cell.
-    size_t index_offset = i * 6;
-    // There are 4 vertices per cell.
-    size_t vertex_offset = i * 4;
-    // The vertices are at vertex_offset +
-    // 2 - 3
-    // |   |
-    // 0 - 1
+void stream_geometry_init(StreamGeometry *geometry) {
+  stream_init(&geometry->vertices);
+  buffer_init(&geometry->indices, BUFFER_ELEMENT, sizeof(unsigned int));
+  geometry->quad_count = 0;
+  geometry->handle = 0;
+}
+
+void stream_geometry_free(StreamGeometry *geometry) {
+  stream_free(&geometry->vertices);
+  buffer_free(&geometry->indices);
+  glDeleteVertexArrays(1, &geometry->handle);
+  stream_geometry_init(geometry);
+}
+
+// Sets up the vertex format, which does not depend on any buffer, so that
+// the vertex buffer can be pointed at a different region of a StreamBuffer
+// every frame.
+static unsigned int create_stream_vertex_array(void) {
+  GLuint vao;
+  glCreateVertexArrays(1, &vao);
+
+  glEnableVertexArrayAttrib(vao, 0);
+  glVertexArrayAttribFormat(vao, 0, 2, GL_INT, GL_FALSE, offsetof(Vertex, pos));
+  glVertexArrayAttribBinding(vao, 0, 0);
+
+  glEnableVertexArrayAttrib(vao, 1);
+  glVertexArrayAttribIFormat(vao, 1, 1, GL_UNSIGNED_INT, offsetof(Vertex, type));
+  glVertexArrayAttribBinding(vao, 1, 0);
+  return vao;
+}
+
+// Grows the index buffer so that it can draw at least quad_count quads.
+static void stream_geometry_reserve(StreamGeometry *geometry, size_t quad_count) {
+  Buffer *indices = &geometry->indices;
+  size_t capacity = indices->datum_count / 6;
+  if (capacity >= quad_count && indices->handle != 0)
+    return;
+
+  while (capacity < quad_count)
+    capacity = new_capacity(capacity);
 
-    // Top triangle.
-    indices[index_offset + 0] = vertex_offset + 0;
-    indices[index_offset + 1] = vertex_offset + 3;
-    indices[index_offset + 2] = vertex_offset + 2;
+  buffer_set_length(indices, 6 * capacity);
+  write_quad_indices(indices->data, capacity);
 
-    // Bottom triangle.
-    indices[index_offset + 3] = vertex_offset + 0;
-    indices[index_offset + 4] = vertex_offset + 1;
-    indices[index_offset + 5] = vertex_offset + 3;
+  if (indices->handle == 0) {
+    glCreateBuffers(1, &indices->handle);
+    glVertexArrayElementBuffer(geometry->handle, indices->handle);
   }
+  indices->gpu_size = indices->datum_count * indices->datum_size;
+  glNamedBufferData(indices->handle, indices->gpu_size, indices->data,
+                    GL_STATIC_DRAW);
 }
 
-static Vertex vertex(const Map *map, unsigned int i) {
-  unsigned int cell_number = i / 4;
-  unsigned int vertex_number = i % 4;
+// Writes a quad for every dynamic cell in the rectangle [min, max) and
+// returns the number written, only counting them if vertices is null.
+static size_t write_dynamic_rect(const Map *map, Vertex *vertices, Vec2I min,
+                                 Vec2I max) {
+  size_t quad_count = 0;
+  for (int y = min.y; y < max.y; ++y) {
+    for (int x = min.x; x < max.x; ++x) {
+      CellType type = map_get_cell(map, vec2i(x, y)).type;
+      if (map_cell_is_static(type))
+        continue;
+
+      if (vertices)
+        write_quad(&vertices[4 * quad_count], vec2i(x, y), vec2i(x + 1, y + 1), type);
+      ++quad_count;
+    }
+  }
 
-  unsigned int x = cell_number % map->width;
-  unsigned int y = cell_number / map->width;
-  CellType type = map_get_cell(map, vec2i(x, y)).type;
+  return quad_count;
+}
+
+// Only allocated chunks of the map can contain dynamic cells, unless the map
+// is filled with them.
+static size_t write_dynamic_quads(const Map *map, Vertex *vertices) {
+  if (!map_cell_is_static(map_fill_cell(map).type))
+    return write_dynamic_rect(map, vertices, VEC2I_ZERO,
+                              vec2i(map->width, map->height));
+
+  size_t quad_count = 0;
+  MapChunk chunk;
+  for (size_t i = 0; map_next_chunk(map, &i, &chunk); ++i) {
+    Vec2I max = vec2i_add(chunk.origin, vec2i(chunk.width, chunk.height));
+    quad_count += write_dynamic_rect(
+        map, vertices ? &vertices[4 * quad_count] : nullptr, chunk.origin, max);
+  }
 
-  Vec2I pos;
-  switch (vertex_number) {
-  case 0:
-    // Bottom left.
-    pos.x = x + 0;
-    pos.y = y + 0;
-    break;
-  case 1:
-    // Bottom right.
-    pos.x = x + 1;
-    pos.y = y + 0;
-    break;
-  case 2:
-    // Top left.
-    pos.x = x + 0;
-    pos.y = y + 1;
-    break;
-  case 3:
-    // Top right.
-    pos.x = x + 1;
-    pos.y = y + 1;
-    break;
-  }
-
-  Vertex v;
-  v.pos = pos;
-  v.type = type;
-  return v;
+  return quad_count;
+}
+
+// One quad for every dynamic cell, only the handful of quads that are
+// actually visible are written.
+void stream_geometry_dynamic_from_map(StreamGeometry *geometry, const Map *map) {
+  TRACE_SCOPE("stream_geometry_dynamic");
+  if (geometry->handle == 0)
+    geometry->handle = create_stream_vertex_array();
+
+  size_t quad_count = write_dynamic_quads(map, nullptr);
+  stream_geometry_reserve(geometry, quad_count);
+
+  bool reallocated;
+  Vertex *vertices = stream_begin(&geometry->vertices,
+                                  4 * quad_count * sizeof(Vertex), &reallocated);
+  write_dynamic_quads(map, vertices);
+  geometry->quad_count = quad_count;
+
+  // Point the vertex array at the region that was just written.
+  glVertexArrayVertexBuffer(geometry->handle, 0, geometry->vertices.handle,
+                            stream_offset(&geometry->vertices), sizeof(Vertex));
+}
+
+// Draws the current region and fences it, so it is not overwritten while the
+// gpu is still reading from it.
+void stream_geometry_draw(StreamGeometry *geometry) {
+  if (geometry->handle == 0)
+    return;
+
+  glBindVertexArray(geometry->handle);
+  glDrawElements(GL_TRIANGLES, 6 * geometry->quad_count, GL_UNSIGNED_INT, nullptr);
+  glBindVertexArray(GL_NONE);
+  stream_fence(&geometry->vertices);
+}
+
+void cell_geometry_init(CellGeometry *geometry) {
+  stream_init(&geometry->vertices);
+  buffer_init(&geometry->indices, BUFFER_ELEMENT, sizeof(unsigned int));
+  geometry->staging = nullptr;
+  geometry->width = 0;
+  geometry->height = 0;
+  for (unsigned int i = 0; i < STREAM_REGION_COUNT; ++i) {
+    geometry->pending[i] = (PendingRows){nullptr, nullptr, 0};
+  }
+  geometry->handle = 0;
+}
+
+void cell_geometry_free(CellGeometry *geometry) {
+  stream_free(&geometry->vertices);
+  buffer_free(&geometry->indices);
+  free(geometry->staging);
+  for (unsigned int i = 0; i < STREAM_REGION_COUNT; ++i) {
+    free(geometry->pending[i].spans);
+    free(geometry->pending[i].rows);
+  }
+  glDeleteVertexArrays(1, &geometry->handle);
+  cell_geometry_init(geometry);
+}
+
+// Adds a span of a row to those a region is missing, the same way the map
+// tracks its dirty rows.
+static void pending_add(PendingRows *pending, unsigned int y, DirtySpan span) {
+  DirtySpan *current = &pending->spans[y];
+  if (current->begin == current->end) {
+    *current = span;
+    pending->rows[pending->row_count++] = y;
+  } else {
+    current->begin = min(current->begin, span.begin);
+    current->end = max(current->end, span.end);
+  }
+}
+
+static void pending_add_all(CellGeometry *geometry) {
+  for (unsigned int i = 0; i < STREAM_REGION_COUNT; ++i) {
+    PendingRows *pending = &geometry->pending[i];
+    for (unsigned int y = 0; y < geometry->height; ++y) {
+      pending->spans[y] = (DirtySpan){0, geometry->width};
+      pending->rows[y] = y;
+    }
+    pending->row_count = geometry->height;
+  }
+}
+
+// Reallocates everything that depends on the dimensions of the map, and
+// rewrites the indices, which only change along with them.
+static void cell_geometry_resize(CellGeometry *geometry, const Map *map) {
+  const size_t cell_count = (size_t)map->width * map->height;
+  Vertex *staging = realloc(geometry->staging, 4 * cell_count * sizeof(Vertex));
+  if (staging == nullptr && cell_count > 0) {
+    report_error("failed to resize cell geometry allocation");
+    exit(EXIT_FAILURE);
+  }
+  geometry->staging = staging;
+  for (unsigned int i = 0; i < STREAM_REGION_COUNT; ++i) {
+    PendingRows *pending = &geometry->pending[i];
+    DirtySpan *spans = realloc(pending->spans, map->height * sizeof(DirtySpan));
+    unsigned int *rows =
+        realloc(pending->rows, map->height * sizeof(unsigned int));
+    if (spans == nullptr || rows == nullptr) {
+      report_error("failed to resize cell geometry allocation");
+      exit(EXIT_FAILURE);
+    }
+    pending->spans = spans;
+    pending->rows = rows;
+  }
+  geometry->width = map->width;
+  geometry->height = map->height;
+
+  Buffer *indices = &geometry->indices;
+  buffer_set_length(indices, 6 * cell_count);
+  write_indices(map, indices->data);
+  if (indices->handle == 0) {
+    glCreateBuffers(1, &indices->handle);
+    glVertexArrayElementBuffer(geometry->handle, indices->handle);
+  }
+  indices->gpu_size = indices->datum_count * indices->datum_size;
+  glNamedBufferData(indices->handle, indices->gpu_size, indices->data,
+                    GL_STATIC_DRAW);
+
+  write_vertices(map, geometry->staging);
+  pending_add_all(geometry);
+}
+
+// Brings the staging copy up to date with the cells of the map that have
+// changed since it was last marked clean, then moves on to the next region
+// of the vertex buffer and copies into it every cell it is missing. A region
+// misses the cells that changed while the other regions were being written,
+// so each changed cell is copied once per region rather than the whole map
+// every frame. The caller is responsible for marking the map clean
+// afterwards.
+void cell_geometry_update(CellGeometry *geometry, const Map *map) {
+  TRACE_SCOPE("cell_geometry_update");
+  if (geometry->handle == 0)
+    geometry->handle = create_stream_vertex_array();
+
+  if (geometry->width != map->width || geometry->height != map->height) {
+    cell_geometry_resize(geometry, map);
+  } else if (map->dirty_row_count > 0) {
+    for (size_t i = 0; i < map->dirty_row_count; ++i) {
+      const unsigned int y = map->dirty_rows[i];
+      const DirtySpan span = map->dirty_spans[y];
+      write_cell_vertices(map, geometry->staging,
+                          row_maj_index(map->width, span.begin, y),
+                          span.end - span.begin);
+      for (unsigned int j = 0; j < STREAM_REGION_COUNT; ++j) {
+        pending_add(&geometry->pending[j], y, span);
+      }
+    }
+  } else {
+    return;
+  }
+
+  const size_t size = 4 * (size_t)map->width * map->height * sizeof(Vertex);
+  bool reallocated;
+  Vertex *vertices = stream_begin(&geometry->vertices, size, &reallocated);
+  if (reallocated)
+    pending_add_all(geometry);
+
+  PendingRows *pending = &geometry->pending[geometry->vertices.region];
+  for (size_t i = 0; i < pending->row_count; ++i) {
+    const unsigned int y = pending->rows[i];
+    const DirtySpan span = pending->spans[y];
+    const size_t first = 4 * row_maj_index(map->width, span.begin, y);
+    memcpy(&vertices[first], &geometry->staging[first],
+           4 * (span.end - span.begin) * sizeof(Vertex));
+    pending->spans[y] = (DirtySpan){0, 0};
+  }
+  pending->row_count = 0;
+
+  glVertexArrayVertexBuffer(geometry->handle, 0, geometry->vertices.handle,
+                            stream_offset(&geometry->vertices), sizeof(Vertex));
+}
+
+void cell_geometry_draw(CellGeometry *geometry) {
+  if (geometry->handle == 0)
+    return;
+
+  glBindVertexArray(geometry->handle);
+  TRACE_SCOPE("draw_elements");
+  glDrawElements(GL_TRIANGLES, geometry->indices.datum_count, GL_UNSIGNED_INT,
+                 nullptr);
+  glBindVertexArray(GL_NONE);
+  stream_fence(&geometry->vertices);
 }
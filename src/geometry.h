@@ -2,6 +2,8 @@
 #define SNAKE_DRAW_H
 
 #include "map.h"
+#include "stream.h"
+#include "vertex.h"
 
 typedef enum {
   BUFFER_ARRAY,
@@ -14,6 +16,9 @@ typedef struct {
   size_t datum_size;
   size_t datum_count;
   unsigned int handle;
+  // The size of the buffer's storage on the gpu in bytes, tracked here so
+  // that we never have to query it from the driver.
+  size_t gpu_size;
 } Buffer;
 
 typedef enum {
@@ -22,14 +27,6 @@ typedef enum {
   GEOMETRY_TRIANGLES,
 } GeometryType;
 
-typedef struct {
-  Vec2I pos;
-  unsigned int type;
-} Vertex;
-
-#define VERTEX_UNPADDED_SIZE sizeof(Vec2I) + sizeof(unsigned int)
-#define VERTEX_IS_UNPADDED sizeof(Vertex) == VERTEX_UNPADDED_SIZE
-
 typedef struct {
   GeometryType type;
   Buffer vertices;
@@ -38,8 +35,55 @@ typedef struct {
   unsigned int handle;
 } Geometry;
 
+// Geometry that is rebuilt from scratch every time it changes. Its vertices
+// are written straight into a persistently mapped StreamBuffer instead of
+// being staged in memory and copied, only the indices are kept in a regular
+// buffer, as they only change when the number of quads grows.
+typedef struct {
+  StreamBuffer vertices;
+  Buffer indices;
+  // The number of quads written to the current region of vertices.
+  size_t quad_count;
+  // Vertex attribute handle.
+  unsigned int handle;
+} StreamGeometry;
+
+// The rows of a region of a CellGeometry that are out of date, kept the same
+// way as the dirty rows of a map.
+typedef struct {
+  DirtySpan *spans;
+  unsigned int *rows;
+  size_t row_count;
+} PendingRows;
+
+// A quad for every cell of the map, updated as cells change. The vertices
+// are kept up to date in a staging copy, and each region of the StreamBuffer
+// they are drawn from is brought up to date from it when its turn comes, by
+// copying only the cells it is missing.
+typedef struct {
+  StreamBuffer vertices;
+  Buffer indices;
+  Vertex *staging;
+  // The dimensions of the map the geometry was built for.
+  unsigned int width;
+  unsigned int height;
+  PendingRows pending[STREAM_REGION_COUNT];
+  // Vertex attribute handle.
+  unsigned int handle;
+} CellGeometry;
+
 void geometry_init(Geometry *geometry);
 void geometry_free(Geometry *geometry);
-void geometry_from_map(Geometry *geometry, const Map *map);
+void geometry_static_from_map(Geometry *geometry, const Map *map);
+
+void stream_geometry_init(StreamGeometry *geometry);
+void stream_geometry_free(StreamGeometry *geometry);
+void stream_geometry_dynamic_from_map(StreamGeometry *geometry, const Map *map);
+void stream_geometry_draw(StreamGeometry *geometry);
+
+void cell_geometry_init(CellGeometry *geometry);
+void cell_geometry_free(CellGeometry *geometry);
+void cell_geometry_update(CellGeometry *geometry, const Map *map);
+void cell_geometry_draw(CellGeometry *geometry);
 
 #endif // !SNAKE_DRAW_H
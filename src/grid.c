@@ -0,0 +1,109 @@
+#include <stdint.h>
+#include <stdlib.h>
+
+#include <glad/gl.h>
+
+#include "error.h"
+#include "grid.h"
+#include "map.h"
+#include "trace.h"
+#include "util.h"
+
+// Makes sure there is room to stage the given number of cells.
+static void reserve(Grid *grid, size_t count) {
+  if (grid->capacity >= count)
+    return;
+
+  uint8_t *data = realloc(grid->data, count);
+  if (data == nullptr) {
+    report_error("failed to resize grid allocation");
+    exit(EXIT_FAILURE);
+  }
+  grid->data = data;
+  grid->capacity = count;
+}
+
+// Uploads the cells in [x, x + width) of a row.
+static void upload_span(Grid *grid, const Map *map, unsigned int x,
+                        unsigned int y, unsigned int width) {
+  for (unsigned int i = 0; i < width; ++i) {
+    grid->data[i] = map_get_cell(map, vec2i(x + i, y)).type;
+  }
+  glTextureSubImage2D(grid->texture, 0, x, y, width, 1, GL_RED_INTEGER,
+                      GL_UNSIGNED_BYTE, grid->data);
+}
+
+void grid_init(Grid *grid) {
+  grid->width = 0;
+  grid->height = 0;
+  grid->texture = 0;
+  grid->handle = 0;
+  grid->data = nullptr;
+  grid->capacity = 0;
+}
+
+void grid_free(Grid *grid) {
+  glDeleteTextures(1, &grid->texture);
+  glDeleteVertexArrays(1, &grid->handle);
+  free(grid->data);
+  grid_init(grid);
+}
+
+// Recreates the texture and uploads every cell of the map.
+void grid_from_map(Grid *grid, const Map *map) {
+  if (grid->handle == 0) {
+    glCreateVertexArrays(1, &grid->handle);
+  }
+
+  // Texture storage is immutable, so a new texture is needed whenever the
+  // dimensions change.
+  if (grid->texture == 0 || grid->width != map->width ||
+      grid->height != map->height) {
+    glDeleteTextures(1, &grid->texture);
+    glCreateTextures(GL_TEXTURE_2D, 1, &grid->texture);
+    glTextureStorage2D(grid->texture, 1, GL_R8UI, map->width, map->height);
+    glTextureParameteri(grid->texture, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTextureParameteri(grid->texture, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    grid->width = map->width;
+    grid->height = map->height;
+  }
+
+  size_t cell_count = map->width * map->height;
+  reserve(grid, cell_count);
+  for (size_t i = 0; i < cell_count; ++i) {
+    Vec2I pos = row_maj_position(map->width, i);
+    grid->data[i] = map_get_cell(map, pos).type;
+  }
+
+  // Rows of single bytes are not 4 byte aligned.
+  glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+  glTextureSubImage2D(grid->texture, 0, 0, 0, map->width, map->height,
+                      GL_RED_INTEGER, GL_UNSIGNED_BYTE, grid->data);
+}
+
+// Uploads only the spans of the map that have changed since it was last
+// marked clean, the caller is responsible for marking it clean afterwards.
+void grid_update(Grid *grid, const Map *map) {
+  TRACE_SCOPE("grid_update");
+  if (grid->texture == 0 || grid->width != map->width ||
+      grid->height != map->height) {
+    grid_from_map(grid, map);
+    return;
+  }
+
+  reserve(grid, map->width);
+  glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+  for (size_t i = 0; i < map->dirty_row_count; ++i) {
+    unsigned int y = map->dirty_rows[i];
+    DirtySpan span = map->dirty_spans[y];
+    upload_span(grid, map, span.begin, y, span.end - span.begin);
+  }
+}
+
+// Expects the grid program to be in use.
+void grid_draw(const Grid *grid) {
+  glBindTextureUnit(0, grid->texture);
+  glBindVertexArray(grid->handle);
+  glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+  glBindVertexArray(GL_NONE);
+}
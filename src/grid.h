@@ -0,0 +1,32 @@
+#ifndef SNAKE_GRID_H
+#define SNAKE_GRID_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "map.h"
+
+// Draws a map by uploading the type of every cell into an integer texture,
+// one byte per cell, and drawing a single quad over the whole map, with the
+// fragment shader looking up the cell each fragment lies in. Requires the
+// grid shaders, see src/shader/grid_vertex.glsl.
+typedef struct {
+  unsigned int width;
+  unsigned int height;
+  // Texture handle.
+  unsigned int texture;
+  // Vertex attribute handle, the quad has no attributes, its vertices are
+  // generated in the vertex shader.
+  unsigned int handle;
+  // Staging memory for the cells being uploaded.
+  uint8_t *data;
+  size_t capacity;
+} Grid;
+
+void grid_init(Grid *grid);
+void grid_free(Grid *grid);
+void grid_from_map(Grid *grid, const Map *map);
+void grid_update(Grid *grid, const Map *map);
+void grid_draw(const Grid *grid);
+
+#endif // !SNAKE_GRID_H
@@ -1,3 +1,4 @@
+#include <stdatomic.h>
 #include <stddef.h>
 #include <stdint.h>
 #include <stdlib.h>
@@ -77,7 +78,7 @@ static void resize(KeyMap *map) {
     if (entry_is_used(source)) {
       Entry *destination = find_entry(entries, capacity, source->keycode);
       destination->keycode = source->keycode;
-      destination->player_id = source->player_id;
+      destination->player = source->player;
       destination->action = source->action;
       ++count;
     }
@@ -100,7 +101,7 @@ void keymap_free(KeyMap *map) {
   keymap_init(map);
 }
 
-bool keymap_map(KeyMap *map, uint16_t keycode, unsigned int player_id, Action action) {
+bool keymap_map(KeyMap *map, uint16_t keycode, PlayerHandle player, Action action) {
   if (map->count + 1 > map->capacity * KEYMAP_MAX_LOAD)
     resize(map);
 
@@ -111,7 +112,7 @@ bool keymap_map(KeyMap *map, uint16_t keycode, unsigned int player_id, Action ac
     ++map->count;
   }
 
-  entry->player_id = player_id;
+  entry->player = player;
   entry->action = action;
 
   return empty;
@@ -132,16 +133,57 @@ bool keymap_unmap(KeyMap *map, uint16_t keycode) {
 
 // Returns true if the action exists and sets the contents of action to the
 // value of the entry.
-bool keymap_action(const KeyMap *map, uint16_t keycode, unsigned int *player_id, Action *action) {
+bool keymap_action(const KeyMap *map, uint16_t keycode, PlayerHandle *player, Action *action) {
   if (map->count == 0)
     return false;
 
   Entry *entry = find_entry(map->entries, map->capacity, keycode);
   bool exists = entry_is_used(entry);
   if (exists) {
-    *player_id = entry->player_id;
+    *player = entry->player;
     *action = entry->action;
   }
 
   return exists;
 }
+
+void action_queue_init(ActionQueue *queue) {
+  atomic_init(&queue->head, 0);
+  atomic_init(&queue->tail, 0);
+}
+
+// Returns false if the queue is full, in which case the action is dropped.
+bool action_queue_push(ActionQueue *queue, Action action, uint64_t time) {
+  const size_t tail = atomic_load_explicit(&queue->tail, memory_order_relaxed);
+  const size_t head = atomic_load_explicit(&queue->head, memory_order_acquire);
+  if (tail - head == ACTION_QUEUE_CAPACITY)
+    return false;
+
+  queue->entries[tail % ACTION_QUEUE_CAPACITY] = (TimedAction){action, time};
+  // Publishes the entry to the consumer.
+  atomic_store_explicit(&queue->tail, tail + 1, memory_order_release);
+  return true;
+}
+
+// Returns false if the queue is empty.
+bool action_queue_peek(ActionQueue *queue, TimedAction *action) {
+  const size_t head = atomic_load_explicit(&queue->head, memory_order_relaxed);
+  const size_t tail = atomic_load_explicit(&queue->tail, memory_order_acquire);
+  if (head == tail)
+    return false;
+
+  *action = queue->entries[head % ACTION_QUEUE_CAPACITY];
+  return true;
+}
+
+// Must only be called after a successful action_queue_peek.
+void action_queue_pop(ActionQueue *queue) {
+  const size_t head = atomic_load_explicit(&queue->head, memory_order_relaxed);
+  // Hands the entry back to the producer.
+  atomic_store_explicit(&queue->head, head + 1, memory_order_release);
+}
+
+void action_queue_clear(ActionQueue *queue) {
+  const size_t tail = atomic_load_explicit(&queue->tail, memory_order_acquire);
+  atomic_store_explicit(&queue->head, tail, memory_order_release);
+}
@@ -1,17 +1,21 @@
 #ifndef SNAKE_INPUT_H
 #define SNAKE_INPUT_H
 
+#include <stdatomic.h>
+#include <stdbool.h>
 #include <stddef.h>
 #include <stdint.h>
 
 #include "action.h"
+#include "player.h"
 
 typedef struct {
   // We use a sentinal value of 0 to indicate that the enty is unused.
   // We use a sentinal value of UINT16_MAX to indicate that the entry was
   // deleted.
   uint16_t keycode;
-  unsigned int player_id;
+  // Held by handle, so a key bound to a player that has left does nothing.
+  PlayerHandle player;
   Action action;
 } Entry;
 
@@ -31,8 +35,38 @@ typedef struct {
 void keymap_init(KeyMap *map);
 void keymap_free(KeyMap *map);
 
-bool keymap_map(KeyMap *map, uint16_t keycode, unsigned int player_id, Action action);
+bool keymap_map(KeyMap *map, uint16_t keycode, PlayerHandle player, Action action);
 bool keymap_unmap(KeyMap *map, uint16_t keycode);
-bool keymap_action(const KeyMap *map, uint16_t keycode, unsigned int *player_id, Action *action);
+bool keymap_action(const KeyMap *map, uint16_t keycode, PlayerHandle *player, Action *action);
+
+// The number of actions a player can have queued, a power of two.
+#define ACTION_QUEUE_CAPACITY 8
+
+typedef struct {
+  Action action;
+  // When the action was given, from time_ns.
+  uint64_t time;
+} TimedAction;
+
+// A bounded queue of the actions a player has given but the game has not
+// applied yet, see game_apply_inputs. It has a single producer and a single
+// consumer, which may be on different threads: the producer only writes
+// tail and the consumer only writes head, so neither needs a lock. The two
+// are kept on separate cache lines so that they do not contend.
+typedef struct {
+  TimedAction entries[ACTION_QUEUE_CAPACITY];
+  alignas(64) atomic_size_t head;
+  alignas(64) atomic_size_t tail;
+} ActionQueue;
+
+void action_queue_init(ActionQueue *queue);
+
+// Producer side.
+bool action_queue_push(ActionQueue *queue, Action action, uint64_t time);
+
+// Consumer side.
+bool action_queue_peek(ActionQueue *queue, TimedAction *action);
+void action_queue_pop(ActionQueue *queue);
+void action_queue_clear(ActionQueue *queue);
 
 #endif // !SNAKE_INPUT_H
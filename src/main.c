@@ -1,42 +1,85 @@
 #include <stddef.h>
+#include <stdio.h>
 #include <stdlib.h>
 
 #define GLFW_INCLUDE_NONE
 #include <GLFW/glfw3.h>
 #include <glad/gl.h>
 
+#include "bot.h"
+#include "capture.h"
+#include "client.h"
 #include "config.h"
 #include "error.h"
 #include "game.h"
 #include "geometry.h"
+#include "grid.h"
 #include "input.h"
 #include "map.h"
+#include "net.h"
 #include "player.h"
+#include "replay.h"
+#include "schedule.h"
+#include "trace.h"
 #include "util.h"
 #include "vec.h"
 
+// The size of the window, and of frames captured offscreen.
+#define WINDOW_WIDTH 512
+#define WINDOW_HEIGHT 512
+
 GLFWwindow *create_window(const Config *config);
 unsigned int create_shader(const char *source, GLenum type);
 unsigned int create_program(const char *vs_path, const char *fs_path);
-Map create_map(const Config *config);
 Game create_game(const Config *config);
 
 void key_callback(GLFWwindow *window, int key, int scancode, int action, int mods);
+void refresh_callback(GLFWwindow *window);
 
 typedef struct {
   GLFWwindow *window;
   unsigned int program;
   Game game;
+  // Drives the players not controlled from the keyboard in a local game.
+  BotController bots;
+  RendererType renderer;
+  // Only used by RENDERER_CELLS.
+  CellGeometry cells;
+  // The static layer of the map, only used by RENDERER_GREEDY.
   Geometry geometry;
+  // The dynamic layer of the map, only used by RENDERER_GREEDY.
+  StreamGeometry dynamic_geometry;
+  // The layout version of the map the static layer was built from.
+  unsigned int layout_version;
+  // Only used by RENDERER_TEXTURE.
+  Grid grid;
+  Recorder recorder;
+  // Whether the game is mirrored from a server rather than run locally.
+  bool online;
+  Client client;
+  Scheduler scheduler;
+  // Whether the window needs to be drawn again, because the game changed or
+  // the window was damaged.
+  bool redraw;
+  // Where the trace is written on exit, see Config.
+  const char *trace_path;
+  // Whether frames are drawn into capture rather than a visible window, see
+  // Config.capture_path.
+  bool offscreen;
+  Capture capture;
+  unsigned int capture_stride;
+  unsigned int tick_count;
 } Application;
 
 void setup(Application *app, const Config *config);
 void run(Application *app);
 void update(Application *app);
-void draw(const Application *app);
-void cleanup(Application *app);
+void sync_renderer(Application *app);
+void draw(Application *app);
+bool cleanup(Application *app);
 
 int main(int argc, const char **argv) {
+  TRACE_THREAD_NAME("main");
   Config config;
   config_init(&config);
   if (!config_from_args(&config, argc, argv)) {
@@ -46,26 +89,43 @@ int main(int argc, const char **argv) {
   Application app;
   setup(&app, &config);
   run(&app);
-  cleanup(&app);
+  if (!cleanup(&app))
+    return EXIT_FAILURE;
 
   return 0;
 }
 
+// Actions are queued rather than applied, so that several keys pressed
+// during one tick each get a turn, see game_apply_inputs.
 void key_callback(GLFWwindow *window, int key, int scancode, int action, int mods) {
-  // TODO: the player can obviously press multiple keys at once, in cases where
-  // the user is pressing at most two keys that have at most a 90 degree
-  // difference between them, we should alternate between moving the two
-  // directions.
-  Game *game = glfwGetWindowUserPointer(window);
-  unsigned int player_id;
+  Application *app = glfwGetWindowUserPointer(window);
+  PlayerHandle player;
   Action act;
-  if (action == GLFW_PRESS &&
-      keymap_action(&game->keymap, key, &player_id, &act)) {
-    PlayerData *player_data = &game->player_data[player_id];
-    player_data->current_action = act;
+  if (action != GLFW_PRESS)
+    return;
+
+  // Prints how long each phase of recent ticks and frames took.
+  if (key == GLFW_KEY_F3) {
+    trace_report(stdout);
+    return;
+  }
+
+  // Online, actions are sent to the server, which applies them.
+  if (app->online) {
+    if (keymap_action(&app->client.keymap, key, &player, &act))
+      client_send_action(&app->client, act);
+  } else if (keymap_action(&app->game.keymap, key, &player, &act)) {
+    ActionQueue *queue = players_queue(&app->game.players, player);
+    if (queue != nullptr)
+      action_queue_push(queue, act, time_ns());
   }
 }
 
+void refresh_callback(GLFWwindow *window) {
+  Application *app = glfwGetWindowUserPointer(window);
+  app->redraw = true;
+}
+
 unsigned int create_shader(const char *source, GLenum type) {
   unsigned int handle = glCreateShader(type);
   glShaderSource(handle, 1, &source, nullptr);
@@ -143,68 +203,39 @@ unsigned int create_program(const char *vs_path, const char *fs_path) {
   return program;
 }
 
-Map create_map(const Config *config) {
-  Map map;
-  // TODO: Add support for loading maps from file.
-  map_init(&map);
-  map_set_dimensions(&map, 32, 32);
-  map_fill(&map, (Cell){CELL_EMPTY});
-
-  // Set vertical walls.
-  for (int i = 0; i < map.height; ++i) {
-    const Cell cell = {CELL_WALL};
-    map_set_cell(&map, vec2i(0, i), cell);
-    map_set_cell(&map, vec2i(map.width - 1, i), cell);
-  }
-
-  // Set horizontal walls.
-  for (int i = 0; i < map.width; ++i) {
-    const Cell cell = {CELL_WALL};
-    map_set_cell(&map, vec2i(i, 0), cell);
-    map_set_cell(&map, vec2i(i, map.height - 1), cell);
-  }
-
-  return map;
+static void map_arrow_keys(KeyMap *keymap, PlayerHandle player) {
+  keymap_map(keymap, GLFW_KEY_UP, player, (Action){ACTION_MOVE_UP});
+  keymap_map(keymap, GLFW_KEY_DOWN, player, (Action){ACTION_MOVE_DOWN});
+  keymap_map(keymap, GLFW_KEY_LEFT, player, (Action){ACTION_MOVE_LEFT});
+  keymap_map(keymap, GLFW_KEY_RIGHT, player, (Action){ACTION_MOVE_RIGHT});
 }
 
 Game create_game(const Config *config) {
   Game game;
-  game_init(&game);
-  game.map = create_map(config);
-
-  // TODO: Add support for multiple players.
-  // TODO: Determine appropriate starting position for players.
-  for (int i = 0; i < config->player_count; ++i) {
-    Player player;
-    player_init(&player);
-    player.id = i;
-
-    const int x_offset = (game.map.width / (config->player_count + 1)) * (i + 1);
-    const int y_offset = game.map.height / 2;
-    const PlayerSegment first = {vec2i(x_offset, y_offset)};
-    const PlayerSegment second = {vec2i(x_offset, y_offset + 1)};
-    player_spawn(&player, first, second);
-    map_player(&game.map, &player);
-    game_add_player(&game, player);
-  }
+  game_setup(&game, config);
 
-  // TODO: Add a proper system for spawning powerups.
-  Cell power_up = {CELL_POWERUP, {.powerup = {5}}};
-  map_set_cell(&game.map, vec2i(4, 4), power_up);
-
-  Player player = game.player_data[0].player;
   KeyMap keymap;
   keymap_init(&keymap);
-  keymap_map(&keymap, GLFW_KEY_UP, player.id, (Action){ACTION_MOVE_UP});
-  keymap_map(&keymap, GLFW_KEY_DOWN, player.id, (Action){ACTION_MOVE_DOWN});
-  keymap_map(&keymap, GLFW_KEY_LEFT, player.id, (Action){ACTION_MOVE_LEFT});
-  keymap_map(&keymap, GLFW_KEY_RIGHT, player.id, (Action){ACTION_MOVE_RIGHT});
+  map_arrow_keys(&keymap, players_handle(&game.players, 0));
 
   game.keymap = keymap;
 
   return game;
 }
 
+// Mirrors a game run by a server instead, the arrow keys control whichever
+// player the server assigns.
+static Game join_game(Client *client, const Config *config) {
+  Game game;
+  game_init(&game);
+  if (!client_connect(client, config->host, config->port, &game)) {
+    exit(EXIT_FAILURE);
+  }
+
+  map_arrow_keys(&client->keymap, client->player);
+  return game;
+}
+
 void setup(Application *app, const Config *config) {
   // Setup window.
   if (!glfwInit()) {
@@ -214,9 +245,17 @@ void setup(Application *app, const Config *config) {
   glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 4);
   glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 6);
   glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+  // Offscreen, the window only provides a context, so it is never shown.
+  app->offscreen = config->capture_path != nullptr;
+  if (app->offscreen && config->host != nullptr) {
+    report_error("capturing is only supported in a local game");
+    exit(EXIT_FAILURE);
+  }
+  glfwWindowHint(GLFW_VISIBLE, app->offscreen ? GLFW_FALSE : GLFW_TRUE);
   // TODO: handle window resizing.
   GLFWwindow *window =
-      glfwCreateWindow(512, 512, "Hello Square", nullptr, nullptr);
+      glfwCreateWindow(WINDOW_WIDTH, WINDOW_HEIGHT, "Hello Square", nullptr,
+                       nullptr);
   if (!window) {
     report_error("failed to create window");
     glfwTerminate();
@@ -227,16 +266,49 @@ void setup(Application *app, const Config *config) {
   gladLoadGL(glfwGetProcAddress);
 
   glfwSetKeyCallback(window, key_callback);
+  glfwSetWindowRefreshCallback(window, refresh_callback);
 
   app->window = window;
+  app->trace_path = config->trace_path;
+  app->capture_stride = config->capture_stride;
+  app->tick_count = config->tick_count;
+  capture_init(&app->capture);
+  if (app->offscreen &&
+      !capture_open(&app->capture, config->capture_path,
+                    config->capture_format, WINDOW_WIDTH, WINDOW_HEIGHT,
+                    config->tick_rate, config->capture_stride)) {
+    exit(EXIT_FAILURE);
+  }
 
-  // Setup shaders.
-  app->program = create_program("src/shader/vertex.glsl", "src/shader/fragment.glsl");
+  // Setup shaders, the texture renderer has its own.
+  app->renderer = config->renderer;
+  if (app->renderer == RENDERER_TEXTURE) {
+    app->program = create_program("src/shader/grid_vertex.glsl",
+                                  "src/shader/grid_fragment.glsl");
+  } else {
+    app->program = create_program("src/shader/vertex.glsl",
+                                  "src/shader/fragment.glsl");
+  }
   glUseProgram(app->program);
 
-  app->game = create_game(config);
+  app->online = config->host != nullptr;
+  client_init(&app->client);
+  app->game =
+      app->online ? join_game(&app->client, config) : create_game(config);
+  bots_init(&app->bots);
+  if (!app->online &&
+      bots_spawn(&app->bots, &app->game, config->bot_count) <
+          config->bot_count) {
+    report_error("map has no room for %u bots", config->bot_count);
+    exit(EXIT_FAILURE);
+  }
+  recorder_init(&app->recorder);
+  if (config->record_path &&
+      !recorder_open(&app->recorder, config->record_path, config)) {
+    exit(EXIT_FAILURE);
+  }
 
-  glfwSetWindowUserPointer(app->window, &app->game);
+  glfwSetWindowUserPointer(app->window, app);
 
   // Here we construct a matrix to fit the map into the viewport.
   float scale = 2.0 / max(app->game.map.width, app->game.map.height);
@@ -252,51 +324,188 @@ void setup(Application *app, const Config *config) {
   unsigned int matrix_location = glGetUniformLocation(app->program, "matrix");
   glUniformMatrix4fv(matrix_location, 1, GL_TRUE, &matrix[0][0]);
 
-  Geometry geometry;
-  geometry_init(&geometry);
-  geometry_from_map(&geometry, &app->game.map);
+  cell_geometry_init(&app->cells);
+  geometry_init(&app->geometry);
+  stream_geometry_init(&app->dynamic_geometry);
+  grid_init(&app->grid);
+  switch (app->renderer) {
+  case RENDERER_CELLS:
+    cell_geometry_update(&app->cells, &app->game.map);
+    break;
+  case RENDERER_GREEDY:
+    geometry_static_from_map(&app->geometry, &app->game.map);
+    stream_geometry_dynamic_from_map(&app->dynamic_geometry, &app->game.map);
+    break;
+  case RENDERER_TEXTURE:
+    grid_from_map(&app->grid, &app->game.map);
+    break;
+  }
+  app->layout_version = app->game.map.layout_version;
+  map_mark_clean(&app->game.map);
 
-  app->geometry = geometry;
+  scheduler_init(&app->scheduler, config->tick_rate, config->frame_rate,
+                 glfwGetTime());
+  app->redraw = true;
 }
 
-void run(Application *app) {
-  double update_limit = 1.0 / 8;
-  double last_update_time = 0.0;
-  while (!glfwWindowShouldClose(app->window)) {
-    double current_time = glfwGetTime();
+// Draws the window if it needs it and the frame cap allows it. The renderer
+// is only synced here, so ticks that are never drawn cost nothing to render.
+static void present(Application *app) {
+  const double now = glfwGetTime();
+  if (!app->redraw || !scheduler_frame_due(&app->scheduler, now))
+    return;
+
+  sync_renderer(app);
+  draw(app);
+  scheduler_frame_drawn(&app->scheduler, now);
+  app->redraw = false;
+}
 
+static void wait_events(double timeout) {
+  if (timeout > 0.0) {
+    glfwWaitEventsTimeout(timeout);
+  } else {
     glfwPollEvents();
-    if (current_time - last_update_time >= update_limit) {
-      update(app);
+  }
+}
+
+// Online, the server decides when the game updates, so the window is only
+// redrawn when a new state arrives. GLFW cannot wait on the socket, so the
+// loop sleeps in short steps between polls.
+static void run_online(Application *app) {
+  while (!glfwWindowShouldClose(app->window)) {
+    bool updated;
+    if (client_poll(&app->client, &app->game, &updated) == NET_CLOSED) {
+      report_error("lost connection to the server");
+      return;
+    }
+
+    app->redraw |= updated;
+    present(app);
+    wait_events(0.001);
+  }
+}
+
+// Offscreen, nobody is watching, so ticks run back to back rather than at
+// the tick rate. A frame is drawn before the first tick and after every
+// capture stride ticks.
+static void run_offscreen(Application *app) {
+  for (unsigned int tick = 0;; ++tick) {
+    if (tick % app->capture_stride == 0) {
+      sync_renderer(app);
       draw(app);
+    }
+    if (tick == app->tick_count)
+      break;
+    update(app);
+  }
+}
 
-      last_update_time = current_time;
+// Sleeps until the next tick is due, or the next frame if one is waiting on
+// the frame cap, input wakes the loop early.
+void run(Application *app) {
+  if (app->online) {
+    run_online(app);
+    return;
+  }
+  if (app->offscreen) {
+    run_offscreen(app);
+    return;
+  }
+
+  Scheduler *scheduler = &app->scheduler;
+  while (!glfwWindowShouldClose(app->window)) {
+    const unsigned int ticks = scheduler_advance(scheduler, glfwGetTime());
+    for (unsigned int i = 0; i < ticks; ++i) {
+      update(app);
     }
+    app->redraw |= ticks > 0;
+
+    present(app);
+    wait_events(scheduler_timeout(scheduler, glfwGetTime(), app->redraw));
   }
 }
 
 void update(Application *app) {
+  TRACE_SCOPE("update");
+  game_apply_inputs(&app->game, time_ns());
+  bots_update(&app->bots, &app->game);
+  recorder_record(&app->recorder, &app->game);
   game_update(&app->game);
-  for (int i = 0; i < app->game.player_count; ++i) {
-    map_player(&app->game.map, &app->game.player_data[i].player);
+}
+
+// Brings the renderer up to date with the map.
+void sync_renderer(Application *app) {
+  TRACE_SCOPE("sync_renderer");
+  Map *map = &app->game.map;
+  switch (app->renderer) {
+  case RENDERER_CELLS:
+    cell_geometry_update(&app->cells, map);
+    break;
+  case RENDERER_GREEDY:
+    if (app->layout_version != map->layout_version) {
+      geometry_static_from_map(&app->geometry, map);
+      app->layout_version = map->layout_version;
+    }
+    if (map->dirty_row_count > 0)
+      stream_geometry_dynamic_from_map(&app->dynamic_geometry, map);
+    break;
+  case RENDERER_TEXTURE:
+    grid_update(&app->grid, map);
+    break;
   }
-  geometry_from_map(&app->geometry, &app->game.map);
+  map_mark_clean(map);
+}
+
+static void draw_geometry(const Geometry *geometry) {
+  glBindVertexArray(geometry->handle);
+  TRACE_SCOPE("draw_elements");
+  glDrawElements(GL_TRIANGLES, geometry->indices.datum_count, GL_UNSIGNED_INT, nullptr);
+  glBindVertexArray(GL_NONE);
 }
 
-void draw(const Application *app) {
-  glBindVertexArray(app->geometry.handle);
+void draw(Application *app) {
+  TRACE_SCOPE("draw");
+  if (app->offscreen)
+    capture_bind(&app->capture);
   glClear(GL_COLOR_BUFFER_BIT);
   glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
-  glDrawElements(GL_TRIANGLES, app->geometry.indices.datum_count, GL_UNSIGNED_INT, nullptr);
-  glBindVertexArray(GL_NONE);
+  switch (app->renderer) {
+  case RENDERER_CELLS:
+    cell_geometry_draw(&app->cells);
+    break;
+  case RENDERER_GREEDY:
+    draw_geometry(&app->geometry);
+    // Dynamic cells are drawn over the static layer.
+    stream_geometry_draw(&app->dynamic_geometry);
+    break;
+  case RENDERER_TEXTURE:
+    grid_draw(&app->grid);
+    break;
+  }
 
-  glfwSwapBuffers(app->window);
+  if (app->offscreen) {
+    capture_frame(&app->capture);
+  } else {
+    TRACE_SCOPE("swap_buffers");
+    glfwSwapBuffers(app->window);
+  }
 }
 
-
-void cleanup(Application *app) {
+// Returns false if any captured frame failed to be written.
+bool cleanup(Application *app) {
+  if (app->trace_path != nullptr)
+    trace_write_json(app->trace_path);
+  const bool captured = capture_close(&app->capture);
+  cell_geometry_free(&app->cells);
   geometry_free(&app->geometry);
+  stream_geometry_free(&app->dynamic_geometry);
+  grid_free(&app->grid);
+  recorder_close(&app->recorder, &app->game);
+  client_free(&app->client);
+  bots_free(&app->bots);
   game_free(&app->game);
   glDeleteProgram(app->program);
   glfwTerminate();
+  return captured;
 }
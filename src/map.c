@@ -1,79 +1,677 @@
+#define _POSIX_C_SOURCE 200809L
+
 #include <assert.h>
 #include <stddef.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
 
 #include "error.h"
 #include "map.h"
+#include "trace.h"
+#include "util.h"
 #include "vec.h"
 
 // Position must be a wrapped vector.
-static inline size_t pos_to_index(const Map *map, Vec2I pos) {
+static inline size_t chunk_index(const Map *map, Vec2I pos) {
   assert(pos.x < map->width);
   assert(pos.y < map->height);
-  return pos.x + pos.y * map->width;
+  return (pos.x >> MAP_CHUNK_BITS) +
+         (pos.y >> MAP_CHUNK_BITS) * map->chunk_columns;
+}
+
+// The index of a cell within its chunk.
+static inline size_t cell_index(Vec2I pos) {
+  return (pos.x & MAP_CHUNK_MASK) + (pos.y & MAP_CHUNK_MASK) * MAP_CHUNK_SIZE;
+}
+
+static size_t chunk_count(const Map *map) {
+  return (size_t)map->chunk_columns * map->chunk_rows;
+}
+
+// Whether a chunk lives in the map's file mapping rather than the heap.
+static bool is_mapped(const Map *map, const PackedCell *chunk) {
+  const char *begin = map->mapping;
+  const char *end = begin + map->mapping_size;
+  return map->mapping && (const char *)chunk >= begin && (const char *)chunk < end;
+}
+
+static void free_chunks(Map *map) {
+  for (size_t i = 0; i < chunk_count(map); ++i) {
+    if (!is_mapped(map, map->chunks[i]))
+      free(map->chunks[i]);
+    map->chunks[i] = nullptr;
+    if (map->empty.chunks != nullptr) {
+      free(map->empty.chunks[i]);
+      map->empty.chunks[i] = nullptr;
+    }
+  }
+
+  // Nothing refers to the mapping anymore.
+  if (map->mapping) {
+    munmap(map->mapping, map->mapping_size);
+    map->mapping = nullptr;
+    map->mapping_size = 0;
+  }
+}
+
+static inline bool is_empty(PackedCell cell) {
+  return (cell & CELL_TYPE_MASK) == CELL_EMPTY;
+}
+
+// The origin and dimensions of a chunk, chunks on the right and top edges
+// of the map may be smaller than a full chunk.
+static MapChunk chunk_bounds(const Map *map, size_t index) {
+  const unsigned int x = (index % map->chunk_columns) << MAP_CHUNK_BITS;
+  const unsigned int y = (index / map->chunk_columns) << MAP_CHUNK_BITS;
+  return (MapChunk){
+      vec2i(x, y),
+      min(MAP_CHUNK_SIZE, map->width - x),
+      min(MAP_CHUNK_SIZE, map->height - y),
+      map->chunks[index],
+  };
+}
+
+// The number of empty cells in a chunk, which is either all or none of them
+// if the chunk is unallocated.
+static size_t chunk_empty_count(const Map *map, size_t index) {
+  const ChunkEmpty *empty = map->empty.chunks[index];
+  if (empty != nullptr)
+    return empty->count;
+  if (!is_empty(map->fill))
+    return 0;
+  const MapChunk chunk = chunk_bounds(map, index);
+  return (size_t)chunk.width * chunk.height;
+}
+
+static size_t group_count(const Map *map) {
+  return (chunk_count(map) + MAP_EMPTY_GROUP_CHUNKS - 1) /
+         MAP_EMPTY_GROUP_CHUNKS;
+}
+
+static void add_empty(Map *map, size_t index, uint16_t cell) {
+  ChunkEmpty *empty = map->empty.chunks[index];
+  empty->slots[cell] = empty->count;
+  empty->cells[empty->count++] = cell;
+  ++map->empty.count;
+  ++map->empty.groups[index / MAP_EMPTY_GROUP_CHUNKS];
+}
+
+static void remove_empty(Map *map, size_t index, uint16_t cell) {
+  ChunkEmpty *empty = map->empty.chunks[index];
+  const uint16_t slot = empty->slots[cell];
+  const uint16_t last = empty->cells[--empty->count];
+  empty->cells[slot] = last;
+  empty->slots[last] = slot;
+  empty->slots[cell] = MAP_EMPTY_NONE;
+  --map->empty.count;
+  --map->empty.groups[index / MAP_EMPTY_GROUP_CHUNKS];
+}
+
+// Keeps the empty index up to date with a cell that changed from before to
+// after, does nothing if the map is not indexed. The cell's chunk must be
+// allocated.
+static inline void update_empty(Map *map, Vec2I pos, PackedCell before,
+                                PackedCell after) {
+  if (map->empty.chunks == nullptr || is_empty(before) == is_empty(after))
+    return;
+
+  const size_t index = chunk_index(map, pos);
+  assert(map->empty.chunks[index] != nullptr);
+  if (is_empty(after)) {
+    add_empty(map, index, cell_index(pos));
+  } else {
+    remove_empty(map, index, cell_index(pos));
+  }
+}
+
+static inline bool is_blocked(PackedCell cell) {
+  const CellType type = cell & CELL_TYPE_MASK;
+  return type == CELL_WALL || type == CELL_PLAYER;
+}
+
+// Keeps the blocked index up to date with a cell that changed from before to
+// after, does nothing if the map is not indexed.
+static inline void update_blocked(Map *map, Vec2I pos, PackedCell before,
+                                  PackedCell after) {
+  if (map->blocked.words == nullptr || is_blocked(before) == is_blocked(after))
+    return;
+
+  bitboard_set(&map->blocked, pos, is_blocked(after));
+}
+
+static inline bool is_indexed(const Map *map) {
+  return map->empty.chunks != nullptr || map->blocked.words != nullptr;
+}
+
+// The same as update_empty and update_blocked for every cell of an allocated
+// chunk that is changing to cells, the chunk's current cells being before.
+static void update_chunk_indices(Map *map, size_t index,
+                                 const PackedCell *before, const void *cells) {
+  if (!is_indexed(map))
+    return;
+
+  const unsigned int x = (index % map->chunk_columns) << MAP_CHUNK_BITS;
+  const unsigned int y = (index / map->chunk_columns) << MAP_CHUNK_BITS;
+  const unsigned int width = min(MAP_CHUNK_SIZE, map->width - x);
+  const unsigned int height = min(MAP_CHUNK_SIZE, map->height - y);
+  const uint8_t *after = cells;
+  for (unsigned int j = 0; j < height; ++j) {
+    for (unsigned int i = 0; i < width; ++i) {
+      const size_t offset = i + j * MAP_CHUNK_SIZE;
+      PackedCell cell;
+      memcpy(&cell, &after[offset * sizeof(PackedCell)], sizeof(PackedCell));
+      const Vec2I pos = vec2i(x + i, y + j);
+      update_empty(map, pos, before[offset], cell);
+      update_blocked(map, pos, before[offset], cell);
+    }
+  }
+}
+
+// Indexes the empty cells of an allocated chunk in row major order, without
+// touching the counts of the index, which the caller keeps up to date.
+static void build_chunk_empty(Map *map, size_t index) {
+  ChunkEmpty **empty = &map->empty.chunks[index];
+  if (*empty == nullptr) {
+    *empty = malloc(sizeof(ChunkEmpty));
+    if (*empty == nullptr) {
+      report_error("failed to allocate empty cell index");
+      exit(EXIT_FAILURE);
+    }
+  }
+
+  const MapChunk chunk = chunk_bounds(map, index);
+  (*empty)->count = 0;
+  for (uint16_t i = 0; i < MAP_CHUNK_CELLS; ++i) {
+    const unsigned int x = i & MAP_CHUNK_MASK;
+    const unsigned int y = i >> MAP_CHUNK_BITS;
+    (*empty)->slots[i] = MAP_EMPTY_NONE;
+    if (x < chunk.width && y < chunk.height && is_empty(chunk.cells[i])) {
+      (*empty)->slots[i] = (*empty)->count;
+      (*empty)->cells[(*empty)->count++] = i;
+    }
+  }
+}
+
+// Rebuilds the empty index, with the cells of each chunk in row major order.
+// Only touches allocated chunks, and one count per chunk.
+static void build_empty_index(Map *map) {
+  EmptyIndex *index = &map->empty;
+  index->count = 0;
+  memset(index->groups, 0, group_count(map) * sizeof(uint32_t));
+  for (size_t i = 0; i < chunk_count(map); ++i) {
+    if (map->chunks[i] != nullptr)
+      build_chunk_empty(map, i);
+    const size_t count = chunk_empty_count(map, i);
+    index->groups[i / MAP_EMPTY_GROUP_CHUNKS] += count;
+    index->count += count;
+  }
+}
+
+static void build_blocked_index(Map *map) {
+  bitboard_resize(&map->blocked, map->width, map->height);
+  for (unsigned int y = 0; y < map->height; ++y) {
+    for (unsigned int x = 0; x < map->width; ++x) {
+      const Vec2I pos = vec2i(x, y);
+      const PackedCell *chunk = map->chunks[chunk_index(map, pos)];
+      const PackedCell cell = chunk ? chunk[cell_index(pos)] : map->fill;
+      if (is_blocked(cell))
+        bitboard_set(&map->blocked, pos, true);
+    }
+  }
+}
+
+// Sizes the index for the chunks of the map. Any chunk indices must have
+// been freed already, see free_chunks.
+static void allocate_empty_index(Map *map) {
+  const size_t cell_count = (size_t)map->width * map->height;
+  if (cell_count >= UINT32_MAX) {
+    report_error("map is too large to index its empty cells");
+    exit(EXIT_FAILURE);
+  }
+
+  EmptyIndex *index = &map->empty;
+  free(index->chunks);
+  ChunkEmpty **chunks = calloc(chunk_count(map), sizeof(ChunkEmpty *));
+  uint32_t *groups =
+      realloc(index->groups, group_count(map) * sizeof(uint32_t));
+  if (chunk_count(map) > 0 && (chunks == nullptr || groups == nullptr)) {
+    report_error("failed to allocate empty cell index");
+    exit(EXIT_FAILURE);
+  }
+  index->chunks = chunks;
+  index->groups = groups;
+}
+
+// Allocates a chunk with every cell set to the fill cell.
+static PackedCell *allocate_chunk(const Map *map) {
+  PackedCell *chunk = malloc(MAP_CHUNK_CELLS * sizeof(PackedCell));
+  if (chunk == nullptr) {
+    report_error("failed to allocate map chunk");
+    exit(EXIT_FAILURE);
+  }
+
+  for (size_t i = 0; i < MAP_CHUNK_CELLS; ++i) {
+    chunk[i] = map->fill;
+  }
+
+  return chunk;
+}
+
+// Allocates the chunk with the given index, every cell set to the fill cell,
+// and indexes it if the map is indexed.
+static void add_chunk(Map *map, size_t index) {
+  map->chunks[index] = allocate_chunk(map);
+  if (map->empty.chunks != nullptr)
+    build_chunk_empty(map, index);
 }
 
 void map_init(Map *map) {
   map->width = 0;
   map->height = 0;
-  map->cells = nullptr;
+  map->chunk_columns = 0;
+  map->chunk_rows = 0;
+  map->chunks = nullptr;
+  map->fill = map_pack_cell((Cell){CELL_EMPTY});
+  map->mapping = nullptr;
+  map->mapping_size = 0;
+  map->dirty_spans = nullptr;
+  map->dirty_rows = nullptr;
+  map->dirty_row_count = 0;
+  map->layout_version = 0;
+  map->empty = (EmptyIndex){nullptr, nullptr, 0};
+  bitboard_init(&map->blocked);
 }
 
 void map_free(Map *map) {
-  free(map->cells);
+  if (map->chunks)
+    free_chunks(map);
+  free(map->chunks);
+  free(map->dirty_spans);
+  free(map->dirty_rows);
+  free(map->empty.chunks);
+  free(map->empty.groups);
+  bitboard_free(&map->blocked);
   map_init(map);
 }
 
+// Any existing contents are discarded, and the map is left filled with empty
+// cells.
 void map_set_dimensions(Map *map, size_t width, size_t height) {
+  if (map->chunks)
+    free_chunks(map);
+
   map->width = width;
   map->height = height;
-  Cell *cells = realloc(map->cells, width * height * sizeof(Cell));
-  if (cells == nullptr) {
+  map->chunk_columns = (width + MAP_CHUNK_MASK) >> MAP_CHUNK_BITS;
+  map->chunk_rows = (height + MAP_CHUNK_MASK) >> MAP_CHUNK_BITS;
+  map->fill = map_pack_cell((Cell){CELL_EMPTY});
+
+  // calloc leaves the chunk table to be zeroed lazily by the operating
+  // system, so even huge maps are created without touching their memory.
+  free(map->chunks);
+  PackedCell **chunks = calloc(chunk_count(map), sizeof(PackedCell *));
+  DirtySpan *dirty_spans = realloc(map->dirty_spans, height * sizeof(DirtySpan));
+  unsigned int *dirty_rows = realloc(map->dirty_rows, height * sizeof(unsigned int));
+  if (chunks == nullptr || dirty_spans == nullptr || dirty_rows == nullptr) {
     report_error("failed to resize map allocation");
     exit(EXIT_FAILURE);
   }
-  map->cells = cells;
+  map->chunks = chunks;
+  map->dirty_spans = dirty_spans;
+  map->dirty_rows = dirty_rows;
+  ++map->layout_version;
+
+  map_mark_all_dirty(map);
+  if (map->empty.chunks != nullptr) {
+    allocate_empty_index(map);
+    build_empty_index(map);
+  }
+  if (map->blocked.words != nullptr)
+    build_blocked_index(map);
 }
 
+// Only frees the chunks that were allocated, so filling an unused map is
+// cheap no matter its size.
 void map_fill(Map *map, Cell cell) {
-  for (int i = 0; i < map->width * map->height; ++i) {
-    map->cells[i] = cell;
+  free_chunks(map);
+  map->fill = map_pack_cell(cell);
+  ++map->layout_version;
+  map_mark_all_dirty(map);
+  if (map->empty.chunks != nullptr)
+    build_empty_index(map);
+  if (map->blocked.words != nullptr)
+    build_blocked_index(map);
+}
+
+// The cell every unallocated chunk is filled with.
+Cell map_fill_cell(const Map *map) {
+  return map_unpack_cell(map->fill);
+}
+
+// Advances index to the next allocated chunk at or after it and returns
+// true, or returns false if there are none left. Start from an index of 0 and
+// increment it after each chunk to visit every allocated chunk, cells outside
+// of those are all equal to the fill cell.
+bool map_next_chunk(const Map *map, size_t *index, MapChunk *chunk) {
+  for (; *index < chunk_count(map); ++*index) {
+    const PackedCell *cells = map->chunks[*index];
+    if (cells == nullptr)
+      continue;
+
+    unsigned int x = (*index % map->chunk_columns) << MAP_CHUNK_BITS;
+    unsigned int y = (*index / map->chunk_columns) << MAP_CHUNK_BITS;
+    chunk->origin = vec2i(x, y);
+    chunk->width = min(MAP_CHUNK_SIZE, map->width - x);
+    chunk->height = min(MAP_CHUNK_SIZE, map->height - y);
+    chunk->cells = cells;
+    return true;
+  }
+
+  return false;
+}
+
+size_t map_allocated_chunk_count(const Map *map) {
+  size_t count = 0;
+  for (size_t i = 0; i < chunk_count(map); ++i) {
+    count += map->chunks[i] != nullptr;
+  }
+  return count;
+}
+
+static void mark_chunk_dirty(Map *map, size_t index) {
+  const unsigned int x = (index % map->chunk_columns) << MAP_CHUNK_BITS;
+  const unsigned int y = (index / map->chunk_columns) << MAP_CHUNK_BITS;
+  const unsigned int width = min(MAP_CHUNK_SIZE, map->width - x);
+  const unsigned int height = min(MAP_CHUNK_SIZE, map->height - y);
+  for (unsigned int i = 0; i < height; ++i) {
+    map_mark_dirty(map, vec2i(x, y + i));
+    map_mark_dirty(map, vec2i(x + width - 1, y + i));
+  }
+}
+
+// Overwrites every cell of the chunk with the given index, as returned by
+// map_next_chunk, allocating it if needed. Cells are copied as is from
+// MAP_CHUNK_CELLS packed cells, which need not be aligned, so they must have
+// been packed by a build with the same cell layout. Nothing is marked dirty
+// if the chunk already holds the same cells.
+void map_set_chunk(Map *map, size_t index, const void *cells) {
+  assert(index < chunk_count(map));
+  const size_t size = MAP_CHUNK_CELLS * sizeof(PackedCell);
+  PackedCell **chunk = &map->chunks[index];
+  if (*chunk == nullptr)
+    add_chunk(map, index);
+  else if (memcmp(*chunk, cells, size) == 0)
+    return;
+  update_chunk_indices(map, index, *chunk, cells);
+
+  memcpy(*chunk, cells, size);
+  mark_chunk_dirty(map, index);
+  ++map->layout_version;
+}
+
+// Sets every cell of an allocated chunk to the fill cell, keeping the
+// allocation around so that it can be reused.
+void map_clear_chunk(Map *map, size_t index) {
+  assert(index < chunk_count(map));
+  PackedCell *chunk = map->chunks[index];
+  if (chunk == nullptr)
+    return;
+
+  if (is_indexed(map)) {
+    PackedCell fill[MAP_CHUNK_CELLS];
+    for (size_t i = 0; i < MAP_CHUNK_CELLS; ++i) {
+      fill[i] = map->fill;
+    }
+    update_chunk_indices(map, index, chunk, fill);
   }
+
+  bool changed = false;
+  for (size_t i = 0; i < MAP_CHUNK_CELLS; ++i) {
+    changed |= chunk[i] != map->fill;
+    chunk[i] = map->fill;
+  }
+
+  if (changed) {
+    mark_chunk_dirty(map, index);
+    ++map->layout_version;
+  }
+}
+
+// Changes the fill cell without touching allocated chunks, so that unlike
+// map_fill only the cells of unallocated chunks change.
+void map_set_fill(Map *map, PackedCell fill) {
+  if (fill == map->fill)
+    return;
+
+  const bool emptiness_changed = is_empty(fill) != is_empty(map->fill);
+  const bool blocking_changed = is_blocked(fill) != is_blocked(map->fill);
+  map->fill = fill;
+  ++map->layout_version;
+  map_mark_all_dirty(map);
+  if (emptiness_changed && map->empty.chunks != nullptr)
+    build_empty_index(map);
+  if (blocking_changed && map->blocked.words != nullptr)
+    build_blocked_index(map);
 }
 
 Cell map_get_cell(const Map *map, Vec2I pos) {
-  size_t index = pos_to_index(map, pos);
-  return map->cells[index];
+  const PackedCell *chunk = map->chunks[chunk_index(map, pos)];
+  return map_unpack_cell(chunk ? chunk[cell_index(pos)] : map->fill);
 }
 
 Cell map_set_cell(Map *map, Vec2I pos, Cell cell) {
-  size_t index = pos_to_index(map, pos);
-  Cell prev = map->cells[index];
-  map->cells[index] = cell;
+  PackedCell packed = map_pack_cell(cell);
+  const size_t index = chunk_index(map, pos);
+  PackedCell **chunk = &map->chunks[index];
+  if (*chunk == nullptr) {
+    // Writing the fill cell to an unallocated chunk changes nothing.
+    if (packed == map->fill)
+      return cell;
+    add_chunk(map, index);
+  }
+
+  PackedCell *slot = &(*chunk)[cell_index(pos)];
+  PackedCell packed_prev = *slot;
+  *slot = packed;
+  if (packed != packed_prev) {
+    map_mark_dirty(map, pos);
+    update_empty(map, pos, packed_prev, packed);
+    update_blocked(map, pos, packed_prev, packed);
+  }
+
+  Cell prev = map_unpack_cell(packed_prev);
+  if ((prev.type == CELL_WALL) != (cell.type == CELL_WALL))
+    ++map->layout_version;
   return prev;
 }
 
-// Write player cells.
-void map_player(Map *map, Player *player) {
-  for (int i = 0; i < player->count; ++i) {
-    PlayerSegment *segment = player_index(player, i);
-    Cell cell = (Cell){CELL_PLAYER, {.player = {1}}};
-    map_set_cell(map, segment->position, cell);
+// Static cells only change when the layout of the map changes, everything
+// else changes as the game is played.
+bool map_cell_is_static(CellType type) {
+  return type == CELL_EMPTY || type == CELL_WALL;
+}
+
+// Compares the type of two cells, and their payload if they have one.
+bool map_cell_eq(Cell a, Cell b) {
+  return map_pack_cell(a) == map_pack_cell(b);
+}
+
+// Cells without a payload always pack to just their type, so packed cells
+// can be compared directly.
+PackedCell map_pack_cell(Cell cell) {
+  PackedCell payload;
+  switch (cell.type) {
+  case CELL_PLAYER:
+    assert(cell.player.id < CELL_PLAYER_ID_COUNT);
+    payload = cell.player.id;
+    break;
+  case CELL_POWERUP:
+    payload = cell.powerup.power;
+    break;
+  default:
+    payload = 0;
+    break;
+  }
+
+  return (PackedCell)(payload << CELL_TYPE_BITS) | cell.type;
+}
+
+Cell map_unpack_cell(PackedCell packed) {
+  Cell cell = {packed & CELL_TYPE_MASK};
+  PackedCell payload = packed >> CELL_TYPE_BITS;
+  switch (cell.type) {
+  case CELL_PLAYER:
+    cell.player.id = payload;
+    break;
+  case CELL_POWERUP:
+    cell.powerup.power = payload;
+    break;
+  default:
+    break;
   }
+
+  return cell;
+}
+
+// Position must be a wrapped vector.
+void map_mark_dirty(Map *map, Vec2I pos) {
+  assert(pos.x < map->width);
+  assert(pos.y < map->height);
+  DirtySpan *span = &map->dirty_spans[pos.y];
+  if (span->begin == span->end) {
+    span->begin = pos.x;
+    span->end = pos.x + 1;
+    map->dirty_rows[map->dirty_row_count++] = pos.y;
+  } else {
+    span->begin = min(span->begin, pos.x);
+    span->end = max(span->end, pos.x + 1);
+  }
+}
+
+void map_mark_all_dirty(Map *map) {
+  for (unsigned int y = 0; y < map->height; ++y) {
+    map->dirty_spans[y] = (DirtySpan){0, map->width};
+    map->dirty_rows[y] = y;
+  }
+  map->dirty_row_count = map->height;
+}
+
+// Should be called once whatever mirrors the map has caught up with it.
+void map_mark_clean(Map *map) {
+  for (size_t i = 0; i < map->dirty_row_count; ++i) {
+    map->dirty_spans[map->dirty_rows[i]] = (DirtySpan){0, 0};
+  }
+  map->dirty_row_count = 0;
+}
+
+// Writes every segment of the player, owned by the player. Only needed when
+// a player is added, game_update keeps the map in step as players move.
+void map_player(Map *map, const Player *player) {
+  TRACE_SCOPE("map_player");
+  const Cell cell = {CELL_PLAYER, {.player = {player->id}}};
+  PlayerCursor cursor = player_cursor(player);
+  Vec2I pos;
+  while (player_cursor_next(&cursor, &pos)) {
+    map_set_cell(map, pos, cell);
+  }
+}
+
+// Starts maintaining the index of empty cells, see EmptyIndex, rebuilding it
+// if it already was. The cells of each chunk are indexed in row major order.
+void map_index_empty(Map *map) {
+  if (map->empty.chunks == nullptr)
+    allocate_empty_index(map);
+  build_empty_index(map);
+}
+
+// Starts maintaining the index of blocked cells, see Map.blocked.
+void map_index_blocked(Map *map) {
+  build_blocked_index(map);
+}
+
+// Replaces the order of the empty cells of an indexed chunk with that of
+// count cell indices within the chunk, which need not be aligned. Returns
+// false if the chunk is not indexed, or they are not exactly its empty
+// cells, in which case its cells are left in row major order.
+bool map_restore_empty_chunk(Map *map, size_t index, const void *cells,
+                             size_t count) {
+  if (map->empty.chunks == nullptr || index >= chunk_count(map) ||
+      map->empty.chunks[index] == nullptr)
+    return false;
+
+  ChunkEmpty *empty = map->empty.chunks[index];
+  if (count != empty->count)
+    return false;
+
+  // Every cell must be in the index exactly once, each one is unlinked as it
+  // is seen so that duplicates are caught.
+  const uint8_t *bytes = cells;
+  for (size_t i = 0; i < count; ++i) {
+    uint16_t cell;
+    memcpy(&cell, &bytes[i * sizeof(uint16_t)], sizeof(uint16_t));
+    if (cell >= MAP_CHUNK_CELLS || empty->slots[cell] == MAP_EMPTY_NONE) {
+      build_chunk_empty(map, index);
+      return false;
+    }
+    empty->slots[cell] = MAP_EMPTY_NONE;
+  }
+
+  memcpy(empty->cells, cells, count * sizeof(uint16_t));
+  for (size_t i = 0; i < count; ++i) {
+    empty->slots[empty->cells[i]] = i;
+  }
+  return true;
+}
+
+size_t map_empty_count(const Map *map) {
+  return map->empty.count;
+}
+
+// The position of one of the empty cells, index must be less than
+// map_empty_count. Cells are ordered chunk by chunk, the group holding the
+// cell is found first, then the chunk within the group.
+Vec2I map_empty_cell(const Map *map, size_t index) {
+  assert(index < map->empty.count);
+  size_t chunk = 0;
+  for (; index >= map->empty.groups[chunk / MAP_EMPTY_GROUP_CHUNKS];
+       chunk += MAP_EMPTY_GROUP_CHUNKS) {
+    index -= map->empty.groups[chunk / MAP_EMPTY_GROUP_CHUNKS];
+  }
+  for (size_t count; index >= (count = chunk_empty_count(map, chunk));
+       ++chunk) {
+    index -= count;
+  }
+
+  const MapChunk bounds = chunk_bounds(map, chunk);
+  const ChunkEmpty *empty = map->empty.chunks[chunk];
+  if (empty == nullptr) {
+    // Every cell of an unallocated chunk is empty, in row major order.
+    return vec2i_add(bounds.origin,
+                     vec2i(index % bounds.width, index / bounds.width));
+  }
+
+  const uint16_t cell = empty->cells[index];
+  return vec2i_add(bounds.origin,
+                   vec2i(cell & MAP_CHUNK_MASK, cell >> MAP_CHUNK_BITS));
 }
 
 // If a map is open at the edges, when a player exits the map on one side they
-// reappear on the other side.
+// reappear on the other side. The remainder is taken in signed arithmetic,
+// with unsigned dimensions a negative position would be converted first and
+// only wrap correctly on sides that are a power of two.
 Vec2I map_wrap_pos(const Map *map, Vec2I pos) {
-  int x = pos.x % map->width;
+  const int w = (int)map->width;
+  int x = pos.x % w;
   if (x < 0)
-    x = map->width + x;
+    x += w;
 
-  int y = pos.y % map->height;
+  const int h = (int)map->height;
+  int y = pos.y % h;
   if (y < 0)
-    y = map->height + y;
+    y += h;
 
   return vec2i(x, y);
 }
@@ -4,6 +4,7 @@
 #include <stddef.h>
 #include <stdint.h>
 
+#include "bitboard.h"
 #include "player.h"
 #include "vec.h"
 
@@ -14,9 +15,28 @@ typedef enum {
   CELL_POWERUP,
 } CellType;
 
+typedef uint16_t PlayerId;
+
+// Cells are stored packed, with the type in the low CELL_TYPE_BITS bits and
+// the payload in the bits above it. By default a cell takes 2 bytes, which
+// leaves room for 14 bit player ids. Building with SNAKE_WIDE_PLAYER_IDS
+// widens cells to 4 bytes, so that every 16 bit player id fits.
+#ifdef SNAKE_WIDE_PLAYER_IDS
+typedef uint32_t PackedCell;
+#define CELL_PLAYER_ID_BITS 16
+#else
+typedef uint16_t PackedCell;
+#define CELL_PLAYER_ID_BITS 14
+#endif
+
+#define CELL_TYPE_BITS 2
+#define CELL_TYPE_MASK ((1u << CELL_TYPE_BITS) - 1)
+// The number of distinct player ids a cell can store.
+#define CELL_PLAYER_ID_COUNT ((size_t)1 << CELL_PLAYER_ID_BITS)
+
 typedef struct {
   // The id of the player that is occupying the cell.
-  uint8_t id;
+  PlayerId id;
 } PlayerCell;
 
 typedef struct {
@@ -24,6 +44,8 @@ typedef struct {
   uint8_t power;
 } PowerUpCell;
 
+// The unpacked form of a cell, this is what the map is read and written
+// through.
 typedef struct {
   CellType type;
   // This should only ever be read from if type is equal to either CELL_PLAYER
@@ -34,10 +56,103 @@ typedef struct {
   };
 } Cell;
 
+// The columns [begin, end) of a row that have changed, the span is empty
+// when begin is equal to end.
+typedef struct {
+  unsigned int begin;
+  unsigned int end;
+} DirtySpan;
+
+// The map is stored in square chunks of MAP_CHUNK_SIZE cells a side, which
+// are only allocated once a cell in them is set to something other than the
+// fill cell of the map. Memory therefore scales with the part of the map that
+// is actually used rather than its dimensions.
+#define MAP_CHUNK_BITS 6
+#define MAP_CHUNK_SIZE (1u << MAP_CHUNK_BITS)
+#define MAP_CHUNK_MASK (MAP_CHUNK_SIZE - 1)
+#define MAP_CHUNK_CELLS (MAP_CHUNK_SIZE * MAP_CHUNK_SIZE)
+
+// A view of the cells of an allocated chunk. Cells are stored row major with
+// a stride of MAP_CHUNK_SIZE, chunks on the right and top edges of the map
+// may be smaller than a full chunk.
 typedef struct {
+  // The position of the bottom left cell of the chunk.
+  Vec2I origin;
   unsigned int width;
   unsigned int height;
-  Cell *cells;
+  const PackedCell *cells;
+} MapChunk;
+
+#define MAP_EMPTY_NONE UINT16_MAX
+
+// The empty cells of an allocated chunk, referred to by their index within
+// the chunk. Removing a cell moves the last one into its place, so the order
+// of cells depends on the order the chunk was changed in.
+typedef struct {
+  uint16_t count;
+  // Every empty cell, in no particular order.
+  uint16_t cells[MAP_CHUNK_CELLS];
+  // The position of each cell of the chunk in cells, or MAP_EMPTY_NONE if it
+  // is not empty.
+  uint16_t slots[MAP_CHUNK_CELLS];
+} ChunkEmpty;
+
+// The number of chunks whose empty cells are counted together, see
+// EmptyIndex.
+#define MAP_EMPTY_GROUP_CHUNKS 64
+
+// An index of the empty cells of a map, so that one can be picked uniformly
+// at random however crowded the map is. Only allocated chunks are indexed
+// cell by cell. Every cell of an unallocated chunk is the fill cell, so
+// either all of them are empty, in row major order, or none are. Cells are
+// ordered chunk by chunk, and chunks are counted in groups. Finding a cell
+// only sums the counts of the groups before its own and of the chunks
+// before it in its group, while changing a cell only updates two counts, as
+// cells change far more often than they are picked.
+typedef struct {
+  // One per chunk, null if the chunk is unallocated. Null if the map is not
+  // indexed.
+  ChunkEmpty **chunks;
+  // The number of empty cells in each group of MAP_EMPTY_GROUP_CHUNKS
+  // chunks.
+  uint32_t *groups;
+  size_t count;
+} EmptyIndex;
+
+typedef struct {
+  unsigned int width;
+  unsigned int height;
+  // The number of chunks along each axis.
+  unsigned int chunk_columns;
+  unsigned int chunk_rows;
+  // One entry per chunk in row major order, null if the chunk has never
+  // been written to, in which case every cell in it is equal to fill.
+  PackedCell **chunks;
+  PackedCell fill;
+  // A private, copy on write, mapping of the file the map was loaded from.
+  // Chunks may point into it instead of being allocated, see map_load.
+  void *mapping;
+  size_t mapping_size;
+  // Tracks which cells have changed since the map was last marked clean, so
+  // that anything mirroring the map only needs to update what changed.
+  // There is one span per row, and a list of the rows with non empty spans
+  // in the order they were first changed.
+  DirtySpan *dirty_spans;
+  unsigned int *dirty_rows;
+  size_t dirty_row_count;
+  // Incremented whenever a wall is added or removed, or the whole map is
+  // rewritten, so that anything derived from the static layout of the map
+  // knows when to rebuild.
+  unsigned int layout_version;
+  // Only maintained once map_index_empty has been called. It takes 8 bytes
+  // for every chunk of the map, and 4 bytes for every cell of an allocated
+  // chunk, so like the map itself it scales with the part that is used.
+  EmptyIndex empty;
+  // One bit per cell, set for walls and players, so that anything that only
+  // cares whether a cell can be moved into reads a bit rather than a cell.
+  // Only maintained once map_index_blocked has been called, words is null
+  // otherwise.
+  Bitboard blocked;
 } Map;
 
 void map_init(Map *map);
@@ -45,12 +160,42 @@ void map_free(Map *map);
 
 void map_set_dimensions(Map *map, size_t width, size_t height);
 void map_fill(Map *map, Cell cell);
+Cell map_fill_cell(const Map *map);
+bool map_next_chunk(const Map *map, size_t *index, MapChunk *chunk);
+size_t map_allocated_chunk_count(const Map *map);
+void map_set_chunk(Map *map, size_t index, const void *cells);
+void map_clear_chunk(Map *map, size_t index);
+void map_set_fill(Map *map, PackedCell fill);
 Cell map_get_cell(const Map *map, Vec2I pos);
 Cell map_set_cell(Map *map, Vec2I pos, Cell cell);
-void map_player(Map *map, Player *player);
+bool map_cell_eq(Cell a, Cell b);
+PackedCell map_pack_cell(Cell cell);
+Cell map_unpack_cell(PackedCell cell);
+bool map_cell_is_static(CellType type);
+void map_player(Map *map, const Player *player);
+
+void map_index_empty(Map *map);
+void map_index_blocked(Map *map);
+bool map_restore_empty_chunk(Map *map, size_t index, const void *cells,
+                             size_t count);
+size_t map_empty_count(const Map *map);
+Vec2I map_empty_cell(const Map *map, size_t index);
+
+void map_mark_dirty(Map *map, Vec2I pos);
+void map_mark_all_dirty(Map *map);
+void map_mark_clean(Map *map);
 
 Vec2I map_wrap_pos(const Map *map, Vec2I pos);
 
+// Whether a cell is a wall or a player. Reads the blocked index if the map
+// has one. Position must be a wrapped vector.
+static inline bool map_is_blocked(const Map *map, Vec2I pos) {
+  if (map->blocked.words != nullptr)
+    return bitboard_get(&map->blocked, pos);
+  const CellType type = map_get_cell(map, pos).type;
+  return type == CELL_WALL || type == CELL_PLAYER;
+}
+
 void map_debug(const Map *map);
 
 #endif // !SNAKE_MAP_H
@@ -0,0 +1,364 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <fcntl.h>
+#include <stdalign.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "error.h"
+#include "map.h"
+#include "mapfile.h"
+#include "util.h"
+
+// Unpacks a cell stored with the given cell size, the layout of a packed cell
+// is the same no matter its size. Returns false if the cell does not fit into
+// the cells of this build.
+static bool unpack_file_cell(uint32_t packed, Cell *cell) {
+  *cell = (Cell){packed & CELL_TYPE_MASK};
+  uint32_t payload = packed >> CELL_TYPE_BITS;
+  switch (cell->type) {
+  case CELL_PLAYER:
+    if (payload >= CELL_PLAYER_ID_COUNT)
+      return false;
+    cell->player.id = payload;
+    break;
+  case CELL_POWERUP:
+    if (payload > UINT8_MAX)
+      return false;
+    cell->powerup.power = payload;
+    break;
+  default:
+    break;
+  }
+
+  return true;
+}
+
+static uint32_t read_file_cell(const uint8_t *cells, size_t cell_size, size_t i) {
+  if (cell_size == sizeof(uint16_t)) {
+    uint16_t value;
+    memcpy(&value, cells + i * cell_size, sizeof(value));
+    return value;
+  }
+
+  uint32_t value;
+  memcpy(&value, cells + i * cell_size, sizeof(value));
+  return value;
+}
+
+// Copies a chunk stored with a different cell size into a new allocation.
+static bool convert_chunk(const uint8_t *cells, size_t cell_size,
+                          PackedCell **out) {
+  PackedCell *chunk = malloc(MAP_CHUNK_CELLS * sizeof(PackedCell));
+  if (chunk == nullptr) {
+    report_error("failed to allocate map chunk");
+    exit(EXIT_FAILURE);
+  }
+
+  for (size_t i = 0; i < MAP_CHUNK_CELLS; ++i) {
+    Cell cell;
+    if (!unpack_file_cell(read_file_cell(cells, cell_size, i), &cell)) {
+      free(chunk);
+      return false;
+    }
+    chunk[i] = map_pack_cell(cell);
+  }
+
+  *out = chunk;
+  return true;
+}
+
+static bool validate_header(const MapFileHeader *header, size_t file_size,
+                            const char *path) {
+  if (memcmp(header->magic, MAP_FILE_MAGIC, sizeof(header->magic)) != 0) {
+    report_error("%s: not a map file", path);
+    return false;
+  }
+
+  if (header->version != MAP_FILE_VERSION) {
+    report_error("%s: unsupported map file version %u", path, header->version);
+    return false;
+  }
+
+  if (header->cell_size != sizeof(uint16_t) &&
+      header->cell_size != sizeof(uint32_t)) {
+    report_error("%s: unsupported cell size %u", path, header->cell_size);
+    return false;
+  }
+
+  if (header->topology != MAP_TOPOLOGY_WRAP) {
+    report_error("%s: unsupported topology %u", path, header->topology);
+    return false;
+  }
+
+  if (header->chunk_size != MAP_CHUNK_SIZE) {
+    report_error("%s: unsupported chunk size %u", path, header->chunk_size);
+    return false;
+  }
+
+  if (header->width == 0 || header->height == 0) {
+    report_error("%s: map has no cells", path);
+    return false;
+  }
+
+  size_t index_size = (size_t)header->chunk_count * sizeof(MapFileChunk);
+  if (header->index_offset > file_size ||
+      index_size > file_size - header->index_offset) {
+    report_error("%s: chunk index is out of bounds", path);
+    return false;
+  }
+
+  return true;
+}
+
+// Maps the file and uses chunks stored with the same cell size as this build
+// in place. The mapping is private, so writing to the map never changes the
+// file, and pages are only copied once they are written to. Anything already
+// in the map is discarded.
+bool map_load(Map *map, const char *path) {
+  int fd = open(path, O_RDONLY);
+  if (fd < 0) {
+    report_error("failed to open map: %s", path);
+    return false;
+  }
+
+  struct stat st;
+  if (fstat(fd, &st) != 0 || st.st_size < (off_t)sizeof(MapFileHeader)) {
+    report_error("%s: not a map file", path);
+    close(fd);
+    return false;
+  }
+
+  size_t file_size = st.st_size;
+  uint8_t *mapping =
+      mmap(nullptr, file_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (mapping == MAP_FAILED) {
+    report_error("failed to map %s", path);
+    return false;
+  }
+
+  MapFileHeader header;
+  memcpy(&header, mapping, sizeof(header));
+  Cell fill;
+  if (!validate_header(&header, file_size, path) ||
+      !unpack_file_cell(header.fill, &fill)) {
+    munmap(mapping, file_size);
+    return false;
+  }
+
+  map_set_dimensions(map, header.width, header.height);
+  map->fill = map_pack_cell(fill);
+
+  const bool same_cells = header.cell_size == sizeof(PackedCell);
+  const size_t chunk_bytes = MAP_CHUNK_CELLS * header.cell_size;
+  bool in_place = false;
+  bool success = true;
+  for (uint32_t i = 0; i < header.chunk_count && success; ++i) {
+    MapFileChunk entry;
+    memcpy(&entry, mapping + header.index_offset + i * sizeof(entry),
+           sizeof(entry));
+
+    if (entry.chunk_x >= map->chunk_columns ||
+        entry.chunk_y >= map->chunk_rows || entry.offset > file_size ||
+        chunk_bytes > file_size - entry.offset) {
+      report_error("%s: chunk %u is out of bounds", path, i);
+      success = false;
+      break;
+    }
+
+    PackedCell **chunk =
+        &map->chunks[entry.chunk_x + entry.chunk_y * map->chunk_columns];
+    if (*chunk != nullptr) {
+      report_error("%s: chunk %u is stored twice", path, i);
+      success = false;
+      break;
+    }
+
+    uint8_t *cells = mapping + entry.offset;
+    if (same_cells && entry.offset % alignof(PackedCell) == 0) {
+      *chunk = (PackedCell *)cells;
+      in_place = true;
+    } else if (!convert_chunk(cells, header.cell_size, chunk)) {
+      report_error("%s: chunk %u has cells this build cannot store", path, i);
+      success = false;
+    }
+  }
+
+  // Chunks that point into the mapping are released along with it.
+  map->mapping = mapping;
+  map->mapping_size = file_size;
+  if (!success) {
+    map_fill(map, (Cell){CELL_EMPTY});
+    return false;
+  }
+
+  if (!in_place) {
+    munmap(mapping, file_size);
+    map->mapping = nullptr;
+    map->mapping_size = 0;
+  }
+
+  return true;
+}
+
+static bool write_padding(FILE *f, size_t alignment) {
+  static const uint8_t zeroes[MAP_FILE_ALIGNMENT] = {0};
+  long pos = ftell(f);
+  size_t padding = (alignment - pos % alignment) % alignment;
+  return fwrite(zeroes, 1, padding, f) == padding;
+}
+
+static bool is_fill_chunk(const Map *map, const PackedCell *cells) {
+  for (size_t i = 0; i < MAP_CHUNK_CELLS; ++i) {
+    if (cells[i] != map->fill)
+      return false;
+  }
+  return true;
+}
+
+// Writes every allocated chunk that holds something other than the fill cell.
+bool map_save(const Map *map, const char *path) {
+  FILE *f = fopen(path, "wb");
+  if (f == nullptr) {
+    report_error("failed to open file: %s", path);
+    return false;
+  }
+
+  MapFileHeader header = {
+      .version = MAP_FILE_VERSION,
+      .cell_size = sizeof(PackedCell),
+      .topology = MAP_TOPOLOGY_WRAP,
+      .width = map->width,
+      .height = map->height,
+      .chunk_size = MAP_CHUNK_SIZE,
+      .fill = map->fill,
+  };
+  memcpy(header.magic, MAP_FILE_MAGIC, sizeof(header.magic));
+
+  // The header is written again once the index is known.
+  bool success = fwrite(&header, sizeof(header), 1, f) == 1;
+
+  MapFileChunk *entries = nullptr;
+  size_t capacity = 0;
+  MapChunk chunk;
+  for (size_t i = 0; success && map_next_chunk(map, &i, &chunk); ++i) {
+    if (is_fill_chunk(map, chunk.cells))
+      continue;
+
+    if (header.chunk_count == capacity) {
+      capacity = new_capacity(capacity);
+      MapFileChunk *resized = realloc(entries, capacity * sizeof(MapFileChunk));
+      if (resized == nullptr) {
+        report_error("failed to resize map file index allocation");
+        exit(EXIT_FAILURE);
+      }
+      entries = resized;
+    }
+
+    success = write_padding(f, MAP_FILE_ALIGNMENT);
+    entries[header.chunk_count++] = (MapFileChunk){
+        chunk.origin.x >> MAP_CHUNK_BITS,
+        chunk.origin.y >> MAP_CHUNK_BITS,
+        ftell(f),
+    };
+    success = success && fwrite(chunk.cells, sizeof(PackedCell),
+                                MAP_CHUNK_CELLS, f) == MAP_CHUNK_CELLS;
+  }
+
+  success = success && write_padding(f, alignof(MapFileChunk));
+  header.index_offset = ftell(f);
+  success = success && fwrite(entries, sizeof(MapFileChunk), header.chunk_count,
+                              f) == header.chunk_count;
+  success = success && fseek(f, 0, SEEK_SET) == 0 &&
+            fwrite(&header, sizeof(header), 1, f) == 1;
+  free(entries);
+
+  if (fclose(f) != 0)
+    success = false;
+  if (!success)
+    report_error("failed to write map file: %s", path);
+  return success;
+}
+
+static bool symbol_cell(char symbol, Cell *cell) {
+  switch (symbol) {
+  case 'e':
+    *cell = (Cell){CELL_EMPTY};
+    return true;
+  case 'w':
+    *cell = (Cell){CELL_WALL};
+    return true;
+  case 'p':
+    // The text format has no way of storing power, so every power-up gets
+    // the same power as those spawned by the game.
+    *cell = (Cell){CELL_POWERUP, {.powerup = {5}}};
+    return true;
+  default:
+    return false;
+  }
+}
+
+// Loads a map written with the same symbols as map_debug, one line per row
+// starting with row 0. Players are not part of a map, so the digits map_debug
+// uses for them are rejected.
+bool map_load_text(Map *map, const char *path) {
+  char *text = read_to_string(path);
+  if (text == nullptr)
+    return false;
+
+  // Work out the dimensions first, every row must be the same length.
+  size_t width = 0;
+  size_t height = 0;
+  for (const char *line = text; *line != '\0';) {
+    size_t length = strcspn(line, "\r\n");
+    if (height > 0 && length != width) {
+      report_error("%s:%zu: expected %zu cells, found %zu", path, height + 1,
+                   width, length);
+      free(text);
+      return false;
+    }
+    width = length;
+    ++height;
+
+    line += length;
+    line += *line == '\r' ? 1 : 0;
+    line += *line == '\n' ? 1 : 0;
+  }
+
+  if (width == 0 || height == 0) {
+    report_error("%s: map has no cells", path);
+    free(text);
+    return false;
+  }
+
+  map_set_dimensions(map, width, height);
+  map_fill(map, (Cell){CELL_EMPTY});
+
+  const char *line = text;
+  for (size_t y = 0; y < height; ++y) {
+    for (size_t x = 0; x < width; ++x) {
+      Cell cell;
+      if (!symbol_cell(line[x], &cell)) {
+        report_error("%s:%zu:%zu: unexpected symbol '%c'", path, y + 1, x + 1,
+                     line[x]);
+        free(text);
+        return false;
+      }
+      map_set_cell(map, vec2i(x, y), cell);
+    }
+
+    line += width;
+    line += *line == '\r' ? 1 : 0;
+    line += *line == '\n' ? 1 : 0;
+  }
+
+  free(text);
+  return true;
+}
@@ -0,0 +1,55 @@
+#ifndef SNAKE_MAPFILE_H
+#define SNAKE_MAPFILE_H
+
+#include <stdint.h>
+
+#include "map.h"
+
+// Binary map files start with a header, followed by the cells of every
+// stored chunk, followed by an index of the stored chunks. Chunks are stored
+// exactly as they are in memory, so that they can be used in place once the
+// file is mapped, chunks that are not stored are filled with the fill cell.
+// All values are little endian.
+#define MAP_FILE_MAGIC "SNKM"
+#define MAP_FILE_VERSION 1
+// Chunk payloads are aligned to this many bytes from the start of the file.
+#define MAP_FILE_ALIGNMENT 64
+
+typedef enum {
+  // Players leaving the map on one side reappear on the other, see
+  // map_wrap_pos. Works for any dimensions. This is currently the only
+  // topology.
+  MAP_TOPOLOGY_WRAP,
+} MapTopology;
+
+typedef struct {
+  char magic[4];
+  uint16_t version;
+  // The size in bytes of each packed cell, 2 or 4.
+  uint16_t cell_size;
+  uint32_t topology;
+  uint32_t width;
+  uint32_t height;
+  // The length of the side of a chunk, must be MAP_CHUNK_SIZE.
+  uint32_t chunk_size;
+  // The packed fill cell.
+  uint32_t fill;
+  // The number of entries in the chunk index.
+  uint32_t chunk_count;
+  // The offset of the chunk index from the start of the file.
+  uint64_t index_offset;
+} MapFileHeader;
+
+typedef struct {
+  // The position of the chunk, in chunks.
+  uint32_t chunk_x;
+  uint32_t chunk_y;
+  // The offset of the chunk's cells from the start of the file.
+  uint64_t offset;
+} MapFileChunk;
+
+bool map_load(Map *map, const char *path);
+bool map_save(const Map *map, const char *path);
+bool map_load_text(Map *map, const char *path);
+
+#endif // !SNAKE_MAPFILE_H
@@ -0,0 +1,199 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "bytes.h"
+#include "error.h"
+#include "net.h"
+
+#define MESSAGE_HEADER_SIZE (sizeof(uint32_t) + sizeof(uint8_t))
+
+// Only numeric IPv4 addresses are accepted, the server is meant to be run on
+// a local network.
+static bool make_address(const char *host, unsigned int port,
+                         struct sockaddr_in *address) {
+  *address = (struct sockaddr_in){.sin_family = AF_INET};
+  address->sin_port = htons(port);
+  if (inet_pton(AF_INET, host, &address->sin_addr) != 1) {
+    report_error("invalid address: %s", host);
+    return false;
+  }
+  return true;
+}
+
+bool net_set_nonblocking(int fd) {
+  const int flags = fcntl(fd, F_GETFL);
+  return flags >= 0 && fcntl(fd, F_SETFL, flags | O_NONBLOCK) == 0;
+}
+
+// Returns a non-blocking socket listening on the given address, or -1.
+int net_listen(const char *host, unsigned int port) {
+  struct sockaddr_in address;
+  if (!make_address(host, port, &address))
+    return -1;
+
+  int fd = socket(AF_INET, SOCK_STREAM, 0);
+  if (fd < 0) {
+    report_error("failed to create socket: %s", strerror(errno));
+    return -1;
+  }
+
+  const int reuse = 1;
+  setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+  if (bind(fd, (struct sockaddr *)&address, sizeof(address)) != 0 ||
+      listen(fd, SOMAXCONN) != 0 || !net_set_nonblocking(fd)) {
+    report_error("failed to listen on %s:%u: %s", host, port, strerror(errno));
+    close(fd);
+    return -1;
+  }
+
+  return fd;
+}
+
+// Returns a blocking socket connected to the given address, or -1.
+int net_connect(const char *host, unsigned int port) {
+  struct sockaddr_in address;
+  if (!make_address(host, port, &address))
+    return -1;
+
+  int fd = socket(AF_INET, SOCK_STREAM, 0);
+  if (fd < 0) {
+    report_error("failed to create socket: %s", strerror(errno));
+    return -1;
+  }
+
+  if (connect(fd, (struct sockaddr *)&address, sizeof(address)) != 0) {
+    report_error("failed to connect to %s:%u: %s", host, port, strerror(errno));
+    close(fd);
+    return -1;
+  }
+
+  // Actions are tiny and latency sensitive.
+  const int no_delay = 1;
+  setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &no_delay, sizeof(no_delay));
+  return fd;
+}
+
+void connection_init(Connection *connection, int fd) {
+  connection->fd = fd;
+  bytes_init(&connection->in);
+  connection->in_cursor = 0;
+  bytes_init(&connection->out);
+  connection->out_cursor = 0;
+}
+
+// Closes the socket.
+void connection_free(Connection *connection) {
+  if (connection->fd >= 0)
+    close(connection->fd);
+  bytes_free(&connection->in);
+  bytes_free(&connection->out);
+  connection_init(connection, -1);
+}
+
+// Queues a message, nothing is sent until the connection is flushed.
+void connection_send(Connection *connection, MessageType type,
+                     const void *payload, size_t size) {
+  ByteBuffer *out = &connection->out;
+  // Drop what has already been sent before growing the buffer.
+  if (connection->out_cursor > 0 &&
+      out->capacity - out->size < MESSAGE_HEADER_SIZE + size) {
+    memmove(out->data, out->data + connection->out_cursor,
+            out->size - connection->out_cursor);
+    out->size -= connection->out_cursor;
+    connection->out_cursor = 0;
+  }
+
+  bytes_write_u32(out, size + sizeof(uint8_t));
+  bytes_write_u8(out, type);
+  bytes_write(out, payload, size);
+}
+
+// The number of queued bytes that have not been sent yet.
+size_t connection_pending(const Connection *connection) {
+  return connection->out.size - connection->out_cursor;
+}
+
+// Sends as much of what has been queued as the socket accepts.
+NetStatus connection_flush(Connection *connection) {
+  ByteBuffer *out = &connection->out;
+  while (connection->out_cursor < out->size) {
+    const ssize_t sent =
+        send(connection->fd, out->data + connection->out_cursor,
+             out->size - connection->out_cursor, MSG_NOSIGNAL);
+    if (sent < 0) {
+      if (errno == EINTR)
+        continue;
+      return errno == EAGAIN || errno == EWOULDBLOCK ? NET_WOULD_BLOCK
+                                                     : NET_CLOSED;
+    }
+    connection->out_cursor += sent;
+  }
+
+  bytes_clear(out);
+  connection->out_cursor = 0;
+  return NET_OK;
+}
+
+// Reads everything available on the socket, returns NET_WOULD_BLOCK once it
+// has been drained.
+NetStatus connection_receive(Connection *connection) {
+  ByteBuffer *in = &connection->in;
+  // Drop messages that have already been handled.
+  if (connection->in_cursor > 0) {
+    memmove(in->data, in->data + connection->in_cursor,
+            in->size - connection->in_cursor);
+    in->size -= connection->in_cursor;
+    connection->in_cursor = 0;
+  }
+
+  for (;;) {
+    bytes_reserve(in, 64 * 1024);
+    const ssize_t received =
+        recv(connection->fd, in->data + in->size, in->capacity - in->size, 0);
+    if (received == 0)
+      return NET_CLOSED;
+    if (received < 0) {
+      if (errno == EINTR)
+        continue;
+      return errno == EAGAIN || errno == EWOULDBLOCK ? NET_WOULD_BLOCK
+                                                     : NET_CLOSED;
+    }
+    in->size += received;
+  }
+}
+
+// Returns the next complete message that has been received. The payload
+// stays valid until the next call to connection_receive. Returns
+// NET_WOULD_BLOCK if there is no complete message, and NET_CLOSED if the
+// peer sent something that is not a message.
+NetStatus connection_next_message(Connection *connection, MessageType *type,
+                                  const uint8_t **payload, size_t *size) {
+  const ByteBuffer *in = &connection->in;
+  const size_t available = in->size - connection->in_cursor;
+  if (available < MESSAGE_HEADER_SIZE)
+    return NET_WOULD_BLOCK;
+
+  uint32_t message_size;
+  memcpy(&message_size, in->data + connection->in_cursor, sizeof(uint32_t));
+  if (message_size < sizeof(uint8_t) || message_size > NET_MAX_MESSAGE_SIZE)
+    return NET_CLOSED;
+  if (available < sizeof(uint32_t) + message_size)
+    return NET_WOULD_BLOCK;
+
+  const uint8_t *message = in->data + connection->in_cursor + sizeof(uint32_t);
+  *type = message[0];
+  *payload = message + 1;
+  *size = message_size - sizeof(uint8_t);
+  connection->in_cursor += sizeof(uint32_t) + message_size;
+  return NET_OK;
+}
@@ -0,0 +1,66 @@
+#ifndef SNAKE_NET_H
+#define SNAKE_NET_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "bytes.h"
+
+#define NET_DEFAULT_PORT 7777
+// Anything larger is treated as a protocol error, full states of the largest
+// maps fit comfortably.
+#define NET_MAX_MESSAGE_SIZE (256u << 20)
+
+// Every message is framed by a 32-bit size, covering the type and payload,
+// followed by a single byte type.
+typedef enum {
+  // Server to client, the id of the player the client controls.
+  MESSAGE_WELCOME,
+  // Server to client, the game is full, no payload.
+  MESSAGE_REJECT,
+  // Server to client, a complete snapshot of the game, see snapshot.h.
+  MESSAGE_FULL_STATE,
+  // Server to client, a delta against the previous state the client was
+  // sent, see snapshot_delta.
+  MESSAGE_DELTA_STATE,
+  // Client to server, a single ActionType for the client's player.
+  MESSAGE_ACTION,
+} MessageType;
+
+// A non-blocking stream socket along with what has been received but not yet
+// handled, and what has been queued but not yet sent.
+typedef struct {
+  int fd;
+  ByteBuffer in;
+  // The offset of the first message in in that has not been handled.
+  size_t in_cursor;
+  ByteBuffer out;
+  // The offset of the first byte in out that has not been sent.
+  size_t out_cursor;
+} Connection;
+
+typedef enum {
+  NET_OK,
+  // Nothing more can be done without blocking.
+  NET_WOULD_BLOCK,
+  // The peer closed the connection, or it failed.
+  NET_CLOSED,
+} NetStatus;
+
+int net_listen(const char *host, unsigned int port);
+int net_connect(const char *host, unsigned int port);
+bool net_set_nonblocking(int fd);
+
+void connection_init(Connection *connection, int fd);
+void connection_free(Connection *connection);
+
+void connection_send(Connection *connection, MessageType type,
+                     const void *payload, size_t size);
+size_t connection_pending(const Connection *connection);
+NetStatus connection_flush(Connection *connection);
+NetStatus connection_receive(Connection *connection);
+NetStatus connection_next_message(Connection *connection, MessageType *type,
+                                  const uint8_t **payload, size_t *size);
+
+#endif // !SNAKE_NET_H
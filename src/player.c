@@ -3,143 +3,288 @@
 #include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
+#include "arena.h"
 #include "error.h"
 #include "player.h"
 #include "util.h"
 #include "vec.h"
 
-// Resize the allocation storing the player's segments.
-static void resize(Player *player) {
-  size_t capacity = new_capacity(player->capacity);
-  PlayerSegment *segments =
-    realloc(player->segments, capacity * sizeof(PlayerSegment));
-  if (segments == nullptr) {
-    report_error("failed to resize player allocation");
-    exit(EXIT_FAILURE);
-  }
-
-  player->segments = segments;
-  player->capacity = capacity;
-}
+static const Vec2I link_directions[] = {
+    [PLAYER_LINK_RIGHT] = VEC2I_RIGHT,
+    [PLAYER_LINK_UP] = VEC2I_UP,
+    [PLAYER_LINK_LEFT] = VEC2I_LEFT,
+    [PLAYER_LINK_DOWN] = VEC2I_DOWN,
+};
 
-static inline size_t wrap_index(const Player *player, size_t index) {
-  return player->capacity > 0 ? index % player->capacity : 0;
+static inline PlayerLink opposite(PlayerLink link) {
+  return link ^ 2;
 }
 
-// Maps a logical index to a physical index.
+// Maps a logical link index to a physical one.
 static inline size_t physical_index(const Player *player, size_t index) {
   assert(index < player->capacity);
-  return wrap_index(player, player->head + index);
+  return (player->first + index) & (player->capacity - 1);
+}
+
+static inline PlayerLink get_link(const Player *player, size_t index) {
+  const size_t i = physical_index(player, index);
+  return player->links[i / PLAYER_LINKS_PER_WORD] >>
+             (i % PLAYER_LINKS_PER_WORD * 2) & 3;
+}
+
+static inline void set_link(Player *player, size_t index, PlayerLink link) {
+  const size_t i = physical_index(player, index);
+  uint64_t *word = &player->links[i / PLAYER_LINKS_PER_WORD];
+  const unsigned int shift = i % PLAYER_LINKS_PER_WORD * 2;
+  *word = (*word & ~((uint64_t)3 << shift)) | (uint64_t)link << shift;
+}
+
+// Moves a position one cell along a link, or against it, wrapping around
+// the player's bounds.
+static inline Vec2I step(const Player *player, Vec2I pos, PlayerLink link,
+                         bool backwards) {
+  const Vec2I direction = link_directions[link];
+  pos = backwards ? vec2i_sub(pos, direction) : vec2i_add(pos, direction);
+  if (pos.x < 0)
+    pos.x += player->bounds.x;
+  else if (pos.x >= player->bounds.x)
+    pos.x -= player->bounds.x;
+  if (pos.y < 0)
+    pos.y += player->bounds.y;
+  else if (pos.y >= player->bounds.y)
+    pos.y -= player->bounds.y;
+  return pos;
+}
+
+// Returns the link from one segment to the next, and false if they are not
+// adjacent in one of the four cardinal directions. A segment on the other
+// side of the map is adjacent if the body wraps around the edge.
+static bool find_link(const Player *player, Vec2I from, Vec2I to,
+                      PlayerLink *link) {
+  Vec2I v = vec2i_sub(to, from);
+  if (v.x > 1)
+    v.x -= player->bounds.x;
+  else if (v.x < -1)
+    v.x += player->bounds.x;
+  if (v.y > 1)
+    v.y -= player->bounds.y;
+  else if (v.y < -1)
+    v.y += player->bounds.y;
+
+  for (PlayerLink i = PLAYER_LINK_RIGHT; i <= PLAYER_LINK_DOWN; ++i) {
+    if (vec2i_eq(v, link_directions[i])) {
+      *link = i;
+      return true;
+    }
+  }
+  return false;
+}
+
+// Returns the 32 links starting from link index * 32, in logical order. Links
+// past the last one are unspecified.
+static uint64_t link_word(const Player *player, size_t index) {
+  if (player->capacity == 0)
+    return 0;
+
+  const size_t i = physical_index(
+      player, index * PLAYER_LINKS_PER_WORD & (player->capacity - 1));
+  const size_t word_mask = player->capacity / PLAYER_LINKS_PER_WORD - 1;
+  const size_t word = i / PLAYER_LINKS_PER_WORD;
+  const unsigned int shift = i % PLAYER_LINKS_PER_WORD * 2;
+  uint64_t value = player->links[word] >> shift;
+  if (shift > 0)
+    value |= player->links[(word + 1) & word_mask] << (64 - shift);
+  return value;
 }
 
-static bool is_adjacent(Vec2I a, Vec2I b) {
-  // TODO: update this function to handle map wrap around.
-  Vec2I v = vec2i_sub(a, b);
-  // If the difference between a and b is at most one in either x or y but not
-  // both the cell is adjacent.
-  return (abs(v.x) == 1) ^ (abs(v.y) == 1);
+static size_t link_word_count(size_t link_count) {
+  return (link_count + PLAYER_LINKS_PER_WORD - 1) / PLAYER_LINKS_PER_WORD;
+}
+
+// Moves the player's links into a block from the arena with room for at
+// least link_count of them. The ring may wrap around the end of the old
+// block, which would no longer line up with the new capacity, so links are
+// copied over in logical order, a word at a time.
+static void resize(Player *player, Arena *arena, size_t link_count) {
+  const size_t word_count =
+      arena_block_capacity(link_word_count(link_count));
+  uint64_t *links = arena_alloc(arena, word_count);
+  const size_t used = player->count > 0 ? player->count - 1 : 0;
+  for (size_t i = 0; i < link_word_count(used); ++i) {
+    links[i] = link_word(player, i);
+  }
+
+  arena_release(arena, player->links,
+                player->capacity / PLAYER_LINKS_PER_WORD);
+  player->links = links;
+  player->capacity = word_count * PLAYER_LINKS_PER_WORD;
+  player->first = 0;
 }
 
 void player_init(Player *player) {
-  player->segments = nullptr;
+  player->bounds = VEC2I_ZERO;
+  player->head = VEC2I_ZERO;
+  player->tail = VEC2I_ZERO;
+  player->links = nullptr;
   player->capacity = 0;
   player->count = 0;
-  player->head = 0;
+  player->first = 0;
   player->alive = false;
   player->queued_growth = 0;
 }
 
-void player_free(Player *player) {
-  free(player->segments);
+// Returns the player's links to the arena they were allocated from.
+void player_free(Player *player, Arena *arena) {
+  arena_release(arena, player->links,
+                player->capacity / PLAYER_LINKS_PER_WORD);
   player_init(player);
 }
 
-// Should only be called on a dead player.
-void player_spawn(Player *player, PlayerSegment head, PlayerSegment tail) {
+// Should only be called on a dead player. Positions must be wrapped vectors
+// within bounds.
+void player_spawn(Player *player, Arena *arena, Vec2I bounds, Vec2I head,
+                  Vec2I tail) {
   assert(!player->alive);
-  assert(is_adjacent(head.position, tail.position));
+  player->bounds = bounds;
+  PlayerLink link;
+  if (!find_link(player, tail, head, &link)) {
+    report_error("player spawned with a head not adjacent to its tail");
+    exit(EXIT_FAILURE);
+  }
 
-  resize(player);
-  player->segments[player->count++] = head;
-  player->segments[player->count++] = tail;
+  player_reserve(player, arena, 2);
+  player->first = 0;
+  set_link(player, 0, link);
+  player->head = head;
+  player->tail = tail;
+  player->count = 2;
   player->alive = true;
 }
 
-void player_kill(Player *player) {
-  player_init(player);
-}
+// Restores the player's body from its head and a ring of capacity links in
+// physical order, which need not be aligned, e.g. from a snapshot. Capacity
+// must be 0 or a power of two multiple of PLAYER_LINKS_PER_WORD. The ring is
+// only replaced if its capacity differs. The tail is found by walking the
+// links.
+void player_set_body(Player *player, Arena *arena, Vec2I bounds, Vec2I head,
+                     size_t count, size_t capacity, size_t first,
+                     const void *links) {
+  assert(capacity % PLAYER_LINKS_PER_WORD == 0);
+  assert(first < max_size(capacity, 1) && count <= capacity + 1);
+  const size_t word_count = capacity / PLAYER_LINKS_PER_WORD;
+  if (player->capacity != capacity) {
+    arena_release(arena, player->links,
+                  player->capacity / PLAYER_LINKS_PER_WORD);
+    player->links = capacity > 0 ? arena_alloc(arena, word_count) : nullptr;
+    player->capacity = capacity;
+  }
 
-PlayerSegment *player_index(const Player *player, size_t index) {
-  return &player->segments[physical_index(player, index)];
-}
+  if (capacity > 0)
+    memcpy(player->links, links, word_count * sizeof(uint64_t));
+  player->bounds = bounds;
+  player->first = first;
+  player->head = head;
+  player->tail = head;
+  player->count = count;
 
-// Peek the first segment of the player.
-PlayerSegment *player_front(const Player *player) {
-  return &player->segments[physical_index(player, 0)];
+  PlayerCursor cursor = player_cursor(player);
+  while (player_cursor_next(&cursor, &player->tail)) {
+  }
 }
 
-// Peek the last segment of the player.
-PlayerSegment *player_back(const Player *player) {
-  return &player->segments[physical_index(player, player->count - 1)];
+// Makes sure the player has room for count segments, so that pushing
+// segments up to that count does not touch the arena.
+void player_reserve(Player *player, Arena *arena, size_t count) {
+  if (count > 1 && count - 1 > player->capacity)
+    resize(player, arena, count - 1);
 }
 
-void player_push_front(Player *player, PlayerSegment segment) {
-  if (player->count == player->capacity)
-    resize(player);
+void player_kill(Player *player) {
+  player_init(player);
+}
 
-  // Make sure the new segment is adjacent to the current tail in one of
-  // the four cardinal directions except behind the head.
-  PlayerSegment *first = player_front(player);
-  PlayerSegment *second = player_index(player, 1);
-  if (!is_adjacent(segment.position, first->position) ||
-      vec2i_eq(segment.position, second->position)) {
-    report_error("new front segment not adjacent to old front");
-    exit(EXIT_FAILURE);
-  }
+// There must be room for the segment, see player_reserve. The new segment
+// must be adjacent to the head, and not be the segment behind it.
+void player_push_front(Player *player, Vec2I position) {
+  assert(player->count > 0 && player->count - 1 < player->capacity);
+  // Positions come from the game, not from input, so one that is not
+  // adjacent means it was wrapped differently from the player's bounds.
+  PlayerLink link;
+  [[maybe_unused]] const bool adjacent =
+      find_link(player, player->head, position, &link);
+  assert(adjacent &&
+         (player->count == 1 || link != opposite(get_link(player, 0))));
 
-  player->segments[wrap_index(player, player->head - 1)] = segment;
-  player->head--;
+  player->first = (player->first - 1) & (player->capacity - 1);
+  set_link(player, 0, link);
+  player->head = position;
   player->count++;
 }
 
-void player_push_back(Player *player, PlayerSegment segment) {
-  if (player->count == player->capacity)
-    resize(player);
-
-  PlayerSegment *last = player_front(player);
-  PlayerSegment *second_to_last = player_index(player, player->count - 1);
-  if (!is_adjacent(segment.position, last->position) ||
-      vec2i_eq(segment.position, second_to_last->position)) {
-    report_error("new back segment not adjacent to old back");
-    exit(EXIT_FAILURE);
-  }
+// There must be room for the segment, see player_reserve. The new segment
+// must be adjacent to the tail, and not be the segment in front of it.
+void player_push_back(Player *player, Vec2I position) {
+  assert(player->count > 0 && player->count - 1 < player->capacity);
+  PlayerLink link;
+  [[maybe_unused]] const bool adjacent =
+      find_link(player, position, player->tail, &link);
+  assert(adjacent && (player->count == 1 ||
+                      link != opposite(get_link(player, player->count - 2))));
 
-  player->segments[wrap_index(player, player->head + player->count)] = segment;
+  set_link(player, player->count - 1, link);
+  player->tail = position;
   player->count++;
 }
 
-PlayerSegment player_pop_front(Player *player) {
-  PlayerSegment segment = player->segments[physical_index(player, 0)];
-  ++player->head;
+Vec2I player_pop_front(Player *player) {
+  assert(player->count > 0);
+  const Vec2I position = player->head;
+  if (player->count > 1) {
+    player->head = step(player, position, get_link(player, 0), true);
+    player->first = (player->first + 1) & (player->capacity - 1);
+  }
   --player->count;
-  return segment;
+  return position;
 }
 
-PlayerSegment player_pop_back(Player *player) {
-  PlayerSegment segment =
-    player->segments[physical_index(player, player->count - 1)];
+Vec2I player_pop_back(Player *player) {
+  assert(player->count > 0);
+  const Vec2I position = player->tail;
+  if (player->count > 1)
+    player->tail =
+        step(player, position, get_link(player, player->count - 2), false);
   --player->count;
-  return segment;
+  return position;
 }
 
 Vec2I player_head_forward(const Player *player) {
     // Player's invariants guarantee that segments are adjacent to each other
-    // in one of the four cardinal directions, meaning the distance between
-    // any cell n and cell n + 1 is always equal to 1, and the difference
-    // between them is a normalised vector, representing in this case the
+    // in one of the four cardinal directions, so the first link is the
     // direction the player is facing.
-    PlayerSegment *first = player_front(player);
-    PlayerSegment *second = player_index(player, 1);
-    return vec2i_sub(first->position, second->position);
+    return link_directions[get_link(player, 0)];
+}
+
+PlayerCursor player_cursor(const Player *player) {
+  return (PlayerCursor){player, player->head, 0, 0};
+}
+
+// Sets position to the next segment and returns true, or returns false
+// once every segment has been visited.
+bool player_cursor_next(PlayerCursor *cursor, Vec2I *position) {
+  const Player *player = cursor->player;
+  if (cursor->index >= player->count)
+    return false;
+
+  *position = cursor->position;
+  if (cursor->index + 1 < player->count) {
+    if (cursor->index % PLAYER_LINKS_PER_WORD == 0)
+      cursor->word = link_word(
+          player, cursor->index / PLAYER_LINKS_PER_WORD);
+    cursor->position = step(player, cursor->position, cursor->word & 3, true);
+    cursor->word >>= 2;
+  }
+  ++cursor->index;
+  return true;
 }
@@ -2,48 +2,108 @@
 #define SNAKE_PLAYER_H
 
 #include <assert.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
 #include <stdio.h>
 
+#include "arena.h"
 #include "vec.h"
 
-// We just store the position of each segment as a Vec2I. As segments are
-// interchangeable, when we move the player we just add a new segment to the
-// front of the deque instead of updating the position of every segment,
-// this will need to change if in the future we need to associate other data
-// with each segment.
+// Refers to a player stored in a PlayerSlotMap. The index of the slot is
+// also the id the player is stored with in the map, and is reused once the
+// player is removed, the generation tells the players that have used a slot
+// apart, so that a handle to a removed player never refers to another one.
 typedef struct {
-  Vec2I position;
-} PlayerSegment;
+  uint32_t index;
+  uint32_t generation;
+} PlayerHandle;
+
+#define PLAYER_HANDLE_NULL ((PlayerHandle){UINT32_MAX, 0})
+
+static inline bool player_handle_is_null(PlayerHandle handle) {
+  return handle.index == UINT32_MAX;
+}
+
+// A player's body is stored as the position of its head and tail, and the
+// direction between each pair of adjacent segments, as a 2 bit code. The
+// position of any segment is found by walking the codes from the head, see
+// PlayerCursor. Codes are packed 32 to a word in a ring of a power of two
+// number of codes, so moving a player only writes the code of its new head,
+// and a body thousands of segments long fits in a few hundred bytes.
+//
+// Link i is the direction from segment i + 1 to segment i, so link 0 is the
+// direction the player is facing.
+typedef enum {
+  PLAYER_LINK_RIGHT,
+  PLAYER_LINK_UP,
+  PLAYER_LINK_LEFT,
+  PLAYER_LINK_DOWN,
+} PlayerLink;
+
+#define PLAYER_LINKS_PER_WORD 32
 
-// Contains a list of a player's segments, implemented using a deque, because
-// we require random access and fast inserts to the front and the back.
-// If a player is alive it should always have at least two segments.
+// Contains a player's body, as a deque of links, because we require fast
+// inserts to the front and the back. The ring is a block from an Arena
+// shared by every player in the game, which the functions that allocate or
+// release it take. If a player is alive it should always have at least two
+// segments.
 typedef struct {
   unsigned int id;
   bool alive;
   uint8_t queued_growth;
 
-  PlayerSegment *segments;
+  // The size of the map the player is on, positions wrap around it.
+  Vec2I bounds;
+  Vec2I head;
+  Vec2I tail;
+  uint64_t *links;
+  // The number of links the ring holds, a power of two.
   size_t capacity;
+  // The number of segments, one more than the number of links.
   size_t count;
-  size_t head;
+  // The physical index of link 0.
+  size_t first;
 } Player;
 
 void player_init(Player *player);
-void player_free(Player *player);
+void player_free(Player *player, Arena *arena);
 
-void player_spawn(Player *player, PlayerSegment head, PlayerSegment tail);
+void player_spawn(Player *player, Arena *arena, Vec2I bounds, Vec2I head,
+                  Vec2I tail);
+void player_set_body(Player *player, Arena *arena, Vec2I bounds, Vec2I head,
+                     size_t count, size_t capacity, size_t first,
+                     const void *links);
+void player_reserve(Player *player, Arena *arena, size_t count);
 void player_kill(Player *player);
 
-PlayerSegment *player_index(const Player *player, size_t index);
-PlayerSegment *player_front(const Player *player);
-PlayerSegment *player_back(const Player *player);
+// Peek the first segment of the player.
+static inline Vec2I player_front(const Player *player) {
+  return player->head;
+}
 
-void player_push_front(Player *player, PlayerSegment value);
-void player_push_back(Player *player, PlayerSegment value);
-PlayerSegment player_pop_front(Player *player);
-PlayerSegment player_pop_back(Player *player);
+// Peek the last segment of the player.
+static inline Vec2I player_back(const Player *player) {
+  return player->tail;
+}
+
+void player_push_front(Player *player, Vec2I position);
+void player_push_back(Player *player, Vec2I position);
+Vec2I player_pop_front(Player *player);
+Vec2I player_pop_back(Player *player);
 
 Vec2I player_head_forward(const Player *player);
 
+// Walks the segments of a player from its head to its tail, reconstructing
+// their positions a word of links at a time.
+typedef struct {
+  const Player *player;
+  Vec2I position;
+  size_t index;
+  uint64_t word;
+} PlayerCursor;
+
+PlayerCursor player_cursor(const Player *player);
+bool player_cursor_next(PlayerCursor *cursor, Vec2I *position);
+
 #endif // !SNAKE_PLAYER_H
@@ -0,0 +1,207 @@
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "action.h"
+#include "arena.h"
+#include "error.h"
+#include "input.h"
+#include "player.h"
+#include "players.h"
+#include "util.h"
+
+void player_data_init(PlayerData *player_data) {
+  player_init(&player_data->player);
+  action_init(&player_data->current_action);
+  action_init(&player_data->previous_action);
+  player_data->move = (PlayerMove){false};
+}
+
+void player_data_free(PlayerData *player_data, Arena *arena) {
+  player_free(&player_data->player, arena);
+  player_data_init(player_data);
+}
+
+void players_init(PlayerSlotMap *players, size_t slot_limit) {
+  players->data = nullptr;
+  players->data_slots = nullptr;
+  players->capacity = 0;
+  players->count = 0;
+  players->slots = nullptr;
+  players->queues = nullptr;
+  players->slot_capacity = 0;
+  players->slot_count = 0;
+  players->free_slot = PLAYER_SLOT_NONE;
+  players->slot_limit = slot_limit;
+  arena_init(&players->bodies, sizeof(uint64_t));
+}
+
+// Every player's body goes with the arena, rather than being released one
+// at a time.
+void players_free(PlayerSlotMap *players) {
+  free(players->data);
+  free(players->data_slots);
+  free(players->slots);
+  for (size_t i = 0; i < players->slot_capacity; ++i) {
+    free(players->queues[i]);
+  }
+  free(players->queues);
+  arena_free(&players->bodies);
+  players_init(players, players->slot_limit);
+}
+
+// Makes sure there is room for at least count players.
+void players_reserve(PlayerSlotMap *players, size_t count) {
+  if (count <= players->capacity)
+    return;
+
+  size_t capacity = new_capacity(players->capacity);
+  while (capacity < count)
+    capacity = new_capacity(capacity);
+
+  PlayerData *data = realloc(players->data, capacity * sizeof(PlayerData));
+  uint32_t *data_slots =
+      realloc(players->data_slots, capacity * sizeof(uint32_t));
+  if (data == nullptr || data_slots == nullptr) {
+    report_error("failed to resize player allocation");
+    exit(EXIT_FAILURE);
+  }
+
+  players->data = data;
+  players->data_slots = data_slots;
+  players->capacity = capacity;
+}
+
+// Makes sure there is room for at least slot_count slots.
+void players_reserve_slots(PlayerSlotMap *players, size_t slot_count) {
+  if (slot_count <= players->slot_capacity)
+    return;
+
+  size_t capacity = new_capacity(players->slot_capacity);
+  while (capacity < slot_count)
+    capacity = new_capacity(capacity);
+
+  PlayerSlot *slots = realloc(players->slots, capacity * sizeof(PlayerSlot));
+  ActionQueue **queues =
+      realloc(players->queues, capacity * sizeof(ActionQueue *));
+  if (slots == nullptr || queues == nullptr) {
+    report_error("failed to resize player slot allocation");
+    exit(EXIT_FAILURE);
+  }
+
+  for (size_t i = players->slot_capacity; i < capacity; ++i) {
+    queues[i] = nullptr;
+  }
+  players->slots = slots;
+  players->queues = queues;
+  players->slot_capacity = capacity;
+}
+
+// Takes ownership of the player, whose id is set to the index of its slot.
+// Returns PLAYER_HANDLE_NULL if every slot up to the slot limit is taken.
+PlayerHandle players_insert(PlayerSlotMap *players, Player player) {
+  uint32_t index = players->free_slot;
+  if (index != PLAYER_SLOT_NONE) {
+    players->free_slot = players->slots[index].value;
+  } else if (players->slot_count < players->slot_limit) {
+    players_reserve_slots(players, players->slot_count + 1);
+    index = players->slot_count++;
+    players->slots[index] = (PlayerSlot){0, false, PLAYER_SLOT_NONE};
+  } else {
+    return PLAYER_HANDLE_NULL;
+  }
+
+  players_reserve(players, players->count + 1);
+  const size_t dense_index = players->count++;
+  PlayerData *player_data = &players->data[dense_index];
+  player_data_init(player_data);
+  player_data->player = player;
+  player_data->player.id = index;
+  players->data_slots[dense_index] = index;
+
+  // Anything left over from the previous occupant of the slot is dropped.
+  if (players->queues[index] != nullptr)
+    action_queue_clear(players->queues[index]);
+
+  PlayerSlot *slot = &players->slots[index];
+  slot->occupied = true;
+  slot->value = dense_index;
+  return (PlayerHandle){index, slot->generation};
+}
+
+// Frees the player and its slot, the last player in the dense array takes
+// its place. Returns false if the handle is stale.
+bool players_remove(PlayerSlotMap *players, PlayerHandle handle) {
+  PlayerData *player_data = players_get(players, handle);
+  if (player_data == nullptr)
+    return false;
+
+  PlayerSlot *slot = &players->slots[handle.index];
+  const size_t dense_index = slot->value;
+  player_data_free(player_data, &players->bodies);
+
+  const size_t last = --players->count;
+  if (dense_index != last) {
+    players->data[dense_index] = players->data[last];
+    players->data_slots[dense_index] = players->data_slots[last];
+    players->slots[players->data_slots[dense_index]].value = dense_index;
+  }
+
+  ++slot->generation;
+  slot->occupied = false;
+  slot->value = players->free_slot;
+  players->free_slot = handle.index;
+  return true;
+}
+
+// Returns nullptr if the handle does not refer to a player anymore.
+PlayerData *players_get(const PlayerSlotMap *players, PlayerHandle handle) {
+  if (handle.index >= players->slot_count)
+    return nullptr;
+
+  const PlayerSlot *slot = &players->slots[handle.index];
+  if (!slot->occupied || slot->generation != handle.generation)
+    return nullptr;
+  return &players->data[slot->value];
+}
+
+// Looks up whichever player is in a slot, for ids that are only meaningful
+// while the player they refer to is around, such as those in map cells.
+PlayerData *players_get_slot(const PlayerSlotMap *players, uint32_t index) {
+  if (index >= players->slot_count || !players->slots[index].occupied)
+    return nullptr;
+  return &players->data[players->slots[index].value];
+}
+
+PlayerHandle players_handle(const PlayerSlotMap *players, size_t dense_index) {
+  const uint32_t index = players->data_slots[dense_index];
+  return (PlayerHandle){index, players->slots[index].generation};
+}
+
+// Returns the input queue of a player, or nullptr if the handle is stale.
+// Queues are never moved or freed before the slot map is, so the queue can
+// be handed to a producer on another thread, which must stop pushing to it
+// once the player has been removed.
+ActionQueue *players_queue(PlayerSlotMap *players, PlayerHandle handle) {
+  if (players_get(players, handle) == nullptr)
+    return nullptr;
+
+  ActionQueue **queue = &players->queues[handle.index];
+  if (*queue == nullptr) {
+    *queue = aligned_alloc(alignof(ActionQueue), sizeof(ActionQueue));
+    if (*queue == nullptr) {
+      report_error("failed to allocate action queue");
+      exit(EXIT_FAILURE);
+    }
+    action_queue_init(*queue);
+  }
+  return *queue;
+}
+
+// Drops every queued action, e.g. when the state of the game is replaced.
+void players_clear_queues(PlayerSlotMap *players) {
+  for (size_t i = 0; i < players->slot_capacity; ++i) {
+    if (players->queues[i] != nullptr)
+      action_queue_clear(players->queues[i]);
+  }
+}
@@ -0,0 +1,92 @@
+#ifndef SNAKE_PLAYERS_H
+#define SNAKE_PLAYERS_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "action.h"
+#include "arena.h"
+#include "input.h"
+#include "player.h"
+#include "vec.h"
+
+// The move a player makes during a tick. Moves for every player are proposed
+// before any of them are applied, so that the outcome of a tick does not
+// depend on the order in which players are updated.
+typedef struct {
+  // Whether the player moves this tick, dead players do not.
+  bool active;
+  // The position of the player's new head.
+  Vec2I head;
+  // Whether the player keeps its last segment because of queued growth.
+  bool grows;
+  // The index of the entry in the game's claim table for the new head.
+  size_t claim;
+} PlayerMove;
+
+typedef struct {
+  Player player;
+  Action current_action;
+  Action previous_action;
+  PlayerMove move;
+} PlayerData;
+
+void player_data_init(PlayerData *player_data);
+void player_data_free(PlayerData *player_data, Arena *arena);
+
+#define PLAYER_SLOT_NONE UINT32_MAX
+
+typedef struct {
+  // Incremented every time the slot is freed.
+  uint32_t generation;
+  bool occupied;
+  // While occupied, the index of the player in the dense array. While free,
+  // the next free slot, or PLAYER_SLOT_NONE.
+  uint32_t value;
+} PlayerSlot;
+
+// A generational slot map of players. Players are stored densely, so that
+// updating every player is a linear walk, and are found through slots that
+// stay put while players come and go. Inserting and removing are both
+// constant time: freed slots are kept in a free list, and a removed player
+// is replaced by the last one in the dense array.
+typedef struct {
+  // The players, in no particular order.
+  PlayerData *data;
+  // The slot of each player in data.
+  uint32_t *data_slots;
+  size_t capacity;
+  size_t count;
+
+  PlayerSlot *slots;
+  // The input queue of each slot, allocated the first time it is asked for,
+  // see players_queue.
+  ActionQueue **queues;
+  size_t slot_capacity;
+  size_t slot_count;
+  // The first free slot, or PLAYER_SLOT_NONE.
+  uint32_t free_slot;
+  // The most slots there can be, see players_insert.
+  size_t slot_limit;
+
+  // The arena every player's body is allocated from.
+  Arena bodies;
+} PlayerSlotMap;
+
+void players_init(PlayerSlotMap *players, size_t slot_limit);
+void players_free(PlayerSlotMap *players);
+
+PlayerHandle players_insert(PlayerSlotMap *players, Player player);
+bool players_remove(PlayerSlotMap *players, PlayerHandle handle);
+
+PlayerData *players_get(const PlayerSlotMap *players, PlayerHandle handle);
+PlayerData *players_get_slot(const PlayerSlotMap *players, uint32_t index);
+PlayerHandle players_handle(const PlayerSlotMap *players, size_t dense_index);
+ActionQueue *players_queue(PlayerSlotMap *players, PlayerHandle handle);
+void players_clear_queues(PlayerSlotMap *players);
+
+void players_reserve_slots(PlayerSlotMap *players, size_t slot_count);
+void players_reserve(PlayerSlotMap *players, size_t count);
+
+#endif // !SNAKE_PLAYERS_H
@@ -0,0 +1,289 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <assert.h>
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <threads.h>
+#include <unistd.h>
+
+#include "error.h"
+#include "pool.h"
+#include "trace.h"
+
+// The chunks a worker has yet to process, stored as a single range so that
+// both ends can be updated with one compare and swap. The owner takes chunks
+// from the end of the range, and other workers steal from the beginning.
+// The first chunk is stored in the low 32 bits, one past the last in the high
+// 32 bits.
+typedef struct {
+  _Atomic uint64_t range;
+} WorkDeque;
+
+static inline uint64_t pack_range(uint32_t begin, uint32_t end) {
+  return (uint64_t)end << 32 | begin;
+}
+
+struct PoolState {
+  thrd_t *threads;
+  // Includes the thread calling parallel_for.
+  unsigned int thread_count;
+  WorkDeque *deques;
+
+  mtx_t lock;
+  // Signalled when a new job is started or the pool is stopping.
+  cnd_t start;
+  // Signalled when the last worker finishes the current job.
+  cnd_t done;
+  // Incremented for every job, workers use it to notice new jobs.
+  unsigned int generation;
+  // The number of workers that have not finished the current job.
+  unsigned int active;
+  bool stopping;
+
+  // The current job.
+  ParallelFn fn;
+  void *context;
+  size_t count;
+  size_t grain;
+};
+
+typedef struct {
+  PoolState *state;
+  unsigned int index;
+} WorkerArgs;
+
+static void run_chunk(PoolState *state, uint32_t chunk) {
+  size_t begin = chunk * state->grain;
+  size_t end = begin + state->grain;
+  if (end > state->count)
+    end = state->count;
+  state->fn(state->context, begin, end);
+}
+
+static bool take_back(WorkDeque *deque, uint32_t *chunk) {
+  uint64_t range = atomic_load_explicit(&deque->range, memory_order_relaxed);
+  for (;;) {
+    uint32_t begin = range;
+    uint32_t end = range >> 32;
+    if (begin == end)
+      return false;
+
+    if (atomic_compare_exchange_weak_explicit(&deque->range, &range,
+                                              pack_range(begin, end - 1),
+                                              memory_order_acq_rel,
+                                              memory_order_relaxed)) {
+      *chunk = end - 1;
+      return true;
+    }
+  }
+}
+
+static bool steal_front(WorkDeque *deque, uint32_t *chunk) {
+  uint64_t range = atomic_load_explicit(&deque->range, memory_order_relaxed);
+  for (;;) {
+    uint32_t begin = range;
+    uint32_t end = range >> 32;
+    if (begin == end)
+      return false;
+
+    if (atomic_compare_exchange_weak_explicit(&deque->range, &range,
+                                              pack_range(begin + 1, end),
+                                              memory_order_acq_rel,
+                                              memory_order_relaxed)) {
+      *chunk = begin;
+      return true;
+    }
+  }
+}
+
+// Processes chunks until every deque is empty.
+static void work(PoolState *state, unsigned int index) {
+  uint32_t chunk;
+  for (;;) {
+    while (take_back(&state->deques[index], &chunk)) {
+      run_chunk(state, chunk);
+    }
+
+    // Nothing left in our own deque, look for a victim, starting with our
+    // neighbour so that thieves spread out.
+    bool stolen = false;
+    for (unsigned int i = 1; i < state->thread_count && !stolen; ++i) {
+      unsigned int victim = (index + i) % state->thread_count;
+      stolen = steal_front(&state->deques[victim], &chunk);
+    }
+
+    if (!stolen)
+      return;
+
+    run_chunk(state, chunk);
+  }
+}
+
+static int worker_main(void *arg) {
+  WorkerArgs args = *(WorkerArgs *)arg;
+  free(arg);
+  PoolState *state = args.state;
+  TRACE_THREAD_NAME("worker");
+
+  unsigned int seen = 0;
+  for (;;) {
+    mtx_lock(&state->lock);
+    while (state->generation == seen && !state->stopping) {
+      cnd_wait(&state->start, &state->lock);
+    }
+    seen = state->generation;
+    bool stopping = state->stopping;
+    mtx_unlock(&state->lock);
+
+    if (stopping)
+      return 0;
+
+    work(state, args.index);
+
+    mtx_lock(&state->lock);
+    if (--state->active == 0)
+      cnd_signal(&state->done);
+    mtx_unlock(&state->lock);
+  }
+}
+
+void pool_init(ThreadPool *pool) {
+  pool->state = nullptr;
+}
+
+void pool_free(ThreadPool *pool) {
+  PoolState *state = pool->state;
+  if (state == nullptr)
+    return;
+
+  mtx_lock(&state->lock);
+  state->stopping = true;
+  cnd_broadcast(&state->start);
+  mtx_unlock(&state->lock);
+
+  for (unsigned int i = 1; i < state->thread_count; ++i) {
+    thrd_join(state->threads[i], nullptr);
+  }
+
+  mtx_destroy(&state->lock);
+  cnd_destroy(&state->start);
+  cnd_destroy(&state->done);
+  free(state->threads);
+  free(state->deques);
+  free(state);
+  pool_init(pool);
+}
+
+void pool_spawn(ThreadPool *pool, unsigned int thread_count) {
+  assert(pool->state == nullptr);
+
+  if (thread_count == 0) {
+    long online = sysconf(_SC_NPROCESSORS_ONLN);
+    thread_count = online > 0 ? online : 1;
+  }
+
+  // A single thread does not need any workers.
+  if (thread_count == 1)
+    return;
+
+  PoolState *state = malloc(sizeof(PoolState));
+  thrd_t *threads = malloc(thread_count * sizeof(thrd_t));
+  WorkDeque *deques = malloc(thread_count * sizeof(WorkDeque));
+  if (state == nullptr || threads == nullptr || deques == nullptr) {
+    report_error("failed to allocate thread pool");
+    exit(EXIT_FAILURE);
+  }
+
+  state->threads = threads;
+  state->thread_count = thread_count;
+  state->deques = deques;
+  state->generation = 0;
+  state->active = 0;
+  state->stopping = false;
+  state->fn = nullptr;
+  state->context = nullptr;
+  state->count = 0;
+  state->grain = 1;
+  for (unsigned int i = 0; i < thread_count; ++i) {
+    atomic_init(&deques[i].range, 0);
+  }
+
+  if (mtx_init(&state->lock, mtx_plain) != thrd_success ||
+      cnd_init(&state->start) != thrd_success ||
+      cnd_init(&state->done) != thrd_success) {
+    report_error("failed to initialise thread pool synchronisation");
+    exit(EXIT_FAILURE);
+  }
+
+  // Index 0 is reserved for the thread calling parallel_for.
+  for (unsigned int i = 1; i < thread_count; ++i) {
+    WorkerArgs *args = malloc(sizeof(WorkerArgs));
+    if (args == nullptr) {
+      report_error("failed to allocate worker arguments");
+      exit(EXIT_FAILURE);
+    }
+    *args = (WorkerArgs){state, i};
+
+    if (thrd_create(&threads[i], worker_main, args) != thrd_success) {
+      report_error("failed to create worker thread");
+      exit(EXIT_FAILURE);
+    }
+  }
+
+  pool->state = state;
+}
+
+unsigned int pool_thread_count(const ThreadPool *pool) {
+  return pool->state ? pool->state->thread_count : 1;
+}
+
+void parallel_for(ThreadPool *pool, size_t count, size_t grain, ParallelFn fn,
+                  void *context) {
+  if (count == 0)
+    return;
+
+  if (grain == 0)
+    grain = 1;
+
+  size_t chunk_count = (count + grain - 1) / grain;
+  PoolState *state = pool->state;
+  // Not worth waking anyone up for a single chunk.
+  if (state == nullptr || chunk_count == 1) {
+    fn(context, 0, count);
+    return;
+  }
+
+  assert(chunk_count <= UINT32_MAX);
+
+  mtx_lock(&state->lock);
+  assert(state->active == 0);
+  state->fn = fn;
+  state->context = context;
+  state->count = count;
+  state->grain = grain;
+
+  // Hand out contiguous runs of chunks so that each worker starts out on its
+  // own part of the data.
+  unsigned int n = state->thread_count;
+  for (unsigned int i = 0; i < n; ++i) {
+    uint32_t begin = chunk_count * i / n;
+    uint32_t end = chunk_count * (i + 1) / n;
+    atomic_store_explicit(&state->deques[i].range, pack_range(begin, end),
+                          memory_order_relaxed);
+  }
+
+  state->active = n - 1;
+  ++state->generation;
+  cnd_broadcast(&state->start);
+  mtx_unlock(&state->lock);
+
+  work(state, 0);
+
+  mtx_lock(&state->lock);
+  while (state->active > 0) {
+    cnd_wait(&state->done, &state->lock);
+  }
+  mtx_unlock(&state->lock);
+}
@@ -0,0 +1,34 @@
+#ifndef SNAKE_POOL_H
+#define SNAKE_POOL_H
+
+#include <stddef.h>
+
+// Processes the items in the range [begin, end).
+typedef void (*ParallelFn)(void *context, size_t begin, size_t end);
+
+typedef struct PoolState PoolState;
+
+// A fixed size pool of worker threads. The thread that calls parallel_for
+// takes part in the work, so a pool of n threads spawns n - 1 workers, and a
+// pool of a single thread runs everything inline without any
+// synchronisation. The pool itself is a handle, and can be copied freely.
+typedef struct {
+  PoolState *state;
+} ThreadPool;
+
+void pool_init(ThreadPool *pool);
+void pool_free(ThreadPool *pool);
+
+// Starts the workers of the pool, a thread count of 0 starts one thread per
+// online processor.
+void pool_spawn(ThreadPool *pool, unsigned int thread_count);
+unsigned int pool_thread_count(const ThreadPool *pool);
+
+// Splits [0, count) into chunks of at most grain items and calls fn on every
+// chunk, returning once all of them have been processed. Chunks are handed
+// out to workers up front, and workers that run out of chunks steal from the
+// others. Must not be called from inside fn.
+void parallel_for(ThreadPool *pool, size_t count, size_t grain, ParallelFn fn,
+                  void *context);
+
+#endif // !SNAKE_POOL_H
@@ -0,0 +1,408 @@
+#include <inttypes.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "action.h"
+#include "bytes.h"
+#include "config.h"
+#include "error.h"
+#include "game.h"
+#include "map.h"
+#include "replay.h"
+#include "snapshot.h"
+#include "trace.h"
+#include "util.h"
+
+void recorder_init(Recorder *recorder) {
+  recorder->file = nullptr;
+  recorder->keyframe_interval = 0;
+  recorder->keyframe_tick = UINT64_MAX;
+  bytes_init(&recorder->buffer);
+  bytes_init(&recorder->snapshot);
+}
+
+// Writes the buffered record, recording stops if the write fails.
+static void flush_record(Recorder *recorder) {
+  if (fwrite(recorder->buffer.data, 1, recorder->buffer.size, recorder->file) !=
+      recorder->buffer.size) {
+    report_error("failed to write replay, recording stopped");
+    fclose(recorder->file);
+    recorder->file = nullptr;
+  }
+  bytes_clear(&recorder->buffer);
+}
+
+bool recorder_open(Recorder *recorder, const char *path, const Config *config) {
+  recorder->file = fopen(path, "wb");
+  if (recorder->file == nullptr) {
+    report_error("failed to open file: %s", path);
+    return false;
+  }
+
+  // A keyframe interval of 0 only writes the initial keyframe.
+  recorder->keyframe_interval = config->keyframe_interval;
+
+  ReplayHeader header = {
+      .version = REPLAY_VERSION,
+      .player_count = config->player_count,
+      .map_width = config->map_width,
+      .map_height = config->map_height,
+      .seed = config->seed,
+      .keyframe_interval = config->keyframe_interval,
+  };
+  memcpy(header.magic, REPLAY_MAGIC, sizeof(header.magic));
+  bytes_write(&recorder->buffer, &header, sizeof(header));
+  flush_record(recorder);
+  return recorder->file != nullptr;
+}
+
+static bool is_keyframe_tick(const Recorder *recorder, uint64_t tick) {
+  return tick == 0 || (recorder->keyframe_interval > 0 &&
+                       tick % recorder->keyframe_interval == 0);
+}
+
+// Writes the keyframe for the current tick if one is due and has not been
+// written yet. Every record goes through here first, so that the keyframe of
+// a tick is taken before anything recorded for it is applied to the game.
+static void begin_tick(Recorder *recorder, const Game *game) {
+  if (!is_keyframe_tick(recorder, game->tick) ||
+      recorder->keyframe_tick == game->tick)
+    return;
+
+  ByteBuffer *buffer = &recorder->buffer;
+  bytes_clear(&recorder->snapshot);
+  snapshot_write(game, &recorder->snapshot);
+  bytes_write_u8(buffer, REPLAY_RECORD_KEYFRAME);
+  bytes_write_varint(buffer, game->tick);
+  bytes_write_varint(buffer, recorder->snapshot.size);
+  bytes_write(buffer, recorder->snapshot.data, recorder->snapshot.size);
+  recorder->keyframe_tick = game->tick;
+}
+
+// Records the actions submitted for the coming tick, along with a keyframe
+// every keyframe interval ticks. Should be called right before game_update,
+// once every input for the tick has been applied. Does nothing if nothing is
+// being recorded.
+void recorder_record(Recorder *recorder, const Game *game) {
+  if (recorder->file == nullptr)
+    return;
+
+  TRACE_SCOPE("recorder_record");
+  ByteBuffer *buffer = &recorder->buffer;
+  begin_tick(recorder, game);
+
+  const PlayerSlotMap *players = &game->players;
+  size_t input_count = 0;
+  for (size_t i = 0; i < players->count; ++i) {
+    input_count += players->data[i].current_action.type != ACTION_NONE;
+  }
+
+  if (input_count > 0) {
+    bytes_write_u8(buffer, REPLAY_RECORD_INPUTS);
+    bytes_write_varint(buffer, game->tick);
+    bytes_write_varint(buffer, input_count);
+    for (size_t i = 0; i < players->count; ++i) {
+      const Action action = players->data[i].current_action;
+      if (action.type == ACTION_NONE)
+        continue;
+      bytes_write_varint(buffer, players->data_slots[i]);
+      bytes_write_u8(buffer, action.type);
+    }
+  }
+
+  if (buffer->size > 0)
+    flush_record(recorder);
+}
+
+// Records a call to game_spawn_player, should be made right before it.
+void recorder_spawn(Recorder *recorder, const Game *game) {
+  if (recorder->file == nullptr)
+    return;
+
+  begin_tick(recorder, game);
+  bytes_write_u8(&recorder->buffer, REPLAY_RECORD_SPAWN);
+  bytes_write_varint(&recorder->buffer, game->tick);
+  flush_record(recorder);
+}
+
+// Records a call to game_remove_player, should be made right before it.
+void recorder_remove(Recorder *recorder, const Game *game,
+                     PlayerHandle player) {
+  if (recorder->file == nullptr ||
+      players_get(&game->players, player) == nullptr)
+    return;
+
+  begin_tick(recorder, game);
+  bytes_write_u8(&recorder->buffer, REPLAY_RECORD_REMOVE);
+  bytes_write_varint(&recorder->buffer, game->tick);
+  bytes_write_varint(&recorder->buffer, player.index);
+  flush_record(recorder);
+}
+
+// Marks the tick the game stopped at and closes the file.
+void recorder_close(Recorder *recorder, const Game *game) {
+  if (recorder->file != nullptr) {
+    bytes_write_u8(&recorder->buffer, REPLAY_RECORD_END);
+    bytes_write_varint(&recorder->buffer, game->tick);
+    flush_record(recorder);
+  }
+
+  if (recorder->file != nullptr && fclose(recorder->file) != 0)
+    report_error("failed to write replay");
+  bytes_free(&recorder->buffer);
+  bytes_free(&recorder->snapshot);
+  recorder_init(recorder);
+}
+
+void replay_init(Replay *replay) {
+  replay->data = nullptr;
+  replay->size = 0;
+  replay->header = (ReplayHeader){0};
+  replay->keyframes = nullptr;
+  replay->keyframe_capacity = 0;
+  replay->keyframe_count = 0;
+  replay->end_tick = 0;
+  replay->cursor = 0;
+  replay->mismatch_count = 0;
+  bytes_init(&replay->scratch);
+}
+
+void replay_free(Replay *replay) {
+  free(replay->data);
+  free(replay->keyframes);
+  bytes_free(&replay->scratch);
+  replay_init(replay);
+}
+
+static void add_keyframe(Replay *replay, ReplayKeyframe keyframe) {
+  if (replay->keyframe_count == replay->keyframe_capacity) {
+    size_t capacity = new_capacity(replay->keyframe_capacity);
+    ReplayKeyframe *keyframes =
+        realloc(replay->keyframes, capacity * sizeof(ReplayKeyframe));
+    if (keyframes == nullptr) {
+      report_error("failed to resize replay keyframe allocation");
+      exit(EXIT_FAILURE);
+    }
+    replay->keyframes = keyframes;
+    replay->keyframe_capacity = capacity;
+  }
+
+  replay->keyframes[replay->keyframe_count++] = keyframe;
+}
+
+// Reads a record, returning false if it is incomplete or malformed. The
+// payload of keyframe, input and remove records is skipped, and returned
+// through payload and payload_size.
+static bool read_record(ByteReader *reader, ReplayRecordType *type,
+                        uint64_t *tick, const uint8_t **payload,
+                        size_t *payload_size) {
+  *type = reader_read_u8(reader);
+  *tick = reader_read_varint(reader);
+  const size_t payload_start = reader->cursor;
+  switch (*type) {
+  case REPLAY_RECORD_KEYFRAME: {
+    const uint64_t size = reader_read_varint(reader);
+    *payload = reader_read(reader, size);
+    *payload_size = size;
+  } break;
+  case REPLAY_RECORD_INPUTS: {
+    const uint64_t count = reader_read_varint(reader);
+    for (uint64_t i = 0; i < count && !reader->error; ++i) {
+      reader_read_varint(reader);
+      reader_read_u8(reader);
+    }
+    *payload = reader->data + payload_start;
+    *payload_size = reader->cursor - payload_start;
+  } break;
+  case REPLAY_RECORD_REMOVE:
+    reader_read_varint(reader);
+    *payload = reader->data + payload_start;
+    *payload_size = reader->cursor - payload_start;
+    break;
+  case REPLAY_RECORD_END:
+  case REPLAY_RECORD_SPAWN:
+    *payload = nullptr;
+    *payload_size = 0;
+    break;
+  default:
+    return false;
+  }
+
+  return !reader->error;
+}
+
+// Loads the whole file and indexes its keyframes, anything after the last
+// complete record is ignored.
+bool replay_load(Replay *replay, const char *path) {
+  FILE *f = fopen(path, "rb");
+  if (f == nullptr) {
+    report_error("failed to open replay: %s", path);
+    return false;
+  }
+
+  fseek(f, 0, SEEK_END);
+  const long size = ftell(f);
+  rewind(f);
+  replay->data = malloc(size > 0 ? size : 1);
+  if (replay->data == nullptr) {
+    report_error("failed to allocate replay");
+    exit(EXIT_FAILURE);
+  }
+  replay->size = fread(replay->data, 1, size, f);
+  fclose(f);
+
+  if (replay->size < sizeof(ReplayHeader)) {
+    report_error("%s: not a replay", path);
+    return false;
+  }
+
+  memcpy(&replay->header, replay->data, sizeof(ReplayHeader));
+  if (memcmp(replay->header.magic, REPLAY_MAGIC, 4) != 0) {
+    report_error("%s: not a replay", path);
+    return false;
+  }
+  if (replay->header.version != REPLAY_VERSION) {
+    report_error("%s: unsupported replay version %u", path,
+                 replay->header.version);
+    return false;
+  }
+
+  ByteReader reader;
+  reader_init(&reader, replay->data, replay->size);
+  reader.cursor = sizeof(ReplayHeader);
+  bool ended = false;
+  while (!reader_done(&reader) && !ended) {
+    const size_t offset = reader.cursor;
+    ReplayRecordType type;
+    uint64_t tick;
+    const uint8_t *payload;
+    size_t payload_size;
+    if (!read_record(&reader, &type, &tick, &payload, &payload_size) ||
+        tick < replay->end_tick) {
+      report_error("%s: replay is truncated after tick %" PRIu64, path,
+                   replay->end_tick);
+      replay->size = offset;
+      break;
+    }
+
+    if (type == REPLAY_RECORD_KEYFRAME)
+      add_keyframe(replay, (ReplayKeyframe){tick, offset});
+    ended = type == REPLAY_RECORD_END;
+    replay->end_tick = tick;
+  }
+
+  if (replay->keyframe_count == 0 || replay->keyframes[0].tick != 0) {
+    report_error("%s: replay has no initial keyframe", path);
+    return false;
+  }
+
+  return true;
+}
+
+// Restores the last keyframe at or before tick, then simulates up to tick.
+// The game must have been initialised, its thread pool is left as is.
+bool replay_seek(Replay *replay, Game *game, uint64_t tick) {
+  if (tick > replay->end_tick) {
+    report_error("cannot seek to tick %" PRIu64 ", the replay ends at tick "
+                 "%" PRIu64, tick, replay->end_tick);
+    return false;
+  }
+
+  size_t low = 0;
+  size_t high = replay->keyframe_count;
+  while (high - low > 1) {
+    const size_t mid = low + (high - low) / 2;
+    if (replay->keyframes[mid].tick <= tick) {
+      low = mid;
+    } else {
+      high = mid;
+    }
+  }
+
+  ByteReader reader;
+  reader_init(&reader, replay->data, replay->size);
+  reader.cursor = replay->keyframes[low].offset;
+  ReplayRecordType type;
+  uint64_t keyframe_tick;
+  const uint8_t *payload;
+  size_t payload_size;
+  read_record(&reader, &type, &keyframe_tick, &payload, &payload_size);
+
+  ByteReader snapshot;
+  reader_init(&snapshot, payload, payload_size);
+  if (!snapshot_read(game, &snapshot))
+    return false;
+
+  replay->cursor = reader.cursor;
+  while (game->tick < tick) {
+    replay_step(replay, game);
+  }
+
+  return true;
+}
+
+// Applies the recorded actions for the current tick and updates the game,
+// returns false once the end of the replay has been reached. Keyframes
+// passed along the way are compared to the game, see mismatch_count.
+bool replay_step(Replay *replay, Game *game) {
+  if (game->tick >= replay->end_tick)
+    return false;
+
+  ByteReader reader;
+  reader_init(&reader, replay->data, replay->size);
+  reader.cursor = replay->cursor;
+  while (!reader_done(&reader)) {
+    const size_t offset = reader.cursor;
+    ReplayRecordType type;
+    uint64_t tick;
+    const uint8_t *payload;
+    size_t payload_size;
+    read_record(&reader, &type, &tick, &payload, &payload_size);
+    if (tick > game->tick) {
+      reader.cursor = offset;
+      break;
+    }
+
+    if (type == REPLAY_RECORD_KEYFRAME) {
+      bytes_clear(&replay->scratch);
+      snapshot_write(game, &replay->scratch);
+      if (replay->scratch.size != payload_size ||
+          memcmp(replay->scratch.data, payload, payload_size) != 0) {
+        if (replay->mismatch_count++ == 0)
+          report_error("replay diverged from the recording by tick %" PRIu64,
+                       tick);
+      }
+    } else if (type == REPLAY_RECORD_INPUTS) {
+      ByteReader inputs;
+      reader_init(&inputs, payload, payload_size);
+      const uint64_t count = reader_read_varint(&inputs);
+      for (uint64_t i = 0; i < count; ++i) {
+        const uint64_t index = reader_read_varint(&inputs);
+        const Action action = {reader_read_u8(&inputs)};
+        PlayerData *player_data =
+            index < UINT32_MAX ? players_get_slot(&game->players, index)
+                               : nullptr;
+        if (player_data != nullptr)
+          player_data->current_action = action;
+      }
+    } else if (type == REPLAY_RECORD_SPAWN) {
+      game_spawn_player(game);
+    } else if (type == REPLAY_RECORD_REMOVE) {
+      ByteReader remove;
+      reader_init(&remove, payload, payload_size);
+      const uint64_t index = reader_read_varint(&remove);
+      if (index < UINT32_MAX && players_get_slot(&game->players, index) != nullptr) {
+        const PlayerHandle player = {index,
+                                     game->players.slots[index].generation};
+        game_remove_player(game, player);
+      }
+    }
+  }
+  replay->cursor = reader.cursor;
+
+  game_update(game);
+
+  return true;
+}
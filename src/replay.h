@@ -0,0 +1,102 @@
+#ifndef SNAKE_REPLAY_H
+#define SNAKE_REPLAY_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "bytes.h"
+#include "config.h"
+#include "game.h"
+
+// A replay file starts with a ReplayHeader followed by a sequence of records
+// in tick order. Every record starts with its type and the tick it belongs
+// to, followed by:
+//
+// - REPLAY_RECORD_KEYFRAME: the size of a snapshot of the game at the start
+//   of the tick and the snapshot itself, see snapshot.h.
+// - REPLAY_RECORD_INPUTS: the number of players that submitted an action for
+//   the tick, and the slot index and ActionType of each of them.
+// - REPLAY_RECORD_SPAWN: nothing, a player was spawned with game_spawn_player.
+// - REPLAY_RECORD_REMOVE: the slot index of a player that was removed.
+// - REPLAY_RECORD_END: nothing, the game was stopped before this tick.
+//
+// Integers in records are varints, see bytes_write_varint. Records are only
+// ever appended, so the file of a game that did not end cleanly can still be
+// replayed up to the last complete record. Records for the same tick are
+// applied in the order they were written, a keyframe always coming first.
+#define REPLAY_MAGIC "SNKR"
+#define REPLAY_VERSION 2
+
+typedef enum {
+  REPLAY_RECORD_KEYFRAME,
+  REPLAY_RECORD_INPUTS,
+  REPLAY_RECORD_END,
+  REPLAY_RECORD_SPAWN,
+  REPLAY_RECORD_REMOVE,
+} ReplayRecordType;
+
+// The config the game was started with, for reference, everything needed to
+// reproduce the game is in the first keyframe.
+typedef struct {
+  char magic[4];
+  uint16_t version;
+  uint16_t reserved;
+  uint32_t player_count;
+  uint32_t map_width;
+  uint32_t map_height;
+  uint32_t seed;
+  uint32_t keyframe_interval;
+} ReplayHeader;
+
+typedef struct {
+  // Null if nothing is being recorded.
+  FILE *file;
+  unsigned int keyframe_interval;
+  // The tick of the last keyframe written, or UINT64_MAX if there is none.
+  uint64_t keyframe_tick;
+  // Each record is built here before being written.
+  ByteBuffer buffer;
+  ByteBuffer snapshot;
+} Recorder;
+
+void recorder_init(Recorder *recorder);
+bool recorder_open(Recorder *recorder, const char *path, const Config *config);
+void recorder_record(Recorder *recorder, const Game *game);
+void recorder_spawn(Recorder *recorder, const Game *game);
+void recorder_remove(Recorder *recorder, const Game *game, PlayerHandle player);
+void recorder_close(Recorder *recorder, const Game *game);
+
+typedef struct {
+  uint64_t tick;
+  // The offset of the keyframe's record.
+  size_t offset;
+} ReplayKeyframe;
+
+typedef struct {
+  uint8_t *data;
+  size_t size;
+  ReplayHeader header;
+  // Every keyframe in the file, in tick order.
+  ReplayKeyframe *keyframes;
+  size_t keyframe_capacity;
+  size_t keyframe_count;
+  // The tick the recorded game stopped at.
+  uint64_t end_tick;
+  // The offset of the next record to apply.
+  size_t cursor;
+  // The number of keyframes passed while stepping that did not match the
+  // game being replayed.
+  size_t mismatch_count;
+  ByteBuffer scratch;
+} Replay;
+
+void replay_init(Replay *replay);
+void replay_free(Replay *replay);
+
+bool replay_load(Replay *replay, const char *path);
+bool replay_seek(Replay *replay, Game *game, uint64_t tick);
+bool replay_step(Replay *replay, Game *game);
+
+#endif // !SNAKE_REPLAY_H
@@ -0,0 +1,30 @@
+#include <assert.h>
+#include <stdint.h>
+
+#include "rng.h"
+
+void rng_init(Rng *rng, uint64_t seed) {
+  // The state of xorshift must never be zero, so we scramble the seed with
+  // splitmix64 which maps zero to a non zero value.
+  uint64_t z = seed + 0x9e3779b97f4a7c15;
+  z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9;
+  z = (z ^ (z >> 27)) * 0x94d049bb133111eb;
+  z = z ^ (z >> 31);
+  rng->state = z != 0 ? z : 1;
+}
+
+uint32_t rng_next(Rng *rng) {
+  uint64_t x = rng->state;
+  x ^= x >> 12;
+  x ^= x << 25;
+  x ^= x >> 27;
+  rng->state = x;
+  return (x * 0x2545f4914f6cdd1d) >> 32;
+}
+
+uint32_t rng_range(Rng *rng, uint32_t bound) {
+  assert(bound > 0);
+  // Lemire's multiply and shift reduction, the bias is negligible for the
+  // bounds we use.
+  return ((uint64_t)rng_next(rng) * bound) >> 32;
+}
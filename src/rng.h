@@ -0,0 +1,19 @@
+#ifndef SNAKE_RNG_H
+#define SNAKE_RNG_H
+
+#include <stdint.h>
+
+// A small deterministic pseudo random number generator (xorshift64*). The
+// state is a plain value so that it can be copied, stored and restored along
+// with the rest of the game state.
+typedef struct {
+  uint64_t state;
+} Rng;
+
+void rng_init(Rng *rng, uint64_t seed);
+
+uint32_t rng_next(Rng *rng);
+// Returns a value in the range [0, bound), bound must be greater than 0.
+uint32_t rng_range(Rng *rng, uint32_t bound);
+
+#endif // !SNAKE_RNG_H
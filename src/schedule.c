@@ -0,0 +1,49 @@
+#include <stdbool.h>
+
+#include "schedule.h"
+
+void scheduler_init(Scheduler *scheduler, unsigned int tick_rate,
+                    unsigned int frame_rate, double now) {
+  scheduler->tick_period = 1.0 / tick_rate;
+  scheduler->frame_period = frame_rate > 0 ? 1.0 / frame_rate : 0.0;
+  scheduler->accumulator = 0.0;
+  scheduler->last_time = now;
+  scheduler->next_frame = now;
+}
+
+// Returns the number of ticks to run to catch up with now.
+unsigned int scheduler_advance(Scheduler *scheduler, double now) {
+  // The clock is not guaranteed to be monotonic.
+  if (now > scheduler->last_time)
+    scheduler->accumulator += now - scheduler->last_time;
+  scheduler->last_time = now;
+
+  unsigned int ticks = 0;
+  while (scheduler->accumulator >= scheduler->tick_period) {
+    scheduler->accumulator -= scheduler->tick_period;
+    ++ticks;
+  }
+
+  if (ticks > SCHEDULE_MAX_CATCH_UP)
+    ticks = SCHEDULE_MAX_CATCH_UP;
+  return ticks;
+}
+
+bool scheduler_frame_due(const Scheduler *scheduler, double now) {
+  return now >= scheduler->next_frame;
+}
+
+void scheduler_frame_drawn(Scheduler *scheduler, double now) {
+  scheduler->next_frame = now + scheduler->frame_period;
+}
+
+// How long the loop can sleep before there is something to do, either the
+// next tick, or the next frame if one is waiting to be drawn.
+double scheduler_timeout(const Scheduler *scheduler, double now,
+                         bool frame_pending) {
+  double timeout = scheduler->tick_period - scheduler->accumulator -
+                   (now - scheduler->last_time);
+  if (frame_pending && scheduler->next_frame - now < timeout)
+    timeout = scheduler->next_frame - now;
+  return timeout > 0.0 ? timeout : 0.0;
+}
@@ -0,0 +1,39 @@
+#ifndef SNAKE_SCHEDULE_H
+#define SNAKE_SCHEDULE_H
+
+#include <stdbool.h>
+
+// The most ticks run at once when the game falls behind, e.g. after the
+// process was suspended. Anything beyond that is dropped, so that a slow
+// machine does not spiral trying to catch up.
+#define SCHEDULE_MAX_CATCH_UP 4
+
+// Decides when a windowed game ticks and draws. The simulation runs on a
+// fixed timestep, time is accumulated and spent a whole tick at a time, so
+// the game advances at the same rate however often the loop wakes up.
+// Frames are decoupled from ticks, they are only drawn when something
+// changed, and at most frame_rate times a second. Times are in seconds, from
+// whatever clock the caller uses.
+typedef struct {
+  double tick_period;
+  // 0 if frames are not capped.
+  double frame_period;
+  // Time that has passed but not been simulated yet, always less than
+  // tick_period after scheduler_advance.
+  double accumulator;
+  double last_time;
+  // The earliest time the next frame may be drawn.
+  double next_frame;
+} Scheduler;
+
+// A frame rate of 0 does not cap frames.
+void scheduler_init(Scheduler *scheduler, unsigned int tick_rate,
+                    unsigned int frame_rate, double now);
+
+unsigned int scheduler_advance(Scheduler *scheduler, double now);
+bool scheduler_frame_due(const Scheduler *scheduler, double now);
+void scheduler_frame_drawn(Scheduler *scheduler, double now);
+double scheduler_timeout(const Scheduler *scheduler, double now,
+                         bool frame_pending);
+
+#endif // !SNAKE_SCHEDULE_H
@@ -0,0 +1,33 @@
+#version 460 core
+
+const uint empty = 0;
+const uint wall = 1;
+const uint player = 2;
+const uint powerup = 3;
+
+uniform usampler2D cells;
+
+in VsOut {
+  vec2 map_pos;
+} fs_in;
+
+out vec4 FragColor;
+
+void main() {
+    ivec2 cell = clamp(ivec2(floor(fs_in.map_pos)), ivec2(0), textureSize(cells, 0) - 1);
+    uint cell_type = texelFetch(cells, cell, 0).r;
+    switch (cell_type) {
+      case empty:
+        FragColor = vec4(0.0, 0.0, 0.0, 1.0);
+        break;
+      case wall:
+        FragColor = vec4(1.0, 1.0, 1.0, 1.0);
+        break;
+      case player:
+        FragColor = vec4(0.0, 1.0, 0.0, 1.0);
+        break;
+      default:
+        FragColor = vec4(1.0, 0.0, 0.0, 1.0);
+        break;
+    }
+}
@@ -0,0 +1,20 @@
+#version 460 core
+
+uniform mat4 matrix;
+uniform usampler2D cells;
+
+out VsOut {
+  vec2 map_pos;
+} vs_out;
+
+void main() {
+  // A quad covering the whole map, drawn as a triangle strip with the
+  // vertices in the order
+  // 2 - 3
+  // |   |
+  // 0 - 1
+  vec2 corner = vec2(gl_VertexID & 1, gl_VertexID >> 1);
+  vec2 pos = corner * vec2(textureSize(cells, 0));
+  vs_out.map_pos = pos;
+  gl_Position = matrix * vec4(pos.x, pos.y, 0.0, 1.0);
+}
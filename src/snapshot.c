@@ -0,0 +1,492 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "arena.h"
+#include "bytes.h"
+#include "error.h"
+#include "game.h"
+#include "input.h"
+#include "map.h"
+#include "player.h"
+#include "snapshot.h"
+#include "spawner.h"
+#include "trace.h"
+#include "util.h"
+#include "vec.h"
+
+// A snapshot holds everything about a game that affects how it plays out, so
+// that a restored game continues exactly as the original did. The thread
+// pool and the actions submitted for the next tick are not part of it,
+// actions are recorded separately, see replay.h.
+//
+// Every value has a fixed size, and containers are stored with the same
+// layout they have in memory, including the unused slots of each player's
+// deque, which are written as zeroes. Two snapshots of the same game a few
+// ticks apart therefore differ in only a few places, which is what makes
+// snapshot_delta effective. The empty cell index changes length every time a
+// cell is filled or emptied, so it goes last, where that does not shift
+// anything else. Map chunks are stored as is, so a snapshot can only be read
+// by a build with the same cell layout.
+
+static void write_map(const Map *map, ByteBuffer *bytes) {
+  bytes_write_u32(bytes, map->width);
+  bytes_write_u32(bytes, map->height);
+  bytes_write_u32(bytes, map->fill);
+  bytes_write_u32(bytes, map_allocated_chunk_count(map));
+  MapChunk chunk;
+  for (size_t i = 0; map_next_chunk(map, &i, &chunk); ++i) {
+    bytes_write_u32(bytes, i);
+    bytes_write(bytes, chunk.cells, MAP_CHUNK_CELLS * sizeof(PackedCell));
+  }
+}
+
+// The order of the empty index decides which cell a random pick lands on, so
+// the order of every indexed chunk is stored as is rather than rebuilt on
+// restore. Unallocated chunks are always in row major order.
+static void write_empty_index(const Map *map, ByteBuffer *bytes) {
+  const bool indexed = map->empty.chunks != nullptr;
+  bytes_write_u8(bytes, indexed);
+  bytes_write_u32(bytes, indexed ? map_allocated_chunk_count(map) : 0);
+  if (!indexed)
+    return;
+
+  MapChunk chunk;
+  for (size_t i = 0; map_next_chunk(map, &i, &chunk); ++i) {
+    const ChunkEmpty *empty = map->empty.chunks[i];
+    bytes_write_u32(bytes, i);
+    bytes_write_u16(bytes, empty->count);
+    bytes_write(bytes, empty->cells, empty->count * sizeof(uint16_t));
+  }
+}
+
+static void write_spawner(const PowerUpSpawner *spawner, ByteBuffer *bytes) {
+  bytes_write_u32(bytes, spawner->rate);
+  bytes_write_u32(bytes, spawner->limit);
+  bytes_write_u32(bytes, spawner->kind_count);
+  for (size_t i = 0; i < spawner->kind_count; ++i) {
+    bytes_write_u8(bytes, spawner->kinds[i].power);
+    bytes_write_u32(bytes, spawner->kinds[i].weight);
+  }
+}
+
+static void write_keymap(const KeyMap *keymap, ByteBuffer *bytes) {
+  bytes_write_u32(bytes, keymap->capacity);
+  bytes_write_u32(bytes, keymap->count);
+  for (size_t i = 0; i < keymap->capacity; ++i) {
+    const Entry *entry = &keymap->entries[i];
+    const bool unused = entry->keycode == ENTRY_KEYCODE_UNUSED;
+    bytes_write_u16(bytes, entry->keycode);
+    bytes_write_u32(bytes, unused ? 0 : entry->player.index);
+    bytes_write_u32(bytes, unused ? 0 : entry->player.generation);
+    bytes_write_u8(bytes, unused ? 0 : entry->action.type);
+  }
+}
+
+// The ring of links is written in physical order, so that a player moving
+// only changes the link of its new head, which keeps deltas between
+// snapshots small. Links outside the body are written as 0.
+static void write_player(const PlayerData *player_data, ByteBuffer *bytes) {
+  const Player *player = &player_data->player;
+  bytes_write_u32(bytes, player->id);
+  bytes_write_u8(bytes, player->alive);
+  bytes_write_u8(bytes, player->queued_growth);
+  bytes_write_u8(bytes, player_data->previous_action.type);
+  bytes_write_u32(bytes, player->head.x);
+  bytes_write_u32(bytes, player->head.y);
+  bytes_write_u32(bytes, player->count);
+  bytes_write_u32(bytes, player->capacity);
+  bytes_write_u32(bytes, player->first);
+
+  const size_t word_count = player->capacity / PLAYER_LINKS_PER_WORD;
+  bytes_reserve(bytes, word_count * sizeof(uint64_t));
+  for (size_t i = 0; i < word_count; ++i) {
+    uint64_t mask = 0;
+    for (size_t j = 0; j < PLAYER_LINKS_PER_WORD; ++j) {
+      const size_t index = i * PLAYER_LINKS_PER_WORD + j;
+      const size_t offset =
+          (index - player->first) & (player->capacity - 1);
+      if (offset + 1 < player->count)
+        mask |= (uint64_t)3 << (j * 2);
+    }
+    bytes_write_u64(bytes, player->links[i] & mask);
+  }
+}
+
+// The slots are written as well as the players, so that handles held
+// outside the game stay valid across a restore and players inserted after it
+// get the same slots they did in the original game.
+static void write_players(const PlayerSlotMap *players, ByteBuffer *bytes) {
+  bytes_write_u32(bytes, players->slot_count);
+  for (size_t i = 0; i < players->slot_count; ++i) {
+    const PlayerSlot *slot = &players->slots[i];
+    bytes_write_u32(bytes, slot->generation);
+    bytes_write_u8(bytes, slot->occupied);
+    bytes_write_u32(bytes, slot->value);
+  }
+  bytes_write_u32(bytes, players->free_slot);
+
+  bytes_write_u32(bytes, players->count);
+  for (size_t i = 0; i < players->count; ++i) {
+    bytes_write_u32(bytes, players->data_slots[i]);
+    write_player(&players->data[i], bytes);
+  }
+}
+
+// Appends a snapshot of the game to bytes.
+void snapshot_write(const Game *game, ByteBuffer *bytes) {
+  TRACE_SCOPE("snapshot_write");
+  bytes_write_u16(bytes, SNAPSHOT_VERSION);
+  bytes_write_u8(bytes, sizeof(PackedCell));
+  bytes_write_u8(bytes, 0);
+  bytes_write_u64(bytes, game->tick);
+  bytes_write_u64(bytes, game->rng.state);
+
+  bytes_write_u32(bytes, game->powerup_count);
+  write_spawner(&game->spawner, bytes);
+
+  write_map(&game->map, bytes);
+  write_keymap(&game->keymap, bytes);
+
+  write_players(&game->players, bytes);
+  write_empty_index(&game->map, bytes);
+}
+
+// Chunks that are allocated in the map but not part of the snapshot are
+// cleared rather than freed, and chunks are only allocated if they were not
+// already, so restoring a snapshot of the same game does not allocate.
+static bool read_map(Map *map, ByteReader *reader) {
+  const uint32_t width = reader_read_u32(reader);
+  const uint32_t height = reader_read_u32(reader);
+  const uint32_t fill = reader_read_u32(reader);
+  const uint32_t chunk_count = reader_read_u32(reader);
+  if (reader->error || width == 0 || height == 0)
+    return false;
+
+  if (width != map->width || height != map->height)
+    map_set_dimensions(map, width, height);
+  map_set_fill(map, fill);
+
+  const size_t total_chunks = (size_t)map->chunk_columns * map->chunk_rows;
+  size_t next = 0;
+  for (uint32_t i = 0; i < chunk_count; ++i) {
+    const uint32_t index = reader_read_u32(reader);
+    const uint8_t *cells =
+        reader_read(reader, MAP_CHUNK_CELLS * sizeof(PackedCell));
+    // Chunks are written in order, anything allocated in between is not
+    // part of the snapshot.
+    if (cells == nullptr || index < next || index >= total_chunks)
+      return false;
+
+    MapChunk chunk;
+    while (map_next_chunk(map, &next, &chunk) && next < index) {
+      map_clear_chunk(map, next++);
+    }
+    map_set_chunk(map, index, cells);
+    next = index + 1;
+  }
+
+  MapChunk chunk;
+  for (; map_next_chunk(map, &next, &chunk); ++next) {
+    map_clear_chunk(map, next);
+  }
+
+  return !reader->error;
+}
+
+// Chunks the snapshot has no order for, which were allocated after it was
+// taken and have since been cleared, are left in row major order, the same
+// as the unallocated chunks they stand in for.
+static bool read_empty_index(Map *map, ByteReader *reader) {
+  const bool indexed = reader_read_u8(reader);
+  const uint32_t chunk_count = reader_read_u32(reader);
+  if (reader->error)
+    return false;
+  if (!indexed)
+    return true;
+
+  map_index_empty(map);
+  for (uint32_t i = 0; i < chunk_count; ++i) {
+    const uint32_t index = reader_read_u32(reader);
+    const uint16_t count = reader_read_u16(reader);
+    const uint8_t *cells = reader_read(reader, count * sizeof(uint16_t));
+    if (cells == nullptr || !map_restore_empty_chunk(map, index, cells, count))
+      return false;
+  }
+  return true;
+}
+
+static bool read_spawner(PowerUpSpawner *spawner, ByteReader *reader) {
+  spawner_init(spawner);
+  spawner->rate = reader_read_u32(reader);
+  spawner->limit = reader_read_u32(reader);
+  const uint32_t kind_count = reader_read_u32(reader);
+  if (reader->error || kind_count > CONFIG_MAX_POWERUP_KINDS)
+    return false;
+
+  for (size_t i = 0; i < kind_count; ++i) {
+    PowerUpKind kind;
+    kind.power = reader_read_u8(reader);
+    kind.weight = reader_read_u32(reader);
+    spawner_add_kind(spawner, kind);
+  }
+  return !reader->error;
+}
+
+static bool read_keymap(KeyMap *keymap, ByteReader *reader) {
+  const uint32_t capacity = reader_read_u32(reader);
+  const uint32_t count = reader_read_u32(reader);
+  if (reader->error || count > capacity ||
+      capacity > reader->size / (sizeof(uint16_t) + 2 * sizeof(uint32_t)))
+    return false;
+
+  if (keymap->capacity != capacity) {
+    Entry *entries = realloc(keymap->entries, capacity * sizeof(Entry));
+    if (capacity > 0 && entries == nullptr) {
+      report_error("failed to resize keymap allocation");
+      exit(EXIT_FAILURE);
+    }
+    keymap->entries = capacity > 0 ? entries : nullptr;
+    keymap->capacity = capacity;
+  }
+
+  keymap->count = count;
+  for (size_t i = 0; i < capacity; ++i) {
+    Entry *entry = &keymap->entries[i];
+    entry->keycode = reader_read_u16(reader);
+    entry->player.index = reader_read_u32(reader);
+    entry->player.generation = reader_read_u32(reader);
+    entry->action.type = reader_read_u8(reader);
+  }
+
+  return !reader->error;
+}
+
+// Reads into a player without a body, which is allocated from the arena.
+static bool read_player(PlayerData *player_data, Arena *arena, Vec2I bounds,
+                        ByteReader *reader) {
+  Player *player = &player_data->player;
+  player->id = reader_read_u32(reader);
+  player->alive = reader_read_u8(reader);
+  player->queued_growth = reader_read_u8(reader);
+  player_data->previous_action.type = reader_read_u8(reader);
+  action_init(&player_data->current_action);
+  player_data->move = (PlayerMove){false};
+
+  Vec2I head;
+  head.x = reader_read_u32(reader);
+  head.y = reader_read_u32(reader);
+  const uint32_t count = reader_read_u32(reader);
+  const uint32_t capacity = reader_read_u32(reader);
+  const uint32_t first = reader_read_u32(reader);
+  const bool is_ring = capacity % PLAYER_LINKS_PER_WORD == 0 &&
+                       (capacity & (capacity - 1)) == 0 &&
+                       first < (capacity > 0 ? capacity : 1);
+  if (reader->error || !is_ring || count > (size_t)capacity + 1 ||
+      (player->alive && count < 2) || head.x < 0 || head.x >= bounds.x ||
+      head.y < 0 || head.y >= bounds.y ||
+      capacity / PLAYER_LINKS_PER_WORD > reader->size / sizeof(uint64_t))
+    return false;
+
+  const uint8_t *links = reader_read(
+      reader, capacity / PLAYER_LINKS_PER_WORD * sizeof(uint64_t));
+  if (links == nullptr)
+    return false;
+  player_set_body(player, arena, bounds, head, count, capacity, first, links);
+  return true;
+}
+
+static bool read_slots(PlayerSlotMap *players, ByteReader *reader) {
+  const uint32_t slot_count = reader_read_u32(reader);
+  if (reader->error || slot_count > players->slot_limit ||
+      slot_count > reader->size / (2 * sizeof(uint32_t)))
+    return false;
+
+  players_reserve_slots(players, slot_count);
+  players->slot_count = slot_count;
+  for (size_t i = 0; i < slot_count; ++i) {
+    PlayerSlot *slot = &players->slots[i];
+    slot->generation = reader_read_u32(reader);
+    slot->occupied = reader_read_u8(reader);
+    slot->value = reader_read_u32(reader);
+  }
+  players->free_slot = reader_read_u32(reader);
+  return !reader->error && (players->free_slot == PLAYER_SLOT_NONE ||
+                            players->free_slot < slot_count);
+}
+
+static bool read_players(PlayerSlotMap *players, Vec2I bounds,
+                         ByteReader *reader) {
+  if (!read_slots(players, reader))
+    return false;
+
+  const uint32_t player_count = reader_read_u32(reader);
+  if (reader->error || player_count > players->slot_count)
+    return false;
+
+  // Every player is replaced, so their bodies are dropped all at once by
+  // resetting the arena, which keeps its slabs for the players being read.
+  arena_reset(&players->bodies);
+  players_reserve(players, player_count);
+  for (size_t i = 0; i < player_count; ++i) {
+    player_data_init(&players->data[i]);
+  }
+  players->count = player_count;
+
+  for (size_t i = 0; i < player_count; ++i) {
+    const uint32_t index = reader_read_u32(reader);
+    if (reader->error || index >= players->slot_count ||
+        !players->slots[index].occupied || players->slots[index].value != i)
+      return false;
+    players->data_slots[i] = index;
+    if (!read_player(&players->data[i], &players->bodies, bounds, reader))
+      return false;
+  }
+
+  // Queued actions were given to the game being replaced.
+  players_clear_queues(players);
+  return true;
+}
+
+// Replaces the state of an initialised game with that of the snapshot.
+// Existing allocations are reused wherever they are large enough, so
+// repeatedly restoring snapshots of the same game, e.g. to roll back, does
+// not allocate. Returns false if the snapshot is malformed or was written by
+// an incompatible build, in which case the game is left without players.
+bool snapshot_read(Game *game, ByteReader *reader) {
+  const uint16_t version = reader_read_u16(reader);
+  const uint8_t cell_size = reader_read_u8(reader);
+  reader_read_u8(reader);
+  if (version != SNAPSHOT_VERSION || cell_size != sizeof(PackedCell)) {
+    report_error("snapshot was written by an incompatible build");
+    return false;
+  }
+
+  game->tick = reader_read_u64(reader);
+  game->rng.state = reader_read_u64(reader);
+  game->powerup_count = reader_read_u32(reader);
+  if (!read_spawner(&game->spawner, reader) || !read_map(&game->map, reader) ||
+      !read_keymap(&game->keymap, reader) ||
+      !read_players(&game->players,
+                    vec2i(game->map.width, game->map.height), reader) ||
+      !read_empty_index(&game->map, reader)) {
+    report_error("malformed snapshot");
+    players_free(&game->players);
+    return false;
+  }
+
+  // The blocked index is not part of the snapshot, it is rebuilt as
+  // game_setup builds it, so that restored games look up cells the same way
+  // as live ones.
+  map_index_blocked(&game->map);
+  return true;
+}
+
+// Runs of unchanged bytes shorter than this are folded into the surrounding
+// literal, as a new run would cost about as much as it saves.
+#define DELTA_MIN_RUN 8
+
+static inline uint8_t base_byte(const uint8_t *base, size_t base_size,
+                                size_t i) {
+  return i < base_size ? base[i] : 0;
+}
+
+// The length of the run of bytes starting at i that are equal in both
+// buffers, compared a word at a time where possible.
+static size_t equal_run(const uint8_t *base, size_t base_size,
+                        const uint8_t *target, size_t target_size, size_t i) {
+  const size_t start = i;
+  const size_t shared = min_size(base_size, target_size);
+  while (i + sizeof(uint64_t) <= shared &&
+         memcmp(&base[i], &target[i], sizeof(uint64_t)) == 0) {
+    i += sizeof(uint64_t);
+  }
+  while (i < target_size && base_byte(base, base_size, i) == target[i]) {
+    ++i;
+  }
+  return i - start;
+}
+
+// Encodes target relative to base, usually an earlier snapshot of the same
+// game. The two are XORed, bytes past the end of base counting as zeroes, and
+// the result is run length encoded as a sequence of pairs of a run of
+// unchanged bytes to skip and a literal run of XORed bytes, both lengths
+// being varints. The delta starts with the size of target.
+void snapshot_delta(const void *base, size_t base_size, const void *target,
+                    size_t target_size, ByteBuffer *delta) {
+  const uint8_t *b = base;
+  const uint8_t *t = target;
+  bytes_write_varint(delta, target_size);
+
+  size_t i = 0;
+  while (i < target_size) {
+    const size_t skip = equal_run(b, base_size, t, target_size, i);
+    i += skip;
+
+    // Extend the literal until the next run that is worth skipping.
+    const size_t literal_start = i;
+    while (i < target_size) {
+      if (base_byte(b, base_size, i) != t[i]) {
+        ++i;
+        continue;
+      }
+
+      const size_t run = equal_run(b, base_size, t, target_size, i);
+      if (run >= DELTA_MIN_RUN || i + run == target_size)
+        break;
+      i += run;
+    }
+
+    const size_t literal_size = i - literal_start;
+    bytes_write_varint(delta, skip);
+    bytes_write_varint(delta, literal_size);
+    bytes_reserve(delta, literal_size);
+    for (size_t j = literal_start; j < i; ++j) {
+      delta->data[delta->size++] = t[j] ^ base_byte(b, base_size, j);
+    }
+  }
+}
+
+// Decodes a delta made by snapshot_delta against the same base, replacing
+// the contents of target. Returns false if the delta is malformed.
+bool snapshot_apply_delta(const void *base, size_t base_size,
+                          const void *delta, size_t delta_size,
+                          ByteBuffer *target) {
+  const uint8_t *b = base;
+  ByteReader reader;
+  reader_init(&reader, delta, delta_size);
+
+  const uint64_t target_size = reader_read_varint(&reader);
+  if (reader.error)
+    return false;
+
+  bytes_clear(target);
+  bytes_reserve(target, target_size);
+  uint8_t *out = target->data;
+  size_t i = 0;
+  while (i < target_size) {
+    const uint64_t skip = reader_read_varint(&reader);
+    const uint64_t literal_size = reader_read_varint(&reader);
+    if (reader.error || skip > target_size - i ||
+        literal_size > target_size - i - skip)
+      return false;
+
+    const size_t copy_end = i + skip;
+    if (i < base_size)
+      memcpy(&out[i], &b[i], min_size(copy_end, base_size) - i);
+    if (copy_end > base_size)
+      memset(&out[max_size(i, base_size)], 0,
+             copy_end - max_size(i, base_size));
+    i = copy_end;
+
+    const uint8_t *literal = reader_read(&reader, literal_size);
+    if (literal == nullptr)
+      return false;
+    for (size_t j = 0; j < literal_size; ++j, ++i) {
+      out[i] = literal[j] ^ base_byte(b, base_size, i);
+    }
+  }
+
+  target->size = target_size;
+  return reader_done(&reader);
+}
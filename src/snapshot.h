@@ -0,0 +1,22 @@
+#ifndef SNAKE_SNAPSHOT_H
+#define SNAKE_SNAPSHOT_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "bytes.h"
+#include "game.h"
+
+// Incremented whenever the layout of a snapshot changes.
+#define SNAPSHOT_VERSION 6
+
+void snapshot_write(const Game *game, ByteBuffer *bytes);
+bool snapshot_read(Game *game, ByteReader *reader);
+
+void snapshot_delta(const void *base, size_t base_size, const void *target,
+                    size_t target_size, ByteBuffer *delta);
+bool snapshot_apply_delta(const void *base, size_t base_size,
+                          const void *delta, size_t delta_size,
+                          ByteBuffer *target);
+
+#endif // !SNAKE_SNAPSHOT_H
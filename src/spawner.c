@@ -0,0 +1,70 @@
+#include <assert.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "config.h"
+#include "map.h"
+#include "rng.h"
+#include "spawner.h"
+
+// The spawner starts out disabled.
+void spawner_init(PowerUpSpawner *spawner) {
+  spawner->rate = 0;
+  spawner->limit = 0;
+  spawner->kind_count = 0;
+  spawner->total_weight = 0;
+}
+
+void spawner_setup(PowerUpSpawner *spawner, const Config *config) {
+  spawner_init(spawner);
+  spawner->rate = config->powerup_rate;
+  spawner->limit = config->powerup_limit;
+  for (unsigned int i = 0; i < config->powerup_kind_count; ++i) {
+    spawner_add_kind(spawner, (PowerUpKind){config->powerup_powers[i],
+                                            config->powerup_weights[i]});
+  }
+}
+
+void spawner_add_kind(PowerUpSpawner *spawner, PowerUpKind kind) {
+  assert(spawner->kind_count < CONFIG_MAX_POWERUP_KINDS);
+  spawner->kinds[spawner->kind_count++] = kind;
+  spawner->total_weight += kind.weight;
+}
+
+// There are only a handful of kinds, so a linear walk over the weights is
+// as fast as anything cleverer.
+static uint8_t pick_power(const PowerUpSpawner *spawner, Rng *rng) {
+  uint32_t pick = rng_range(rng, spawner->total_weight);
+  for (uint32_t i = 0; i < spawner->kind_count; ++i) {
+    if (pick < spawner->kinds[i].weight)
+      return spawner->kinds[i].power;
+    pick -= spawner->kinds[i].weight;
+  }
+
+  unreachable();
+}
+
+// Spawns the power-ups due this tick, given how many are on the map already,
+// and returns how many were spawned. The map must have an empty index, see
+// map_index_empty.
+unsigned int spawner_update(const PowerUpSpawner *spawner, Map *map, Rng *rng,
+                            unsigned int powerup_count) {
+  if (spawner->rate == 0 || spawner->total_weight == 0)
+    return 0;
+
+  unsigned int due = spawner->rate / 1000;
+  if (rng_range(rng, 1000) < spawner->rate % 1000)
+    ++due;
+
+  unsigned int spawned = 0;
+  while (spawned < due && powerup_count + spawned < spawner->limit &&
+         map_empty_count(map) > 0) {
+    const Vec2I pos =
+        map_empty_cell(map, rng_range(rng, map_empty_count(map)));
+    const Cell cell = {CELL_POWERUP, {.powerup = {pick_power(spawner, rng)}}};
+    map_set_cell(map, pos, cell);
+    ++spawned;
+  }
+
+  return spawned;
+}
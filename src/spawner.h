@@ -0,0 +1,37 @@
+#ifndef SNAKE_SPAWNER_H
+#define SNAKE_SPAWNER_H
+
+#include <stdint.h>
+
+#include "config.h"
+#include "map.h"
+#include "rng.h"
+
+typedef struct {
+  uint8_t power;
+  uint32_t weight;
+} PowerUpKind;
+
+// Places power-ups on empty cells picked uniformly at random, see
+// map_empty_cell, so spawning costs the same however crowded the map is.
+typedef struct {
+  // The average number of power-ups spawned every 1000 ticks, 0 disables
+  // spawning.
+  uint32_t rate;
+  // The most power-ups there can be on the map at once.
+  uint32_t limit;
+  // The power of each power-up is picked from these in proportion to their
+  // weights.
+  PowerUpKind kinds[CONFIG_MAX_POWERUP_KINDS];
+  uint32_t kind_count;
+  uint32_t total_weight;
+} PowerUpSpawner;
+
+void spawner_init(PowerUpSpawner *spawner);
+void spawner_setup(PowerUpSpawner *spawner, const Config *config);
+void spawner_add_kind(PowerUpSpawner *spawner, PowerUpKind kind);
+
+unsigned int spawner_update(const PowerUpSpawner *spawner, Map *map, Rng *rng,
+                            unsigned int powerup_count);
+
+#endif // !SNAKE_SPAWNER_H
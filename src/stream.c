@@ -0,0 +1,105 @@
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include <glad/gl.h>
+
+#include "error.h"
+#include "stream.h"
+#include "trace.h"
+
+static void wait_fence(StreamBuffer *stream, unsigned int region) {
+  GLsync fence = stream->fences[region];
+  if (fence == nullptr)
+    return;
+
+  TRACE_SCOPE("wait_fence");
+  for (;;) {
+    GLenum result =
+        glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, FENCE_TIMEOUT_NS);
+    if (result == GL_ALREADY_SIGNALED || result == GL_CONDITION_SATISFIED)
+      break;
+    if (result == GL_WAIT_FAILED) {
+      report_error("failed to wait for stream buffer fence");
+      break;
+    }
+  }
+
+  glDeleteSync(fence);
+  stream->fences[region] = nullptr;
+}
+
+static void release(StreamBuffer *stream) {
+  for (unsigned int i = 0; i < STREAM_REGION_COUNT; ++i) {
+    wait_fence(stream, i);
+  }
+
+  if (stream->handle != 0) {
+    glUnmapNamedBuffer(stream->handle);
+    glDeleteBuffers(1, &stream->handle);
+  }
+}
+
+static void allocate(StreamBuffer *stream, size_t region_size) {
+  const GLbitfield flags =
+      GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+  const size_t size = region_size * STREAM_REGION_COUNT;
+
+  glCreateBuffers(1, &stream->handle);
+  glNamedBufferStorage(stream->handle, size, nullptr, flags);
+  stream->mapping = glMapNamedBufferRange(stream->handle, 0, size, flags);
+  if (stream->mapping == nullptr) {
+    report_error("failed to map stream buffer");
+    exit(EXIT_FAILURE);
+  }
+  stream->region_size = region_size;
+}
+
+void stream_init(StreamBuffer *stream) {
+  stream->handle = 0;
+  stream->mapping = nullptr;
+  stream->region_size = 0;
+  stream->region = 0;
+  for (unsigned int i = 0; i < STREAM_REGION_COUNT; ++i) {
+    stream->fences[i] = nullptr;
+  }
+}
+
+void stream_free(StreamBuffer *stream) {
+  release(stream);
+  stream_init(stream);
+}
+
+void *stream_begin(StreamBuffer *stream, size_t size, bool *reallocated) {
+  *reallocated = false;
+  if (stream->handle == 0 || size > stream->region_size) {
+    // Grow geometrically so that slowly growing data does not reallocate on
+    // every frame.
+    size_t region_size = stream->region_size > 0 ? stream->region_size : 4096;
+    while (region_size < size)
+      region_size *= 2;
+
+    release(stream);
+    stream_init(stream);
+    allocate(stream, region_size);
+    *reallocated = true;
+  } else {
+    stream->region = (stream->region + 1) % STREAM_REGION_COUNT;
+  }
+
+  wait_fence(stream, stream->region);
+  return (uint8_t *)stream->mapping + stream_offset(stream);
+}
+
+size_t stream_offset(const StreamBuffer *stream) {
+  return stream->region * stream->region_size;
+}
+
+void stream_fence(StreamBuffer *stream) {
+  // Replace any fence from an earlier draw of the same region, the new one is
+  // signalled later.
+  if (stream->fences[stream->region] != nullptr)
+    glDeleteSync(stream->fences[stream->region]);
+  stream->fences[stream->region] =
+      glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+}
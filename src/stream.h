@@ -0,0 +1,48 @@
+#ifndef SNAKE_STREAM_H
+#define SNAKE_STREAM_H
+
+#include <stddef.h>
+
+#define STREAM_REGION_COUNT 3
+
+// How long a single wait on a fence lasts. Waiting for longer than this
+// means something has gone wrong, but callers keep waiting regardless, as
+// the memory the fence guards must not be touched before it is signalled.
+#define FENCE_TIMEOUT_NS 1000000000
+
+// A buffer for data that is rewritten every frame. Its storage is split into
+// regions that are used in turn, and stays mapped for the lifetime of the
+// buffer, so data is written straight into memory the gpu reads from. Each
+// region is guarded by a fence placed after the last draw that read from it,
+// so the cpu only waits when it gets more than STREAM_REGION_COUNT - 1
+// frames ahead of the gpu.
+typedef struct {
+  unsigned int handle;
+  // The persistent mapping of the whole buffer.
+  void *mapping;
+  // The size of each region in bytes.
+  size_t region_size;
+  // The region most recently handed out by stream_begin.
+  unsigned int region;
+  // One fence per region, null if nothing is reading from the region. These
+  // are GLsync objects, stored as pointers so that this header does not
+  // depend on OpenGL.
+  void *fences[STREAM_REGION_COUNT];
+} StreamBuffer;
+
+void stream_init(StreamBuffer *stream);
+void stream_free(StreamBuffer *stream);
+
+// Moves on to the next region and returns a pointer to at least size bytes
+// of it, waiting for the gpu to finish with it first if needed. If the
+// regions are too small the buffer is reallocated, in which case it returns
+// true through reallocated, and any state referring to the old handle needs
+// to be updated.
+void *stream_begin(StreamBuffer *stream, size_t size, bool *reallocated);
+// The offset in bytes of the current region from the start of the buffer.
+size_t stream_offset(const StreamBuffer *stream);
+// Should be called after the last command that reads from the current region
+// has been submitted.
+void stream_fence(StreamBuffer *stream);
+
+#endif // !SNAKE_STREAM_H
@@ -0,0 +1,263 @@
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <threads.h>
+
+#include "error.h"
+#include "trace.h"
+#include "util.h"
+
+// An event as it is stored in a buffer. Fields are atomic because a report
+// may read an event while its thread overwrites it, see collect.
+typedef struct {
+  _Atomic(const char *) name;
+  _Atomic uint64_t start;
+  _Atomic uint64_t end;
+} StoredEvent;
+
+// The events of one thread, in a ring that only that thread writes to.
+// Buffers are created the first time a thread records an event, and live
+// for as long as the process, so a report never races with a free.
+typedef struct TraceBuffer {
+  struct TraceBuffer *next;
+  unsigned int thread;
+  _Atomic(const char *) thread_name;
+  // The number of events ever recorded, the newest is at (head - 1) modulo
+  // the size of the ring.
+  _Atomic uint64_t head;
+  StoredEvent events[TRACE_BUFFER_SIZE];
+} TraceBuffer;
+
+// A copy of an event taken for a report.
+typedef struct {
+  const char *name;
+  unsigned int thread;
+  uint64_t start;
+  uint64_t duration;
+} TraceEvent;
+
+static _Atomic(TraceBuffer *) buffers = nullptr;
+static atomic_uint thread_count = 0;
+static thread_local TraceBuffer *local_buffer = nullptr;
+
+static TraceBuffer *get_buffer(void) {
+  if (local_buffer != nullptr)
+    return local_buffer;
+
+  TraceBuffer *buffer = calloc(1, sizeof(TraceBuffer));
+  if (buffer == nullptr) {
+    report_error("failed to allocate trace buffer");
+    exit(EXIT_FAILURE);
+  }
+  buffer->thread = atomic_fetch_add(&thread_count, 1);
+
+  // Buffers are only ever added, so pushing onto the front of the list is
+  // enough to publish one.
+  TraceBuffer *head = atomic_load(&buffers);
+  do {
+    buffer->next = head;
+  } while (!atomic_compare_exchange_weak(&buffers, &head, buffer));
+  local_buffer = buffer;
+  return buffer;
+}
+
+TraceScope trace_begin(const char *name) {
+  return (TraceScope){name, time_ns()};
+}
+
+// Records the scope as an event of the calling thread. Never blocks, and
+// only allocates the first time a thread records anything.
+void trace_end(TraceScope *scope) {
+  const uint64_t end = time_ns();
+  TraceBuffer *buffer = get_buffer();
+  const uint64_t head =
+      atomic_load_explicit(&buffer->head, memory_order_relaxed);
+  StoredEvent *event = &buffer->events[head & (TRACE_BUFFER_SIZE - 1)];
+  atomic_store_explicit(&event->name, scope->name, memory_order_relaxed);
+  atomic_store_explicit(&event->start, scope->start, memory_order_relaxed);
+  atomic_store_explicit(&event->end, end, memory_order_relaxed);
+  atomic_store_explicit(&buffer->head, head + 1, memory_order_release);
+}
+
+// Names the calling thread in the trace, the name must outlive the trace.
+void trace_name_thread(const char *name) {
+  atomic_store(&get_buffer()->thread_name, name);
+}
+
+bool trace_enabled(void) {
+#ifdef SNAKE_TRACE
+  return true;
+#else
+  return false;
+#endif
+}
+
+// Copies the events of a buffer that its thread may still be writing to.
+// Events are copied oldest first, then any that the thread may have
+// overwritten in the meantime are dropped, so only whole events are kept.
+// Returns the number of events written to out, which has room for a full
+// buffer.
+static size_t collect(const TraceBuffer *buffer, TraceEvent *out) {
+  const uint64_t head =
+      atomic_load_explicit(&buffer->head, memory_order_acquire);
+  const uint64_t first =
+      head > TRACE_BUFFER_SIZE ? head - TRACE_BUFFER_SIZE : 0;
+  for (uint64_t i = first; i < head; ++i) {
+    const StoredEvent *event = &buffer->events[i & (TRACE_BUFFER_SIZE - 1)];
+    const uint64_t start =
+        atomic_load_explicit(&event->start, memory_order_relaxed);
+    out[i - first] = (TraceEvent){
+        atomic_load_explicit(&event->name, memory_order_relaxed),
+        buffer->thread,
+        start,
+        atomic_load_explicit(&event->end, memory_order_relaxed) - start,
+    };
+  }
+
+  // The slot of event i is reused by event i + TRACE_BUFFER_SIZE, which the
+  // thread may be writing before it advances head.
+  atomic_thread_fence(memory_order_acquire);
+  const uint64_t now =
+      atomic_load_explicit(&buffer->head, memory_order_relaxed);
+  const uint64_t valid =
+      now + 1 > TRACE_BUFFER_SIZE ? now + 1 - TRACE_BUFFER_SIZE : 0;
+  if (valid <= first)
+    return head - first;
+  if (valid >= head)
+    return 0;
+  memmove(out, out + (valid - first), (head - valid) * sizeof(TraceEvent));
+  return head - valid;
+}
+
+// Returns a copy of the events of every thread, which the caller frees.
+static TraceEvent *collect_all(size_t *count) {
+  const unsigned int threads = atomic_load(&thread_count);
+  TraceEvent *events =
+      malloc(((size_t)threads * TRACE_BUFFER_SIZE + 1) * sizeof(TraceEvent));
+  if (events == nullptr) {
+    report_error("failed to allocate trace report");
+    exit(EXIT_FAILURE);
+  }
+
+  *count = 0;
+  for (TraceBuffer *buffer = atomic_load(&buffers); buffer != nullptr;
+       buffer = buffer->next) {
+    // A thread that started after the count was read is left out.
+    if (buffer->thread < threads)
+      *count += collect(buffer, &events[*count]);
+  }
+  return events;
+}
+
+static int compare_events(const void *a, const void *b) {
+  const TraceEvent *x = a;
+  const TraceEvent *y = b;
+  const int order = strcmp(x->name, y->name);
+  if (order != 0)
+    return order;
+  return (x->duration > y->duration) - (x->duration < y->duration);
+}
+
+// Prints the count, median, 99th percentile and maximum duration of every
+// kind of event, over the events each thread still holds, so the summary
+// covers roughly the last TRACE_BUFFER_SIZE events of each thread.
+void trace_report(FILE *file) {
+  if (!trace_enabled()) {
+    fprintf(file, "tracing is disabled, build with TRACE=1\n");
+    return;
+  }
+
+  size_t count;
+  TraceEvent *events = collect_all(&count);
+  qsort(events, count, sizeof(TraceEvent), compare_events);
+
+  fprintf(file, "  %-24s %8s %12s %12s %12s\n", "probe", "count", "p50 us",
+          "p99 us", "max us");
+  for (size_t begin = 0; begin < count;) {
+    size_t end = begin + 1;
+    while (end < count && strcmp(events[end].name, events[begin].name) == 0)
+      ++end;
+
+    const TraceEvent *group = &events[begin];
+    const size_t n = end - begin;
+    fprintf(file, "  %-24s %8zu %12.1f %12.1f %12.1f\n", group->name, n,
+            group[(n - 1) * 50 / 100].duration / 1e3,
+            group[(n - 1) * 99 / 100].duration / 1e3,
+            group[n - 1].duration / 1e3);
+    begin = end;
+  }
+  free(events);
+}
+
+static void write_json_string(FILE *f, const char *string) {
+  fputc('"', f);
+  for (const char *c = string; *c != '\0'; ++c) {
+    if (*c == '"' || *c == '\\')
+      fputc('\\', f);
+    fputc(*c, f);
+  }
+  fputc('"', f);
+}
+
+// Writes every event the threads still hold in the Chrome trace event
+// format, which chrome://tracing and Perfetto can open. Timestamps are in
+// microseconds from the earliest event.
+bool trace_write_json(const char *path) {
+  if (!trace_enabled()) {
+    report_error("tracing is disabled, build with TRACE=1");
+    return false;
+  }
+
+  FILE *f = fopen(path, "w");
+  if (f == nullptr) {
+    report_error("failed to open file: %s", path);
+    return false;
+  }
+
+  size_t count;
+  TraceEvent *events = collect_all(&count);
+  uint64_t origin = UINT64_MAX;
+  for (size_t i = 0; i < count; ++i) {
+    if (events[i].start < origin)
+      origin = events[i].start;
+  }
+
+  fprintf(f, "{\"traceEvents\":[\n");
+  bool first = true;
+  for (TraceBuffer *buffer = atomic_load(&buffers); buffer != nullptr;
+       buffer = buffer->next) {
+    const char *name = atomic_load(&buffer->thread_name);
+    fprintf(f, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,"
+               "\"tid\":%u,\"args\":{\"name\":",
+            first ? "" : ",\n", buffer->thread);
+    if (name != nullptr) {
+      write_json_string(f, name);
+    } else {
+      fprintf(f, "\"thread %u\"", buffer->thread);
+    }
+    fprintf(f, "}}");
+    first = false;
+  }
+  for (size_t i = 0; i < count; ++i) {
+    const TraceEvent *event = &events[i];
+    fprintf(f, "%s{\"name\":", first ? "" : ",\n");
+    write_json_string(f, event->name);
+    fprintf(f, ",\"ph\":\"X\",\"pid\":1,\"tid\":%u,\"ts\":%.3f,\"dur\":%.3f}",
+            event->thread, (event->start - origin) / 1e3,
+            event->duration / 1e3);
+    first = false;
+  }
+  fprintf(f, "\n]}\n");
+  free(events);
+
+  const bool success = !ferror(f);
+  if (fclose(f) != 0 || !success) {
+    report_error("failed to write trace: %s", path);
+    return false;
+  }
+  return true;
+}
@@ -0,0 +1,49 @@
+#ifndef SNAKE_TRACE_H
+#define SNAKE_TRACE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+// The number of events each thread keeps, once a thread has recorded this
+// many its oldest events are overwritten. Must be a power of two.
+#define TRACE_BUFFER_SIZE 65536
+
+// A probe that has started but not finished, see TRACE_SCOPE.
+typedef struct {
+  const char *name;
+  uint64_t start;
+} TraceScope;
+
+TraceScope trace_begin(const char *name);
+void trace_end(TraceScope *scope);
+void trace_name_thread(const char *name);
+
+bool trace_enabled(void);
+void trace_report(FILE *file);
+bool trace_write_json(const char *path);
+
+// Probes are only compiled in when building with TRACE=1, otherwise they
+// expand to nothing and cost nothing.
+#ifdef SNAKE_TRACE
+
+#define TRACE_CONCAT_(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_(a, b)
+
+// Times the rest of the enclosing block as an event. The name must outlive
+// the trace, e.g. a string literal, and events with the same name are
+// summarised together by trace_report.
+#define TRACE_SCOPE(name)                                                      \
+  [[gnu::cleanup(trace_end)]] TraceScope TRACE_CONCAT(trace_scope_,            \
+                                                      __LINE__) =              \
+      trace_begin(name)
+#define TRACE_THREAD_NAME(name) trace_name_thread(name)
+
+#else
+
+#define TRACE_SCOPE(name) ((void)0)
+#define TRACE_THREAD_NAME(name) ((void)0)
+
+#endif
+
+#endif // !SNAKE_TRACE_H
@@ -1,6 +1,10 @@
+#define _POSIX_C_SOURCE 199309L
+
 #include <stddef.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <time.h>
 
 #include "error.h"
 #include "util.h"
@@ -34,10 +38,26 @@ int max(int a, int b) {
   return a > b ? a : b;
 }
 
+size_t min_size(size_t a, size_t b) {
+  return a < b ? a : b;
+}
+
+size_t max_size(size_t a, size_t b) {
+  return a > b ? a : b;
+}
+
 size_t new_capacity(size_t capacity) {
   return capacity == 0 ? 8 : capacity * 2;
 }
 
+// Returns the value of a monotonic clock in nanoseconds, only differences
+// between two values are meaningful.
+uint64_t time_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
 // Converts a position to a row major index.
 size_t row_maj_index(size_t w, size_t x, size_t y) {
   return w * y + x;
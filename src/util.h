@@ -2,6 +2,7 @@
 #define SNAKE_UTIL_H
 
 #include <stddef.h>
+#include <stdint.h>
 
 #include "vec.h"
 
@@ -9,6 +10,8 @@ char *read_to_string(const char *path);
 
 int min(int a, int b);
 int max(int a, int b);
+size_t min_size(size_t a, size_t b);
+size_t max_size(size_t a, size_t b);
 
 size_t row_maj_index(size_t w, size_t x, size_t y);
 Vec2I row_maj_position(size_t w, size_t i);
@@ -17,6 +20,15 @@ Vec2I col_maj_position(size_t h, size_t i);
 
 size_t new_capacity(size_t capacity);
 
+// The slot a key starts probing from in an open addressing table, found by
+// Fibonacci hashing. The capacity must be a power of two, mask being one
+// less than it.
+static inline size_t hash_slot(uint64_t key, size_t mask) {
+  return (key * 11400714819323198485ull) >> 32 & mask;
+}
+
+uint64_t time_ns(void);
+
 #define DBG_EXP(x)                                                             \
   printf(_Generic((x),                                                         \
          char *: "%s = %s\n",                                                  \
@@ -0,0 +1,96 @@
+#include <stddef.h>
+
+#include "map.h"
+#include "trace.h"
+#include "vec.h"
+#include "vertex.h"
+
+static Vertex vertex(const Map *map, unsigned int i) {
+  unsigned int cell_number = i / 4;
+  unsigned int vertex_number = i % 4;
+
+  unsigned int x = cell_number % map->width;
+  unsigned int y = cell_number / map->width;
+  CellType type = map_get_cell(map, vec2i(x, y)).type;
+
+  Vec2I pos;
+  switch (vertex_number) {
+  case 0:
+    // Bottom left.
+    pos.x = x + 0;
+    pos.y = y + 0;
+    break;
+  case 1:
+    // Bottom right.
+    pos.x = x + 1;
+    pos.y = y + 0;
+    break;
+  case 2:
+    // Top left.
+    pos.x = x + 0;
+    pos.y = y + 1;
+    break;
+  case 3:
+    // Top right.
+    pos.x = x + 1;
+    pos.y = y + 1;
+    break;
+  }
+
+  Vertex v;
+  v.pos = pos;
+  v.type = type;
+  return v;
+}
+
+// Writes one quad per cell no matter what, geometry_static_from_map and
+// stream_geometry_dynamic_from_map produce far fewer quads for the same map.
+void write_vertices(const Map *map, Vertex *vertices) {
+  TRACE_SCOPE("write_vertices");
+  write_cell_vertices(map, vertices, 0, map->width * map->height);
+}
+
+// Writes the 4 vertices of each cell in [first_cell, first_cell + cell_count).
+void write_cell_vertices(const Map *map, Vertex *vertices, size_t first_cell,
+                         size_t cell_count) {
+  for (size_t i = 4 * first_cell; i < 4 * (first_cell + cell_count); ++i) {
+    vertices[i] = vertex(map, i);
+  }
+}
+
+void write_indices(const Map *map, unsigned int *indices) {
+  TRACE_SCOPE("write_indices");
+  write_quad_indices(indices, map->width * map->height);
+}
+
+// Writes the 4 vertices of a quad covering the cells in [min, max).
+void write_quad(Vertex *vertices, Vec2I min, Vec2I max, CellType type) {
+  // The vertices are in the same order as those of a cell.
+  vertices[0] = (Vertex){vec2i(min.x, min.y), type};
+  vertices[1] = (Vertex){vec2i(max.x, min.y), type};
+  vertices[2] = (Vertex){vec2i(min.x, max.y), type};
+  vertices[3] = (Vertex){vec2i(max.x, max.y), type};
+}
+
+void write_quad_indices(unsigned int *indices, size_t quad_count) {
+  for (size_t i = 0; i < quad_count; ++i) {
+    // there are 6 unsigned ints per quad.
+    size_t index_offset = i * 6;
+    // There are 4 vertices per quad.
+    size_t vertex_offset = i * 4;
+    // The vertices are at vertex_offset +
+    // 2 - 3
+    // |   |
+    // 0 - 1
+
+    // Top triangle.
+    indices[index_offset + 0] = vertex_offset + 0;
+    indices[index_offset + 1] = vertex_offset + 3;
+    indices[index_offset + 2] = vertex_offset + 2;
+
+    // Bottom triangle.
+    indices[index_offset + 3] = vertex_offset + 0;
+    indices[index_offset + 4] = vertex_offset + 1;
+    indices[index_offset + 5] = vertex_offset + 3;
+  }
+}
@@ -0,0 +1,26 @@
+#ifndef SNAKE_VERTEX_H
+#define SNAKE_VERTEX_H
+
+#include <stddef.h>
+
+#include "map.h"
+#include "vec.h"
+
+typedef struct {
+  Vec2I pos;
+  unsigned int type;
+} Vertex;
+
+#define VERTEX_UNPADDED_SIZE sizeof(Vec2I) + sizeof(unsigned int)
+#define VERTEX_IS_UNPADDED sizeof(Vertex) == VERTEX_UNPADDED_SIZE
+
+// Writing vertices and indices does not touch OpenGL, so it is kept apart
+// from geometry.c and can be used without a window, e.g. by snake-bench.
+void write_vertices(const Map *map, Vertex *vertices);
+void write_cell_vertices(const Map *map, Vertex *vertices, size_t first_cell,
+                         size_t cell_count);
+void write_indices(const Map *map, unsigned int *indices);
+void write_quad(Vertex *vertices, Vec2I min, Vec2I max, CellType type);
+void write_quad_indices(unsigned int *indices, size_t quad_count);
+
+#endif // !SNAKE_VERTEX_H
@@ -0,0 +1,96 @@
+// Walks a snake across every edge of open maps whose sides are not powers of
+// two, checking that map_wrap_pos lands on the cell at the other side and
+// that the body stays linked as it wraps. Exits with a failure if any check
+// does not hold.
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "arena.h"
+#include "map.h"
+#include "player.h"
+#include "vec.h"
+
+#define SNAKE_LENGTH 4
+
+static unsigned int failures = 0;
+
+static void check(bool condition, const char *what, unsigned int width,
+                  unsigned int height, Vec2I direction) {
+  if (condition)
+    return;
+  fprintf(stderr, "%ux%u moving %d,%d: %s\n", width, height, direction.x,
+          direction.y, what);
+  ++failures;
+}
+
+static int wrap(int value, int size) {
+  return ((value % size) + size) % size;
+}
+
+// Moves a snake twice around the map in a direction, starting near the low
+// edge so that it crosses it straight away when moving down or left.
+static void walk(Map *map, Arena *arena, Vec2I direction) {
+  const Vec2I bounds = vec2i(map->width, map->height);
+  const Vec2I start = vec2i(1, 1);
+  Player player;
+  player_init(&player);
+  player_spawn(&player, arena, bounds, start,
+               map_wrap_pos(map, vec2i_sub(start, direction)));
+  player_reserve(&player, arena, SNAKE_LENGTH + 1);
+  while (player.count < SNAKE_LENGTH) {
+    const Vec2I tail = map_wrap_pos(map, vec2i_sub(player.tail, direction));
+    player_push_back(&player, tail);
+  }
+
+  const int steps = 2 * (direction.x != 0 ? map->width : map->height);
+  for (int i = 1; i <= steps; ++i) {
+    const Vec2I head =
+        map_wrap_pos(map, vec2i_add(player_front(&player), direction));
+    const Vec2I expected = vec2i(wrap(start.x + i * direction.x, bounds.x),
+                                 wrap(start.y + i * direction.y, bounds.y));
+    check(vec2i_eq(head, expected), "wrapped to the wrong cell", map->width,
+          map->height, direction);
+    player_push_front(&player, head);
+    player_pop_back(&player);
+  }
+
+  PlayerCursor cursor = player_cursor(&player);
+  Vec2I pos;
+  size_t count = 0;
+  while (player_cursor_next(&cursor, &pos)) {
+    check(pos.x >= 0 && pos.x < bounds.x && pos.y >= 0 && pos.y < bounds.y,
+          "segment outside of the map", map->width, map->height, direction);
+    ++count;
+  }
+  check(count == SNAKE_LENGTH, "body lost segments", map->width, map->height,
+        direction);
+  player_free(&player, arena);
+}
+
+int main(void) {
+  static const struct {
+    unsigned int width;
+    unsigned int height;
+  } sizes[] = {{30, 10}, {33, 17}, {65, 3}};
+  const Vec2I directions[] = {VEC2I_RIGHT, VEC2I_LEFT, VEC2I_UP, VEC2I_DOWN};
+
+  Arena arena;
+  arena_init(&arena, sizeof(uint64_t));
+  Map map;
+  map_init(&map);
+  for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); ++i) {
+    map_set_dimensions(&map, sizes[i].width, sizes[i].height);
+    for (size_t j = 0; j < sizeof(directions) / sizeof(directions[0]); ++j) {
+      walk(&map, &arena, directions[j]);
+    }
+  }
+  map_free(&map);
+  arena_free(&arena);
+
+  if (failures > 0)
+    return EXIT_FAILURE;
+  printf("wrap: ok\n");
+  return EXIT_SUCCESS;
+}